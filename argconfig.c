@@ -32,6 +32,7 @@
 #include "argconfig.h"
 #include "suffix.h"
 
+#include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
 #include <stdio.h>
@@ -134,87 +135,144 @@ void argconfig_print_help(const char *program_desc,
 		show_option(s);
 }
 
+/*
+ * getopt tables of one command. They only depend on the names, short
+ * options and argument types of its option descriptors, never on the
+ * config they fill in, so they are built the first time a command parses
+ * its options and reused for the rest of the process, which matters to
+ * batch and daemon mode. Commands are told apart by their description
+ * string and a table is only reused if every descriptor still matches.
+ */
+struct argconfig_tables {
+	const char *desc;
+	int count;
+	struct option *long_opts;	/* count + "help" + end */
+	char *short_opts;
+	char *shorts;			/* short option of each descriptor */
+	unsigned char short_index[128];	/* descriptor by short option, +1 */
+};
+
+#define ARGCONFIG_TABLES	256
+
+static struct argconfig_tables *argconfig_tables[ARGCONFIG_TABLES];
+
+static bool argconfig_tables_match(const struct argconfig_tables *t,
+				   const struct argconfig_commandline_options *options,
+				   int count)
+{
+	int i;
+
+	if (t->count != count)
+		return false;
+	for (i = 0; i < count; i++)
+		if (t->long_opts[i].name != options[i].option ||
+		    t->long_opts[i].has_arg != options[i].argument_type ||
+		    t->shorts[i] != options[i].short_option)
+			return false;
+	return true;
+}
+
+static struct argconfig_tables *argconfig_tables_build(const char *desc,
+		const struct argconfig_commandline_options *options, int count)
+{
+	const struct argconfig_commandline_options *s;
+	struct argconfig_tables *t;
+	int i, short_index = 0;
+	unsigned char c;
+
+	t = calloc(1, sizeof(*t) + (count + 2) * sizeof(*t->long_opts) +
+		   (count * 3 + 4) + count);
+	if (!t)
+		return NULL;
+	t->desc = desc;
+	t->count = count;
+	t->long_opts = (struct option *)(t + 1);
+	t->short_opts = (char *)(t->long_opts + count + 2);
+	t->shorts = t->short_opts + count * 3 + 4;
+
+	for (i = 0, s = options; i < count; i++, s++) {
+		c = s->short_option;
+		t->shorts[i] = s->short_option;
+		if (c) {
+			t->short_opts[short_index++] = c;
+			if (s->argument_type == required_argument ||
+			    s->argument_type == optional_argument)
+				t->short_opts[short_index++] = ':';
+			if (s->argument_type == optional_argument)
+				t->short_opts[short_index++] = ':';
+			if (c < 128 && !t->short_index[c] && i < 255)
+				t->short_index[c] = i + 1;
+		}
+		/* flags are set below, not through getopt's flag pointer */
+		t->long_opts[i].name = s->option;
+		t->long_opts[i].has_arg = s->argument_type;
+	}
+
+	t->long_opts[i].name = "help";
+	t->long_opts[i].val = 'h';
+
+	t->short_opts[short_index++] = '?';
+	t->short_opts[short_index++] = 'h';
+	t->short_opts[short_index] = 0;
+	return t;
+}
+
+static struct argconfig_tables *argconfig_tables_get(const char *desc,
+		const struct argconfig_commandline_options *options, int count)
+{
+	struct argconfig_tables **slot;
+
+	slot = &argconfig_tables[((uintptr_t)desc >> 3) % ARGCONFIG_TABLES];
+	if (*slot && (*slot)->desc == desc &&
+	    argconfig_tables_match(*slot, options, count))
+		return *slot;
+
+	free(*slot);
+	*slot = argconfig_tables_build(desc, options, count);
+	return *slot;
+}
+
 int argconfig_parse(int argc, char *argv[], const char *program_desc,
 		    const struct argconfig_commandline_options *options,
 		    void *config_out, size_t config_size)
 {
-	char *short_opts;
 	char *endptr;
-	struct option *long_opts;
 	const struct argconfig_commandline_options *s;
-	int c, option_index = 0, short_index = 0, options_count = 0;
+	struct argconfig_tables *t;
+	struct option *long_opts;
+	int c, option_index = 0, options_count = 0;
 	void *value_addr;
 
 	errno = 0;
 	for (s = options; s->option != NULL; s++)
 		options_count++;
 
-	long_opts = malloc(sizeof(struct option) * (options_count + 2));
-	short_opts = malloc(sizeof(*short_opts) * (options_count * 3 + 4));
-
-	for (s = options; (s->option != NULL) && (option_index < options_count);
-	     s++) {
-		if (s->short_option != 0) {
-			short_opts[short_index++] = s->short_option;
-			if (s->argument_type == required_argument ||
-			    s->argument_type == optional_argument)
-				short_opts[short_index++] = ':';
-			if (s->argument_type == optional_argument)
-				short_opts[short_index++] = ':';
-		}
-		if (s->option && strlen(s->option)) {
-			long_opts[option_index].name = s->option;
-			long_opts[option_index].has_arg = s->argument_type;
-
-			if (s->argument_type == no_argument
-			    && s->default_value != NULL) {
-				value_addr = (void *)(char *)s->default_value;
-
-				long_opts[option_index].flag = value_addr;
-				long_opts[option_index].val = 1;
-			} else {
-				long_opts[option_index].flag = NULL;
-				long_opts[option_index].val = 0;
-			}
-		}
-		option_index++;
+	t = argconfig_tables_get(program_desc, options, options_count);
+	if (!t) {
+		fprintf(stderr, "can not allocate option tables\n");
+		return -ENOMEM;
 	}
-
-	long_opts[option_index].name = "help";
-	long_opts[option_index].flag = NULL;
-	long_opts[option_index].val = 'h';
-	option_index++;
-
-	long_opts[option_index].name = NULL;
-	long_opts[option_index].flag = NULL;
-	long_opts[option_index].val = 0;
-
-	short_opts[short_index++] = '?';
-	short_opts[short_index++] = 'h';
-	short_opts[short_index] = 0;
+	long_opts = t->long_opts;
 
 	optind = 0;
-	while ((c = getopt_long_only(argc, argv, short_opts, long_opts,
+	while ((c = getopt_long_only(argc, argv, t->short_opts, long_opts,
 				&option_index)) != -1) {
 		if (c != 0) {
 			if (c == '?' || c == 'h') {
 				argconfig_print_help(program_desc, options);
 				goto out;
 			}
-			for (option_index = 0; option_index < options_count;
-			     option_index++) {
-				if (c == options[option_index].short_option)
-					break;
-			}
-			if (option_index == options_count)
+			if (c >= 128 || !t->short_index[c])
 				continue;
-			if (long_opts[option_index].flag) {
-				*(uint8_t *)(long_opts[option_index].flag) = 1;
-				continue;
-			}
+			option_index = t->short_index[c] - 1;
 		}
 
 		s = &options[option_index];
+		if (s->argument_type == no_argument && s->default_value) {
+			*(uint8_t *)s->default_value = 1;
+			continue;
+		}
+
 		value_addr = (void *)(char *)s->default_value;
 		if (s->config_type == CFG_STRING) {
 			*((char **)value_addr) = optarg;
@@ -353,13 +411,8 @@ int argconfig_parse(int argc, char *argv[], const char *program_desc,
 			*((FILE **) value_addr) = f;
 		}
 	}
-	free(short_opts);
-	free(long_opts);
-
 	return 0;
  out:
-	free(short_opts);
-	free(long_opts);
 	return -EINVAL;
 }
 
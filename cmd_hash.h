@@ -0,0 +1,109 @@
+/* Generated by gen-cmd-hash.awk from the command headers, do not edit */
+
+#define CMD_HASH_BUCKETS	44
+#define CMD_HASH_SLOTS		108
+
+static const unsigned short cmd_hash_mul[CMD_HASH_BUCKETS] = {
+	37, 33, 43, 35, 33, 39, 33, 79, 33, 51, 33, 33, 33, 33, 33, 37, 33, 33,
+	85, 33, 37, 33, 41, 33, 37, 33, 49, 57, 35, 55, 37, 33, 39, 33, 33, 95,
+	37, 33, 33, 45, 49, 39, 43, 43,
+};
+
+static const struct cmd_hash_entry cmd_hash[CMD_HASH_SLOTS] = {
+	[0] = { NULL, "get-ns-id", 12 },
+	[1] = { NULL, "set-feature", 20 },
+	[6] = { "wdc", "purge-monitor", 5 },
+	[7] = { "wdc", "drive-log", 1 },
+	[9] = { "lnvm", "diag-bbtbl", 7 },
+	[10] = { "intel", "temp-stats", 3 },
+	[11] = { NULL, "error-log", 16 },
+	[12] = { "lnvm", "diag-set-bbtbl", 8 },
+	[13] = { NULL, "security-send", 27 },
+	[14] = { NULL, "disconnect", 49 },
+	[15] = { NULL, "show-regs", 45 },
+	[16] = { NULL, "admin-passthru", 25 },
+	[17] = { NULL, "id-ctrl", 3 },
+	[18] = { NULL, "list-ns", 5 },
+	[19] = { NULL, "id-ns", 4 },
+	[21] = { NULL, "resv-report", 32 },
+	[22] = { "wdc", "smart-add-log", 6 },
+	[23] = { NULL, "fw-activate", 23 },
+	[25] = { NULL, "get-feature", 19 },
+	[26] = { NULL, "connect-all", 47 },
+	[27] = { "intel", "lat-stats", 4 },
+	[29] = { NULL, "discover", 46 },
+	[30] = { NULL, "resv-release", 31 },
+	[31] = { "wdc", "get-crash-dump", 2 },
+	[32] = { "intel", "internal-log", 5 },
+	[33] = { NULL, "format", 22 },
+	[34] = { NULL, "path-bench", 2 },
+	[35] = { NULL, "delete-ns", 8 },
+	[36] = { NULL, "dsm", 33 },
+	[38] = { NULL, "sanitize-log", 41 },
+	[39] = { NULL, "fw-commit", 23 },
+	[40] = { NULL, "fw-log", 14 },
+	[41] = { NULL, "sanitize", 40 },
+	[42] = { NULL, "batch", 53 },
+	[43] = { NULL, "reset", 42 },
+	[44] = { "lnvm", "id-ns", 2 },
+	[46] = { NULL, "dir-send", 57 },
+	[47] = { "huawei", "list", 0 },
+	[48] = { NULL, "fw-download", 24 },
+	[49] = { NULL, "subsystem-reset", 43 },
+	[50] = { "huawei", "id-ctrl", 1 },
+	[51] = { "lnvm", "factory", 6 },
+	[52] = { NULL, "read", 36 },
+	[54] = { NULL, "fabric-health", 52 },
+	[55] = { "intel", "id-ctrl", 0 },
+	[56] = { "memblaze", "get-feature-add", 1 },
+	[58] = { NULL, "list-subsys", 1 },
+	[59] = { NULL, "io-passthru", 26 },
+	[61] = { NULL, "effects-log", 17 },
+	[62] = { "intel", "market-name", 2 },
+	[63] = { NULL, "dir-receive", 56 },
+	[65] = { "lnvm", "create", 4 },
+	[67] = { NULL, "write-uncor", 39 },
+	[69] = { "memblaze", "smart-log-add", 0 },
+	[70] = { "intel", "smart-log-add", 1 },
+	[71] = { NULL, "write", 37 },
+	[72] = { NULL, "monitor", 51 },
+	[73] = { "lnvm", "list", 0 },
+	[74] = { NULL, "connect", 48 },
+	[76] = { NULL, "write-zeroes", 38 },
+	[78] = { NULL, "ns-rescan", 44 },
+	[79] = { NULL, "reconnect", 50 },
+	[80] = { NULL, "flush", 34 },
+	[81] = { "wdc", "purge", 4 },
+	[82] = { NULL, "set-property", 21 },
+	[83] = { NULL, "resv-acquire", 29 },
+	[84] = { NULL, "daemon", 54 },
+	[85] = { "lnvm", "init", 3 },
+	[86] = { NULL, "create-ns", 7 },
+	[87] = { NULL, "get-log", 13 },
+	[88] = { NULL, "ns-descs", 6 },
+	[89] = { "wdc", "id-ctrl", 3 },
+	[90] = { NULL, "list-ctrl", 11 },
+	[91] = { NULL, "attach-ns", 9 },
+	[94] = { NULL, "gen-hostnqn", 55 },
+	[95] = { "lnvm", "remove", 5 },
+	[96] = { "memblaze", "set-feature-add", 2 },
+	[97] = { NULL, "security-recv", 28 },
+	[98] = { NULL, "resv-register", 30 },
+	[99] = { NULL, "ana-log", 18 },
+	[100] = { "wdc", "cap-diag", 0 },
+	[103] = { NULL, "detach-ns", 10 },
+	[104] = { NULL, "list", 0 },
+	[105] = { "lnvm", "info", 1 },
+	[106] = { NULL, "smart-log", 15 },
+	[107] = { NULL, "compare", 35 },
+};
+
+/* plugins whose commands are all in cmd_hash[] */
+static const char *const cmd_hash_plugins[] = {
+	"intel",
+	"lnvm",
+	"memblaze",
+	"wdc",
+	"huawei",
+	NULL
+};
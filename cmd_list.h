@@ -0,0 +1,22 @@
+/*
+ * Command headers read once more, the way cmd_handler.h reads them, but
+ * only to list command names. The Makefile preprocesses this file
+ * followed by every command header, each preceded by CMD_FILE, and feeds
+ * the result to gen-cmd-hash.awk, which builds the dispatch table in
+ * cmd_hash.h. A header lists the built-in commands until it names a
+ * plugin; an entry's index is its place in the COMMAND_LIST.
+ */
+
+#include "cmd.h"
+
+#undef NAME
+#define NAME(n, d) CMD_PLUGIN n
+
+#undef ENTRY
+#define ENTRY(n, h, f, ...) CMD_ENTRY n __VA_ARGS__
+
+#undef COMMAND_LIST
+#define COMMAND_LIST(args...) args
+
+#undef PLUGIN
+#define PLUGIN(name, cmds) name cmds
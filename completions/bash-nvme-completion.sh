@@ -4,14 +4,14 @@
 
 _cmds="list id-ctrl id-ns list-ns create-ns delete-ns \
 	attach-ns detach-ns list-ctrl get-ns-id get-log \
-	fw-log smart-log smart-log-add error-log \
+	fw-log smart-log smart-log-add error-log ana-log \
 	get_feature set-feature format fw-activate \
 	fw-download admin-passthru io-passthru security-send \
 	security-recv resv-acquire resv-register resv-release \
 	resv-report dsm flush compare read write write-zeroes \
 	write-uncor reset subsystem-reset show-regs discover \
-	connect-all connect disconnect version help \
-	intel lnvm memblaze list-subsys"
+	connect-all connect disconnect reconnect monitor fabric-health version \
+	help intel lnvm memblaze list-subsys path-bench batch daemon"
 
 nvme_list_opts () {
         local opts=""
@@ -32,7 +32,10 @@ nvme_list_opts () {
 
 	case "$1" in
 		"list")
-		opts=""
+		opts+=" --output-format= -o --watch -w"
+		;;
+		"list-subsys")
+		opts+=" --output-format= -o --ana -a"
 		;;
 		"id-ctrl")
 		opts+=" --raw-binary -b --human-readable -H \
@@ -44,7 +47,8 @@ nvme_list_opts () {
 			--force -f --output-format= -o"
 			;;
 		"list-ns")
-		opts+=" --namespace-id= -n --al -a"
+		opts+=" --namespace-id= -n --al -a --detail -d \
+			--output-format= -o"
 			;;
 		"create-ns")
 		opts+=" --nsze= -s --ncap= -c --flbas= -f \
@@ -82,6 +86,10 @@ nvme_list_opts () {
 		opts+=" --namespace-id= -n --raw-binary -b --log-entries= -e \
 			--output-format= -o"
 			;;
+		"ana-log")
+		opts+=" --groups-only -g --fresh -f --output-format= -o \
+			--raw-binary -b"
+			;;
 		"get-feature")
 		opts+=" --namespace-id= -n --feature-id= -f --sel= -s \
 			--data-len= -l --cdw11= --raw-binary -b \
@@ -193,19 +201,50 @@ nvme_list_opts () {
 			;;
 		"discover")
 		opts+=" --transport= -t -traddr= -a -trsvcid= -s \
-			--hostnqn= -q --raw= -r"
+			--hostnqn= -q --raw= -r --persistent -p
+			--nr-write-queues= -W --nr-poll-queues= -P --tos= -T
+			--hdr_digest -g --data_digest -G
+			--remove-stale -R --auto-queues -A --log= --timing"
 			;;
 		"connect-all")
 		opts+=" --transport= -t --traddr= -a --trsvcid= -s
-			--hostnqn= -q --raw= -r"
+			--hostnqn= -q --raw= -r --parallel= -C
+			--duplicate_connect -D --nr-write-queues= -W
+			--nr-poll-queues= -P --tos= -T --hdr_digest -g
+			--data_digest -G --auto-queues -A --log= --timing"
 			;;
 		"connect")
 		opts+=" --transport= -t --nqn= -n --traddr= -a --trsvcid -s \
 			--hostnqn= -q --nr-io-queues= -i --keep-alive-tmo -k \
-			--reconnect-delay -r"
+			--reconnect-delay -r --nr-write-queues= -W \
+			--nr-poll-queues= -P --tos= -T --hdr_digest -g \
+			--data_digest -G --auto-queues -A --log= --timing \
+			--manifest= -m --parallel= -C"
 			;;
 		"disconnect")
-		opts+=" --nqn -n --device -d"
+		opts+=" --nqn -n --device -d --all -A --log= --timing"
+			;;
+		"reconnect")
+		opts+=" --nqn= -n --hostnqn= -q --parallel= -C --retries= -r
+			--backoff= -b --jitter= -j --stagger= -s --log= --timing"
+			;;
+		"monitor")
+		opts+=" --exec= -x --reconnect -r --invalidate -i --retries=
+			--backoff= --output-format= -o"
+			;;
+		"fabric-health")
+		opts+=" --log= -l"
+			;;
+		"path-bench")
+		opts+=" --namespace-id= -n --count= -c --warmup= -w \
+			--data-size= -z --threshold= -t --concurrent -C \
+			--output-format= -o"
+			;;
+		"batch")
+		opts+=" --file= -f --stop-on-error -e --output-format= -o"
+			;;
+		"daemon")
+		opts+=" --socket= -s --workers= -w --min-interval= -i"
 			;;
 		"version")
 		opts+=""
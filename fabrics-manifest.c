@@ -0,0 +1,314 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fabrics-manifest.h"
+
+/*
+ * Reader for 'connect --manifest'. Two layouts are accepted:
+ *
+ *  - discovery.conf syntax, one target per line:
+ *	-t tcp -a 192.168.1.3 -s 4420 -n nqn.2014-08.com.example:sub1
+ *
+ *  - a JSON array of flat objects keyed by long option name:
+ *	[ { "transport": "tcp", "traddr": "192.168.1.3",
+ *	    "trsvcid": 4420, "nqn": "nqn.2014-08.com.example:sub1",
+ *	    "hdr_digest": true } ]
+ *
+ * Both end up as argv vectors that go through the same option parsing as
+ * the command line, so there is one place that knows the options.
+ */
+
+#define MANIFEST_MAX_ARGS	64
+
+struct json_reader {
+	const char *p;
+	const char *start;
+	const char *path;
+};
+
+static int add_arg(struct manifest_entry *e, const char *s, size_t len)
+{
+	char *arg;
+
+	if (e->argc >= MANIFEST_MAX_ARGS - 1)
+		return -E2BIG;
+	arg = strndup(s, len);
+	if (!arg)
+		return -ENOMEM;
+	e->argv[e->argc++] = arg;
+	return 0;
+}
+
+static struct manifest_entry *new_entry(struct manifest *m, int line)
+{
+	struct manifest_entry *tmp, *e;
+
+	tmp = realloc(m->entries, (m->n + 1) * sizeof(*m->entries));
+	if (!tmp)
+		return NULL;
+	m->entries = tmp;
+
+	e = &m->entries[m->n];
+	e->line = line;
+	e->argc = 0;
+	e->argv = calloc(MANIFEST_MAX_ARGS, sizeof(char *));
+	if (!e->argv || add_arg(e, "connect", 7)) {
+		free(e->argv);
+		return NULL;
+	}
+	m->n++;
+	return e;
+}
+
+static int load_conf(const char *buf, struct manifest *m)
+{
+	struct manifest_entry *e;
+	const char *p = buf, *eol, *tok;
+	int line = 0, ret;
+	size_t len;
+
+	for (; *p; p = *eol ? eol + 1 : eol) {
+		eol = p + strcspn(p, "\n");
+		line++;
+
+		p += strspn(p, " \t\r");
+		if (p == eol || *p == '#')
+			continue;
+
+		e = new_entry(m, line);
+		if (!e)
+			return -ENOMEM;
+
+		while (p < eol) {
+			len = strcspn(p, " =\t\r\n");
+			if (p + len > eol)
+				len = eol - p;
+			tok = p;
+			p += len;
+			p += strspn(p, " =\t\r");
+			if (!len)
+				continue;
+			ret = add_arg(e, tok, len);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+static int json_line(struct json_reader *r)
+{
+	const char *p;
+	int line = 1;
+
+	for (p = r->start; p < r->p; p++)
+		if (*p == '\n')
+			line++;
+	return line;
+}
+
+static int json_error(struct json_reader *r, const char *what)
+{
+	fprintf(stderr, "%s:%d: %s\n", r->path, json_line(r), what);
+	return -EINVAL;
+}
+
+static void json_skip(struct json_reader *r)
+{
+	while (isspace((unsigned char)*r->p))
+		r->p++;
+}
+
+static bool json_expect(struct json_reader *r, char c)
+{
+	json_skip(r);
+	if (*r->p != c)
+		return false;
+	r->p++;
+	return true;
+}
+
+/* Unescape a JSON string into @buf; only ASCII \u escapes are accepted */
+static int json_string(struct json_reader *r, char *buf, size_t len)
+{
+	size_t n = 0;
+	unsigned int u;
+	char c;
+
+	if (!json_expect(r, '"'))
+		return json_error(r, "expected a string");
+
+	while (*r->p != '"') {
+		c = *r->p++;
+		if (!c || c == '\n')
+			return json_error(r, "unterminated string");
+		if (c == '\\') {
+			c = *r->p++;
+			switch (c) {
+			case 'n': c = '\n'; break;
+			case 't': c = '\t'; break;
+			case '"': case '\\': case '/': break;
+			case 'u':
+				if (sscanf(r->p, "%4x", &u) != 1 || u > 0x7f)
+					return json_error(r, "unsupported escape");
+				c = u;
+				r->p += 4;
+				break;
+			default:
+				return json_error(r, "unsupported escape");
+			}
+		}
+		if (n + 1 >= len)
+			return json_error(r, "string too long");
+		buf[n++] = c;
+	}
+	r->p++;
+	buf[n] = '\0';
+	return 0;
+}
+
+static int json_object(struct json_reader *r, struct manifest *m)
+{
+	struct manifest_entry *e;
+	char key[64], opt[68], val[1024];
+	size_t len;
+	int ret;
+
+	json_skip(r);
+	e = new_entry(m, json_line(r));
+	if (!e)
+		return -ENOMEM;
+	if (!json_expect(r, '{'))
+		return json_error(r, "expected an object for each target");
+	if (json_expect(r, '}'))
+		return 0;
+
+	do {
+		ret = json_string(r, key, sizeof(key));
+		if (ret)
+			return ret;
+		if (!json_expect(r, ':'))
+			return json_error(r, "expected ':'");
+		snprintf(opt, sizeof(opt), "--%s", key);
+
+		json_skip(r);
+		if (*r->p == '"') {
+			ret = json_string(r, val, sizeof(val));
+			if (!ret)
+				ret = add_arg(e, opt, strlen(opt));
+			if (!ret)
+				ret = add_arg(e, val, strlen(val));
+		} else if (!strncmp(r->p, "true", 4)) {
+			r->p += 4;
+			ret = add_arg(e, opt, strlen(opt));
+		} else if (!strncmp(r->p, "false", 5)) {
+			r->p += 5;
+		} else if (*r->p == '-' || isdigit((unsigned char)*r->p)) {
+			len = strspn(r->p, "-+.0123456789eE");
+			ret = add_arg(e, opt, strlen(opt));
+			if (!ret)
+				ret = add_arg(e, r->p, len);
+			r->p += len;
+		} else {
+			return json_error(r,
+				"values must be strings, numbers or booleans");
+		}
+		if (ret)
+			return ret;
+	} while (json_expect(r, ','));
+
+	if (!json_expect(r, '}'))
+		return json_error(r, "expected ',' or '}'");
+	return 0;
+}
+
+static int load_json(const char *buf, const char *path, struct manifest *m)
+{
+	struct json_reader r = { .p = buf, .start = buf, .path = path };
+	int ret;
+
+	if (!json_expect(&r, '['))
+		return json_error(&r, "expected an array of targets");
+	if (json_expect(&r, ']'))
+		return 0;
+
+	do {
+		ret = json_object(&r, m);
+		if (ret)
+			return ret;
+	} while (json_expect(&r, ','));
+
+	if (!json_expect(&r, ']'))
+		return json_error(&r, "expected ',' or ']'");
+	json_skip(&r);
+	if (*r.p)
+		return json_error(&r, "trailing data after the target array");
+	return 0;
+}
+
+/**
+ * manifest_load: - read a connect manifest
+ * @path: file in JSON or discovery.conf layout; JSON if the first
+ *	  non-blank character is '['
+ * @m: filled in on success, release with manifest_free()
+ */
+int manifest_load(const char *path, struct manifest *m)
+{
+	char *buf = NULL;
+	size_t len = 0, alloc = 0, got;
+	FILE *f;
+	int ret;
+
+	memset(m, 0, sizeof(*m));
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		return -errno;
+	}
+	do {
+		if (len + 4096 + 1 > alloc) {
+			char *tmp = realloc(buf, alloc + 65536);
+
+			if (!tmp) {
+				fclose(f);
+				free(buf);
+				return -ENOMEM;
+			}
+			buf = tmp;
+			alloc += 65536;
+		}
+		got = fread(buf + len, 1, 4096, f);
+		len += got;
+	} while (got);
+	fclose(f);
+	buf[len] = '\0';
+
+	if (buf[strspn(buf, " \t\r\n")] == '[')
+		ret = load_json(buf, path, m);
+	else
+		ret = load_conf(buf, m);
+	free(buf);
+
+	if (ret)
+		manifest_free(m);
+	return ret;
+}
+
+void manifest_free(struct manifest *m)
+{
+	int i, j;
+
+	for (i = 0; i < m->n; i++) {
+		for (j = 0; j < m->entries[i].argc; j++)
+			free(m->entries[i].argv[j]);
+		free(m->entries[i].argv);
+	}
+	free(m->entries);
+	memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,23 @@
+#ifndef _FABRICS_MANIFEST_H
+#define _FABRICS_MANIFEST_H
+
+/*
+ * One target of a connect manifest, turned into the command line it
+ * stands for: argv[0] is "connect", followed by "--option" and, for
+ * options that take one, its value.
+ */
+struct manifest_entry {
+	int line;
+	int argc;
+	char **argv;
+};
+
+struct manifest {
+	struct manifest_entry *entries;
+	int n;
+};
+
+int manifest_load(const char *path, struct manifest *m);
+void manifest_free(struct manifest *m);
+
+#endif
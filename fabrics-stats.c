@@ -0,0 +1,387 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fabrics-stats.h"
+#include "hash.h"
+
+/*
+ * Timing of fabrics operations. Every controller create, discovery log
+ * read and controller delete is timed on CLOCK_MONOTONIC and tagged with
+ * the target it went to (transport, traddr, trsvcid, subsystem NQN).
+ * Outcomes can be appended to a log as one JSON object per line and/or
+ * folded into a per target table, printed slowest first. The log can be
+ * read back later to build the same table over many runs.
+ *
+ * Recording is a no-op until fabrics_stats_init() asked for a log or a
+ * table. It may be called from connect-all worker threads.
+ */
+
+#define STATS_FIELD_LEN		256
+#define STATS_ERROR_LEN		64
+#define STATS_LINE_LEN		2048
+
+struct stats_target {
+	char transport[16];
+	char traddr[STATS_FIELD_LEN];
+	char trsvcid[32];
+	char host_traddr[STATS_FIELD_LEN];
+	char nqn[STATS_FIELD_LEN];
+};
+
+struct stats_row {
+	enum fabrics_op op;
+	char target[STATS_LINE_LEN];
+	unsigned int count;
+	unsigned int failed;
+	double total;
+	double max;
+	char error[STATS_ERROR_LEN];
+};
+
+static const char * const op_names[] = {
+	[FABRICS_OP_CONNECT]	= "connect",
+	[FABRICS_OP_DISCOVER]	= "discover",
+	[FABRICS_OP_DELETE]	= "delete",
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hash_table stats_rows;
+static bool stats_table;
+static int stats_log_fd = -1;
+
+int fabrics_stats_init(const char *log_path, bool table)
+{
+	if (log_path) {
+		stats_log_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT,
+				    0644);
+		if (stats_log_fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", log_path,
+				strerror(errno));
+			return -errno;
+		}
+	}
+	if (table && !stats_table) {
+		if (hash_init(&stats_rows, 64))
+			return -ENOMEM;
+		stats_table = true;
+	}
+	return 0;
+}
+
+bool fabrics_stats_enabled(void)
+{
+	return stats_log_fd >= 0 || stats_table;
+}
+
+void fabrics_stats_start(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/* Copy the value of "name=value" out of a comma separated option string */
+static void opt_field(const char *opts, const char *name, char *buf,
+		      size_t len)
+{
+	size_t nlen = strlen(name), vlen;
+	const char *p = opts, *end;
+
+	buf[0] = '\0';
+	while (p && *p) {
+		end = strchr(p, ',');
+		if (!strncmp(p, name, nlen) && p[nlen] == '=') {
+			p += nlen + 1;
+			vlen = end ? (size_t)(end - p) : strcspn(p, "\n");
+			if (vlen >= len)
+				vlen = len - 1;
+			memcpy(buf, p, vlen);
+			buf[vlen] = '\0';
+			return;
+		}
+		p = end ? end + 1 : NULL;
+	}
+}
+
+static void parse_target(const char *opts, struct stats_target *t)
+{
+	opt_field(opts, "transport", t->transport, sizeof(t->transport));
+	opt_field(opts, "traddr", t->traddr, sizeof(t->traddr));
+	opt_field(opts, "trsvcid", t->trsvcid, sizeof(t->trsvcid));
+	opt_field(opts, "host_traddr", t->host_traddr,
+		  sizeof(t->host_traddr));
+	opt_field(opts, "nqn", t->nqn, sizeof(t->nqn));
+}
+
+static void target_label(const struct stats_target *t, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s %s%s%s %s", t->transport[0] ? t->transport : "-",
+		 t->traddr[0] ? t->traddr : "-", t->trsvcid[0] ? ":" : "",
+		 t->trsvcid, t->nqn[0] ? t->nqn : "-");
+}
+
+static void add_row(enum fabrics_op op, const char *target, double msecs,
+		    const char *error)
+{
+	char key[STATS_LINE_LEN + 16];
+	struct stats_row *row;
+
+	snprintf(key, sizeof(key), "%d %s", op, target);
+	row = hash_lookup(&stats_rows, key);
+	if (!row) {
+		row = calloc(1, sizeof(*row));
+		if (!row)
+			return;
+		row->op = op;
+		snprintf(row->target, sizeof(row->target), "%s", target);
+		if (hash_insert(&stats_rows, key, row)) {
+			free(row);
+			return;
+		}
+	}
+
+	row->count++;
+	row->total += msecs;
+	if (msecs > row->max)
+		row->max = msecs;
+	if (error) {
+		row->failed++;
+		snprintf(row->error, sizeof(row->error), "%s", error);
+	}
+}
+
+static size_t json_escape(char *out, size_t len, const char *in)
+{
+	size_t n = 0;
+
+	for (; *in && n + 7 < len; in++) {
+		unsigned char c = *in;
+
+		if (c == '"' || c == '\\') {
+			out[n++] = '\\';
+			out[n++] = c;
+		} else if (c < 0x20) {
+			n += snprintf(out + n, len - n, "\\u%04x", c);
+		} else {
+			out[n++] = c;
+		}
+	}
+	out[n] = '\0';
+	return n;
+}
+
+static void log_record(enum fabrics_op op, const struct stats_target *t,
+		       double msecs, const char *error)
+{
+	char line[STATS_LINE_LEN * 2], esc[STATS_LINE_LEN], stamp[32];
+	const char *fields[] = { "transport", t->transport, "traddr", t->traddr,
+				 "trsvcid", t->trsvcid, "host_traddr",
+				 t->host_traddr, "nqn", t->nqn };
+	struct timespec now;
+	struct tm tm;
+	size_t n, i;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	gmtime_r(&now.tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+	n = snprintf(line, sizeof(line), "{\"time\":\"%s\",\"op\":\"%s\"",
+		     stamp, op_names[op]);
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i += 2) {
+		if (!fields[i + 1][0])
+			continue;
+		json_escape(esc, sizeof(esc), fields[i + 1]);
+		n += snprintf(line + n, sizeof(line) - n, ",\"%s\":\"%s\"",
+			      fields[i], esc);
+	}
+	n += snprintf(line + n, sizeof(line) - n, ",\"msecs\":%.3f", msecs);
+	if (error) {
+		json_escape(esc, sizeof(esc), error);
+		n += snprintf(line + n, sizeof(line) - n,
+			      ",\"status\":\"failed\",\"error\":\"%s\"}\n", esc);
+	} else {
+		n += snprintf(line + n, sizeof(line) - n,
+			      ",\"status\":\"ok\"}\n");
+	}
+	if (n >= sizeof(line))
+		return;
+
+	/* one write per record keeps concurrent appenders from interleaving */
+	if (write(stats_log_fd, line, n) != (ssize_t)n)
+		fprintf(stderr, "Failed to write fabrics log: %s\n",
+			strerror(errno));
+}
+
+/**
+ * fabrics_stats_record: - account one finished fabrics operation
+ * @op: what was done
+ * @opts: option string naming the target, as written to /dev/nvme-fabrics
+ *	  ("transport=tcp,traddr=...,trsvcid=...,nqn=...")
+ * @error: NULL on success, otherwise a short description of the failure
+ * @start: time taken with fabrics_stats_start() before the operation
+ */
+void fabrics_stats_record(enum fabrics_op op, const char *opts,
+			  const char *error, const struct timespec *start)
+{
+	struct stats_target t;
+	struct timespec end;
+	char label[STATS_LINE_LEN];
+	double msecs;
+
+	if (!fabrics_stats_enabled())
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	msecs = (end.tv_sec - start->tv_sec) * 1000.0 +
+		(end.tv_nsec - start->tv_nsec) / 1000000.0;
+	parse_target(opts, &t);
+
+	pthread_mutex_lock(&stats_lock);
+	if (stats_log_fd >= 0)
+		log_record(op, &t, msecs, error);
+	if (stats_table) {
+		target_label(&t, label, sizeof(label));
+		add_row(op, label, msecs, error);
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/* Value of "key":"..." or "key":number in one of our own log lines */
+static int json_field(const char *line, const char *key, char *buf,
+		      size_t len)
+{
+	char pat[64];
+	const char *p;
+	size_t n = 0;
+
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	p = strstr(line, pat);
+	if (!p)
+		return -ENOENT;
+	p += strlen(pat);
+
+	if (*p != '"') {
+		n = strcspn(p, ",}");
+		if (n >= len)
+			n = len - 1;
+		memcpy(buf, p, n);
+		buf[n] = '\0';
+		return 0;
+	}
+	for (p++; *p && *p != '"' && n + 1 < len; p++) {
+		if (*p == '\\' && p[1])
+			p++;
+		buf[n++] = *p;
+	}
+	buf[n] = '\0';
+	return 0;
+}
+
+/**
+ * fabrics_stats_load: - fold a JSON log written by earlier runs into the
+ *			 table
+ * @log_path: file to read
+ */
+int fabrics_stats_load(const char *log_path)
+{
+	char line[STATS_LINE_LEN * 2], op[16], msecs[32], status[16];
+	char error[STATS_ERROR_LEN], label[STATS_LINE_LEN];
+	struct stats_target t;
+	unsigned int i;
+	FILE *f;
+
+	if (!stats_table && fabrics_stats_init(NULL, true))
+		return -ENOMEM;
+
+	f = fopen(log_path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", log_path,
+			strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (json_field(line, "op", op, sizeof(op)) ||
+		    json_field(line, "msecs", msecs, sizeof(msecs)) ||
+		    json_field(line, "status", status, sizeof(status)))
+			continue;
+		for (i = 0; i < sizeof(op_names) / sizeof(op_names[0]); i++)
+			if (!strcmp(op, op_names[i]))
+				break;
+		if (i == sizeof(op_names) / sizeof(op_names[0]))
+			continue;
+
+		memset(&t, 0, sizeof(t));
+		json_field(line, "transport", t.transport, sizeof(t.transport));
+		json_field(line, "traddr", t.traddr, sizeof(t.traddr));
+		json_field(line, "trsvcid", t.trsvcid, sizeof(t.trsvcid));
+		json_field(line, "nqn", t.nqn, sizeof(t.nqn));
+		if (strcmp(status, "ok") &&
+		    json_field(line, "error", error, sizeof(error)))
+			snprintf(error, sizeof(error), "%s", status);
+
+		target_label(&t, label, sizeof(label));
+		add_row(i, label, strtod(msecs, NULL),
+			strcmp(status, "ok") ? error : NULL);
+	}
+	fclose(f);
+	return 0;
+}
+
+static int row_cmp(const void *a, const void *b)
+{
+	const struct stats_row *ra = *(const struct stats_row **)a;
+	const struct stats_row *rb = *(const struct stats_row **)b;
+
+	if (ra->max != rb->max)
+		return ra->max < rb->max ? 1 : -1;
+	return strcmp(ra->target, rb->target);
+}
+
+/**
+ * fabrics_stats_report: - print the per target table, slowest first
+ */
+void fabrics_stats_report(void)
+{
+	struct stats_row **rows;
+	struct hash_entry *e;
+	unsigned int i, n = 0;
+
+	if (!stats_table || !stats_rows.count)
+		return;
+
+	rows = calloc(stats_rows.count, sizeof(*rows));
+	if (!rows)
+		return;
+	hash_for_each(&stats_rows, i, e)
+		rows[n++] = e->data;
+	qsort(rows, n, sizeof(*rows), row_cmp);
+
+	printf("%-9s %5s %5s %10s %10s  %s\n", "op", "count", "fail",
+	       "avg ms", "max ms", "target");
+	for (i = 0; i < n; i++) {
+		printf("%-9s %5u %5u %10.3f %10.3f  %s", op_names[rows[i]->op],
+		       rows[i]->count, rows[i]->failed,
+		       rows[i]->total / rows[i]->count, rows[i]->max,
+		       rows[i]->target);
+		if (rows[i]->failed)
+			printf(" (last error: %s)", rows[i]->error);
+		printf("\n");
+	}
+	free(rows);
+}
+
+void fabrics_stats_exit(void)
+{
+	if (stats_log_fd >= 0) {
+		close(stats_log_fd);
+		stats_log_fd = -1;
+	}
+	if (stats_table) {
+		hash_free(&stats_rows, free);
+		stats_table = false;
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef _FABRICS_STATS_H
+#define _FABRICS_STATS_H
+
+#include <stdbool.h>
+#include <time.h>
+
+enum fabrics_op {
+	FABRICS_OP_CONNECT,
+	FABRICS_OP_DISCOVER,
+	FABRICS_OP_DELETE,
+};
+
+int fabrics_stats_init(const char *log_path, bool table);
+bool fabrics_stats_enabled(void);
+void fabrics_stats_start(struct timespec *start);
+void fabrics_stats_record(enum fabrics_op op, const char *opts,
+			  const char *error, const struct timespec *start);
+int fabrics_stats_load(const char *log_path);
+void fabrics_stats_report(void);
+void fabrics_stats_exit(void);
+
+#endif
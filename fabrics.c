@@ -34,6 +34,10 @@
 #include <libgen.h>
 #include <sys/stat.h>
 #include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #include "parser.h"
 #include "nvme-ioctl.h"
@@ -43,10 +47,19 @@
 #include "argconfig.h"
 
 #include "common.h"
-
-#define NVMF_HOSTID_SIZE	36
-
-static struct config {
+#include "parallel.h"
+#include "hash.h"
+#include "nvme-resolve.h"
+#include "nvme-uevent.h"
+#include "nvme-scan.h"
+#include "nvme-topology.h"
+#include "fabrics-stats.h"
+#include "fabrics-manifest.h"
+#include "nvme-cache.h"
+#include "json.h"
+#include "libnvmf.h"
+
+struct config {
 	char *nqn;
 	char *transport;
 	char *traddr;
@@ -59,30 +72,64 @@ static struct config {
 	char *keep_alive_tmo;
 	char *reconnect_delay;
 	char *ctrl_loss_tmo;
+	char *nr_write_queues;
+	char *nr_poll_queues;
+	char *tos;
+	int  hdr_digest;
+	int  data_digest;
 	char *raw;
 	char *device;
 	int  duplicate_connect;
-} cfg = { NULL };
+	unsigned int parallel;
+	int  persistent;
+	int  remove_stale;
+	int  all;
+	int  auto_queues;
+	char *log;
+	int  timing;
+	char *manifest;
+	unsigned int retries;
+	unsigned int backoff;
+	unsigned int jitter;
+	unsigned int stagger;
+	char *exec;
+	int  reconnect;
+	int  invalidate;
+	char *output_format;
+};
+
+/*
+ * Options as parsed from the command line or discovery.conf. Code that
+ * runs once per connection (and may run on a connect-all worker thread)
+ * only reads from the snapshot it is handed, never from here. Every
+ * command clears it first, since 'batch' runs many in one process.
+ */
+static struct config cfg = { NULL };
 
 #define BUF_SIZE		4096
 #define PATH_NVME_FABRICS	"/dev/nvme-fabrics"
 #define PATH_NVMF_DISC		"/etc/nvme/discovery.conf"
-#define PATH_NVMF_HOSTNQN	"/etc/nvme/hostnqn"
-#define PATH_NVMF_HOSTID	"/etc/nvme/hostid"
 #define SYS_NVMF		"/sys/class/nvmf"
+#define PATH_NVMF_DISC_CACHE	NVME_RUN_DIR "/discovery"
+#define DISC_CACHE_MAGIC	"NVMFDLC1"
+#define PERSISTENT_RETRY	5	/* seconds between reconnect attempts */
+#define PERSISTENT_POLL		30	/* seconds, when AENs are unavailable */
+
+#define NVME_AEN_CFG_DISC_CHANGE	(1U << 31)
+
+#define AUTO_MAX_IO_QUEUES	32
+#define AUTO_MAX_POLL_QUEUES	4
+#define AUTO_DEPTH_BUDGET	4096	/* entries per controller */
+#define AUTO_MIN_QUEUE_SIZE	32
+#define AUTO_MAX_QUEUE_SIZE	1024
 #define MAX_DISC_ARGS		10
-
-enum {
-	OPT_INSTANCE,
-	OPT_CNTLID,
-	OPT_ERR
-};
-
-static const match_table_t opt_tokens = {
-	{ OPT_INSTANCE,		"instance=%d"	},
-	{ OPT_CNTLID,		"cntlid=%d"	},
-	{ OPT_ERR,		NULL		},
-};
+#define MANIFEST_RETRIES	3	/* attempts after the first one */
+#define MANIFEST_BACKOFF	1	/* seconds, doubled on every retry */
+#define RECONNECT_PARALLEL	4
+#define RECONNECT_RETRIES	5
+#define RECONNECT_BACKOFF	1000	/* ms before the first retry */
+#define RECONNECT_BACKOFF_MAX	60000	/* ms */
+#define RECONNECT_JITTER	50	/* percent of each delay */
 
 static const char *arg_str(const char * const *strings,
 		size_t array_size, size_t idx)
@@ -95,6 +142,7 @@ static const char *arg_str(const char * const *strings,
 static const char * const trtypes[] = {
 	[NVMF_TRTYPE_RDMA]	= "rdma",
 	[NVMF_TRTYPE_FC]	= "fibre-channel",
+	[NVMF_TRTYPE_TCP]	= "tcp",
 	[NVMF_TRTYPE_LOOP]	= "loop",
 };
 
@@ -169,101 +217,92 @@ static const char *cms_str(__u8 cm)
 	return arg_str(cms, ARRAY_SIZE(cms), cm);
 }
 
-static int do_discover(char *argstr, bool connect);
+static const char * const sectypes[] = {
+	[NVMF_TCP_SECTYPE_NONE]	= "none",
+	[NVMF_TCP_SECTYPE_TLS]	= "tls",
+};
 
-static int add_ctrl(const char *argstr)
+static const char *sectype_str(__u8 sectype)
 {
-	substring_t args[MAX_OPT_ARGS];
-	char buf[BUF_SIZE], *options, *p;
-	int token, ret, fd, len = strlen(argstr);
-
-	fd = open(PATH_NVME_FABRICS, O_RDWR);
-	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s: %s\n",
-			 PATH_NVME_FABRICS, strerror(errno));
-		ret = -errno;
-		goto out;
-	}
+	return arg_str(sectypes, ARRAY_SIZE(sectypes), sectype);
+}
 
-	if (write(fd, argstr, len) != len) {
-		fprintf(stderr, "Failed to write to %s: %s\n",
-			 PATH_NVME_FABRICS, strerror(errno));
-		ret = -errno;
-		goto out_close;
-	}
+static int do_discover(char *argstr, bool connect, const struct config *c);
 
-	len = read(fd, buf, BUF_SIZE);
-	if (len < 0) {
-		fprintf(stderr, "Failed to read from %s: %s\n",
-			 PATH_NVME_FABRICS, strerror(errno));
-		ret = -errno;
-		goto out_close;
-	}
+static int read_sysfs(const char *path, char *buf, size_t len)
+{
+	ssize_t ret;
+	int fd;
 
-	buf[len] = '\0';
-	options = buf;
-	while ((p = strsep(&options, ",\n")) != NULL) {
-		if (!*p)
-			continue;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret < 0)
+		return -errno;
+	buf[ret] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
 
-		token = match_token(p, opt_tokens, args);
-		switch (token) {
-		case OPT_INSTANCE:
-			if (match_int(args, &token))
-				goto out_fail;
-			ret = token;
-			goto out_close;
-		default:
-			/* ignore */
-			break;
-		}
-	}
+static int read_ctrl_attr(const char *ctrl, const char *attr, char *buf,
+			  size_t len)
+{
+	char path[PATH_MAX];
 
-out_fail:
-	fprintf(stderr, "Failed to parse ctrl info for \"%s\"\n", argstr);
-	ret = -EINVAL;
-out_close:
-	close(fd);
-out:
-	return ret;
+	snprintf(path, sizeof(path), "%s/%s/%s", SYS_NVMF, ctrl, attr);
+	return read_sysfs(path, buf, len);
 }
 
-static int remove_ctrl_by_path(char *sysfs_path)
+/*
+ * Describe an existing controller the way its connect options would, so
+ * a delete is accounted to the same target as the connect.
+ */
+static void ctrl_target_opts(const char *ctrl, char *opts, size_t len)
 {
-	int ret, fd;
+	char transport[16] = "", address[NVMF_TRADDR_SIZE * 2] = "";
+	char nqn[NVMF_NQN_FIELD_LEN] = "";
 
-	fd = open(sysfs_path, O_WRONLY);
-	if (fd < 0) {
-		ret = errno;
-		goto out;
-	}
+	read_ctrl_attr(ctrl, "transport", transport, sizeof(transport));
+	read_ctrl_attr(ctrl, "address", address, sizeof(address));
+	read_ctrl_attr(ctrl, "subsysnqn", nqn, sizeof(nqn));
+	snprintf(opts, len, "transport=%s,%s,nqn=%s", transport, address, nqn);
+}
 
-	if (write(fd, "1", 1) != 1) {
-		ret = errno;
-		goto out_close;
-	}
+static int add_ctrl(const char *argstr)
+{
+	struct timespec start;
+	int ret;
 
-	ret = 0;
-out_close:
-	close(fd);
-out:
+	fabrics_stats_start(&start);
+	ret = nvmf_add_ctrl(argstr);
+	if (ret == -EINVAL)
+		fprintf(stderr, "Failed to parse ctrl info for \"%s\"\n",
+			argstr);
+	else if (ret < 0)
+		fprintf(stderr, "Failed to add controller through %s: %s\n",
+			PATH_NVME_FABRICS, strerror(-ret));
+	fabrics_stats_record(FABRICS_OP_CONNECT, argstr,
+			     ret < 0 ? strerror(-ret) : NULL, &start);
 	return ret;
 }
 
 static int remove_ctrl(int instance)
 {
-	char *sysfs_path;
+	char ctrl[32], opts[BUF_SIZE];
+	struct timespec start;
 	int ret;
 
-	if (asprintf(&sysfs_path, "/sys/class/nvmf/nvmf%d/delete_controller",
-			instance) < 0) {
-		ret = errno;
-		goto out;
+	opts[0] = '\0';
+	if (fabrics_stats_enabled()) {
+		snprintf(ctrl, sizeof(ctrl), "nvmf%d", instance);
+		ctrl_target_opts(ctrl, opts, sizeof(opts));
 	}
-
-	ret = remove_ctrl_by_path(sysfs_path);
-	free(sysfs_path);
-out:
+	fabrics_stats_start(&start);
+	ret = -nvmf_remove_ctrl(instance);
+	fabrics_stats_record(FABRICS_OP_DELETE, opts,
+			     ret ? strerror(ret) : NULL, &start);
 	return ret;
 }
 
@@ -275,94 +314,169 @@ enum {
 	DISC_NOT_EQUAL,
 };
 
-static int nvmf_get_log_page_discovery(const char *dev_path,
-		struct nvmf_disc_rsp_page_hdr **logp, int *numrec)
+/*
+ * The last discovery log of every target is kept under
+ * PATH_NVMF_DISC_CACHE, keyed by the connect string of its discovery
+ * controller (transport, addresses, host NQN and ID). When the header of
+ * a fresh log shows the same generation counter and record count the
+ * cached entries are used instead of transferring the whole log again.
+ */
+struct disc_cache_hdr {
+	char	magic[8];
+	__u32	key_len;
+	__u32	log_len;
+};
+
+static void disc_cache_path(char *buf, size_t len, const char *key)
 {
-	struct nvmf_disc_rsp_page_hdr *log;
-	unsigned int log_size = 0;
-	unsigned long genctr;
-	int error, fd;
+	snprintf(buf, len, "%s/%016lx", PATH_NVMF_DISC_CACHE, hash_str(key));
+}
 
-	printf("%s\n", dev_path);
+static struct nvmf_disc_rsp_page_hdr *disc_cache_load(const char *key,
+		__u64 genctr, __u64 numrec)
+{
+	struct nvmf_disc_rsp_page_hdr *log = NULL;
+	struct disc_cache_hdr hdr;
+	char path[PATH_MAX], *stored = NULL;
+	size_t log_len = sizeof(*log) +
+		numrec * sizeof(struct nvmf_disc_rsp_page_entry);
+	int fd;
 
-	fd = open(dev_path, O_RDWR);
-	if (fd < 0) {
-		error = -errno;
+	disc_cache_path(path, sizeof(path), key);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.magic, DISC_CACHE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.key_len != strlen(key) || hdr.log_len != log_len)
 		goto out;
+
+	stored = malloc(hdr.key_len);
+	log = malloc(log_len);
+	if (!stored || !log ||
+	    read(fd, stored, hdr.key_len) != hdr.key_len ||
+	    memcmp(stored, key, hdr.key_len) ||
+	    read(fd, log, log_len) != log_len ||
+	    le64_to_cpu(log->genctr) != genctr ||
+	    le64_to_cpu(log->numrec) != numrec) {
+		free(log);
+		log = NULL;
 	}
+out:
+	free(stored);
+	close(fd);
+	return log;
+}
 
-	/* first get_log_page we just need numrec entry from discovery hdr.
-	 * host supplies its desired bytes via dwords, per NVMe spec.
-	 */
-	log_size = round_up((offsetof(struct nvmf_disc_rsp_page_hdr, numrec) +
-			    sizeof(log->numrec)), sizeof(__u32));
+static void disc_cache_store(const char *key,
+		struct nvmf_disc_rsp_page_hdr *log, int numrec)
+{
+	struct disc_cache_hdr hdr;
+	char path[PATH_MAX];
+	struct iovec iov[3];
 
-	/*
-	 * Issue first get log page w/numdl small enough to retrieve numrec.
-	 * We just want to know how many records to retrieve.
-	 */
-	log = calloc(1, log_size);
-	if (!log) {
-		error = -ENOMEM;
-		goto out_close;
-	}
+	if ((mkdir(NVME_RUN_DIR, 0755) && errno != EEXIST) ||
+	    (mkdir(PATH_NVMF_DISC_CACHE, 0700) && errno != EEXIST))
+		return;
 
-	error = nvme_discovery_log(fd, log, log_size);
-	if (error) {
-		error = DISC_GET_NUMRECS;
-		goto out_free_log;
-	}
+	memcpy(hdr.magic, DISC_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.key_len = strlen(key);
+	hdr.log_len = sizeof(*log) +
+		numrec * sizeof(struct nvmf_disc_rsp_page_entry);
 
-	/* check numrec limits */
-	*numrec = le64_to_cpu(log->numrec);
-	genctr = le64_to_cpu(log->genctr);
-	free(log);
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)key;
+	iov[1].iov_len = hdr.key_len;
+	iov[2].iov_base = log;
+	iov[2].iov_len = hdr.log_len;
 
-	if (*numrec == 0) {
-		error = DISC_NO_LOG;
-		goto out_close;
+	disc_cache_path(path, sizeof(path), key);
+	nvme_cache_write(path, iov, 3, 0600);
+}
+
+/* Short reason for a nvmf_get_log_page_discovery() result, NULL if OK */
+static const char *disc_error_str(int ret)
+{
+	switch (ret) {
+	case DISC_OK:
+		return NULL;
+	case DISC_NO_LOG:
+		return "no discovery log entries";
+	case DISC_GET_NUMRECS:
+		return "reading the log page header failed";
+	case DISC_GET_LOG:
+		return "reading the log page failed";
+	case DISC_NOT_EQUAL:
+		return "log kept changing";
+	default:
+		return ret < 0 ? strerror(-ret) : "unknown error";
 	}
+}
 
-	/* we are actually retrieving the entire discovery tables
-	 * for the second get_log_page(), per
-	 * NVMe spec so no need to round_up(), or there is something
-	 * seriously wrong with the standard
-	 */
-	log_size = sizeof(struct nvmf_disc_rsp_page_hdr) +
-			sizeof(struct nvmf_disc_rsp_page_entry) * *numrec;
+/*
+ * Read the discovery log, see nvmf_get_discovery_log(). With a cache key
+ * the header is read first, and the saved log is used when the
+ * generation counter and number of records did not change.
+ */
+static int nvmf_get_log_page_discovery(const char *dev_path,
+		const char *cache_key,
+		struct nvmf_disc_rsp_page_hdr **logp, int *numrec)
+{
+	struct nvmf_disc_rsp_page_hdr *log;
+	__u64 genctr, nrec;
+	int error, fd;
+	struct timespec start;
 
-	/* allocate discovery log pages based on page_hdr->numrec */
-	log = calloc(1, log_size);
-	if (!log) {
-		error = -ENOMEM;
-		goto out_close;
+	printf("%s\n", dev_path);
+	fabrics_stats_start(&start);
+
+	fd = open(dev_path, O_RDWR);
+	if (fd < 0) {
+		error = -errno;
+		goto out;
 	}
 
-	/*
-	 * issue new get_log_page w/numdl+numdh set to get all records,
-	 * up to MAX_DISC_LOGS.
-	 */
-	error = nvme_discovery_log(fd, log, log_size);
-	if (error) {
-		error = DISC_GET_LOG;
-		goto out_free_log;
+	if (cache_key) {
+		if (nvmf_disc_log_header(fd, &genctr, &nrec)) {
+			error = DISC_GET_NUMRECS;
+			goto out_close;
+		}
+		log = nrec ? disc_cache_load(cache_key, genctr, nrec) : NULL;
+		if (log) {
+			*logp = log;
+			*numrec = nrec;
+			error = DISC_OK;
+			goto out_close;
+		}
 	}
 
-	if (*numrec != le32_to_cpu(log->numrec) || genctr != le64_to_cpu(log->genctr)) {
+	error = nvmf_get_discovery_log(fd, logp, numrec);
+	switch (error) {
+	case 0:
+		/* needs to be freed by the caller */
+		if (cache_key)
+			disc_cache_store(cache_key, *logp, *numrec);
+		error = DISC_OK;
+		break;
+	case -ENODATA:
+		error = DISC_NO_LOG;
+		break;
+	case -EAGAIN:
 		error = DISC_NOT_EQUAL;
-		goto out_free_log;
+		break;
+	default:
+		if (error > 0)
+			error = DISC_GET_LOG;
+		break;
 	}
 
-	/* needs to be freed by the caller */
-	*logp = log;
-	goto out_close;
-
-	error = DISC_OK;
-out_free_log:
-	free(log);
 out_close:
 	close(fd);
 out:
+	fabrics_stats_record(FABRICS_OP_DISCOVER, cache_key,
+			     disc_error_str(error), &start);
 	return error;
 }
 
@@ -413,19 +527,24 @@ static void print_discovery_log(struct nvmf_disc_rsp_page_hdr *log, int numrec)
 			printf("rdma_pkey: 0x%04x\n",
 				e->tsas.rdma.pkey);
 			break;
+		case NVMF_TRTYPE_TCP:
+			printf("sectype: %s\n",
+				sectype_str(e->tsas.tcp.sectype));
+			break;
 		}
 	}
 }
 
-static void save_discovery_log(struct nvmf_disc_rsp_page_hdr *log, int numrec)
+static void save_discovery_log(struct nvmf_disc_rsp_page_hdr *log, int numrec,
+			       const char *raw)
 {
 	int fd;
 	int len, ret;
 
-	fd = open(cfg.raw, O_CREAT|O_RDWR|O_TRUNC, S_IRUSR|S_IWUSR);
+	fd = open(raw, O_CREAT|O_RDWR|O_TRUNC, S_IRUSR|S_IWUSR);
 	if (fd < 0) {
 		fprintf(stderr, "failed to open %s: %s\n",
-			cfg.raw, strerror(errno));
+			raw, strerror(errno));
 		return;
 	}
 
@@ -434,94 +553,55 @@ static void save_discovery_log(struct nvmf_disc_rsp_page_hdr *log, int numrec)
 	ret = write(fd, log, len);
 	if (ret < 0)
 		fprintf(stderr, "failed to write to %s: %s\n",
-			cfg.raw, strerror(errno));
+			raw, strerror(errno));
 	else
-		printf("Discovery log is saved to %s\n", cfg.raw);
+		printf("Discovery log is saved to %s\n", raw);
 
 	close(fd);
 }
 
 static int nvmf_hostnqn_file(void)
 {
-	FILE *f;
 	char hostnqn[NVMF_NQN_SIZE];
-	int ret = false;
 
-	f = fopen(PATH_NVMF_HOSTNQN, "r");
-	if (f == NULL)
+	if (nvmf_read_hostnqn(hostnqn, sizeof(hostnqn)))
 		return false;
 
-	if (fgets(hostnqn, sizeof(hostnqn), f) == NULL)
-		goto out;
-
 	cfg.hostnqn = strdup(hostnqn);
-	if (!cfg.hostnqn)
-		goto out;
-
-	ret = true;
-out:
-	fclose(f);
-	return ret;
+	return cfg.hostnqn != NULL;
 }
 
 static int nvmf_hostid_file(void)
 {
-	FILE *f;
 	char hostid[NVMF_HOSTID_SIZE + 1];
-	int ret = false;
 
-	f = fopen(PATH_NVMF_HOSTID, "r");
-	if (f == NULL)
+	if (nvmf_read_hostid(hostid, sizeof(hostid)))
 		return false;
 
-	if (fgets(hostid, sizeof(hostid), f) == NULL)
-		goto out;
-
 	cfg.hostid = strdup(hostid);
-	if (!cfg.hostid)
-		goto out;
-
-	ret = true;
-out:
-	fclose(f);
-	return ret;
-}
-
-static int
-add_bool_argument(char **argstr, int *max_len, char *arg_str, bool arg)
-{
-	int len;
-
-	if (arg) {
-		len = snprintf(*argstr, *max_len, ",%s", arg_str);
-		if (len < 0)
-			return -EINVAL;
-		*argstr += len;
-		*max_len -= len;
-	}
-
-	return 0;
-}
-
-static int
-add_argument(char **argstr, int *max_len, char *arg_str, char *arg)
-{
-	int len;
-
-	if (arg) {
-		len = snprintf(*argstr, *max_len, ",%s=%s", arg_str, arg);
-		if (len < 0)
-			return -EINVAL;
-		*argstr += len;
-		*max_len -= len;
-	}
-
-	return 0;
+	return cfg.hostid != NULL;
 }
 
 static int build_options(char *argstr, int max_len)
 {
-	int len;
+	struct nvmf_connect_args args = {
+		.nqn			= cfg.nqn,
+		.transport		= cfg.transport,
+		.traddr			= cfg.traddr,
+		.trsvcid		= cfg.trsvcid,
+		.host_traddr		= cfg.host_traddr,
+		.nr_io_queues		= cfg.nr_io_queues,
+		.queue_size		= cfg.queue_size,
+		.keep_alive_tmo		= cfg.keep_alive_tmo,
+		.reconnect_delay	= cfg.reconnect_delay,
+		.ctrl_loss_tmo		= cfg.ctrl_loss_tmo,
+		.nr_write_queues	= cfg.nr_write_queues,
+		.nr_poll_queues		= cfg.nr_poll_queues,
+		.tos			= cfg.tos,
+		.hdr_digest		= cfg.hdr_digest,
+		.data_digest		= cfg.data_digest,
+		.duplicate_connect	= cfg.duplicate_connect,
+	};
 
 	if (!cfg.transport) {
 		fprintf(stderr, "need a transport (-t) argument\n");
@@ -535,38 +615,16 @@ static int build_options(char *argstr, int max_len)
 		}
 	}
 
-	/* always specify nqn as first arg - this will init the string */
-	len = snprintf(argstr, max_len, "nqn=%s", cfg.nqn);
-	if (len < 0)
-		return -EINVAL;
-	argstr += len;
-	max_len -= len;
-
-	if (add_argument(&argstr, &max_len, "transport", cfg.transport) ||
-	    add_argument(&argstr, &max_len, "traddr", cfg.traddr) ||
-	    add_argument(&argstr, &max_len, "host_traddr", cfg.host_traddr) ||
-	    add_argument(&argstr, &max_len, "trsvcid", cfg.trsvcid) ||
-	    ((cfg.hostnqn || nvmf_hostnqn_file()) &&
-		    add_argument(&argstr, &max_len, "hostnqn", cfg.hostnqn)) ||
-	    ((cfg.hostid || nvmf_hostid_file()) &&
-		    add_argument(&argstr, &max_len, "hostid", cfg.hostid)) ||
-	    add_argument(&argstr, &max_len, "nr_io_queues",
-				cfg.nr_io_queues) ||
-	    add_argument(&argstr, &max_len, "queue_size", cfg.queue_size) ||
-	    add_argument(&argstr, &max_len, "keep_alive_tmo",
-				cfg.keep_alive_tmo) ||
-	    add_argument(&argstr, &max_len, "reconnect_delay",
-				cfg.reconnect_delay) ||
-	    add_argument(&argstr, &max_len, "ctrl_loss_tmo",
-				cfg.ctrl_loss_tmo) ||
-	    add_bool_argument(&argstr, &max_len, "duplicate_connect",
-				cfg.duplicate_connect))
-		return -EINVAL;
+	if (cfg.hostnqn || nvmf_hostnqn_file())
+		args.hostnqn = cfg.hostnqn;
+	if (cfg.hostid || nvmf_hostid_file())
+		args.hostid = cfg.hostid;
 
-	return 0;
+	return nvmf_build_args(&args, argstr, max_len) ? -EINVAL : 0;
 }
 
-static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
+static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e,
+			const struct config *c)
 {
 	char argstr[BUF_SIZE], *p = argstr;
 	bool discover = false;
@@ -588,29 +646,71 @@ static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
 		return -EINVAL;
 	p += len;
 
-	if (cfg.hostnqn) {
-		len = sprintf(p, ",hostnqn=%s", cfg.hostnqn);
+	if (c->hostnqn) {
+		len = sprintf(p, ",hostnqn=%s", c->hostnqn);
+		if (len < 0)
+			return -EINVAL;
+		p += len;
+	}
+
+	if (c->hostid) {
+		len = sprintf(p, ",hostid=%s", c->hostid);
+		if (len < 0)
+			return -EINVAL;
+		p += len;
+	}
+
+	if (c->queue_size) {
+		len = sprintf(p, ",queue_size=%s", c->queue_size);
+		if (len < 0)
+			return -EINVAL;
+		p += len;
+	}
+
+	if (c->nr_io_queues) {
+		len = sprintf(p, ",nr_io_queues=%s", c->nr_io_queues);
+		if (len < 0)
+			return -EINVAL;
+		p += len;
+	}
+
+	if (c->duplicate_connect) {
+		len = sprintf(p, ",duplicate_connect");
+		if (len < 0)
+			return -EINVAL;
+		p += len;
+	}
+
+	if (c->nr_write_queues) {
+		len = sprintf(p, ",nr_write_queues=%s", c->nr_write_queues);
+		if (len < 0)
+			return -EINVAL;
+		p += len;
+	}
+
+	if (c->nr_poll_queues) {
+		len = sprintf(p, ",nr_poll_queues=%s", c->nr_poll_queues);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (cfg.hostid) {
-		len = sprintf(p, ",hostid=%s", cfg.hostid);
+	if (c->tos) {
+		len = sprintf(p, ",tos=%s", c->tos);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (cfg.queue_size) {
-		len = sprintf(p, ",queue_size=%s", cfg.queue_size);
+	if (c->hdr_digest) {
+		len = sprintf(p, ",hdr_digest");
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (cfg.nr_io_queues) {
-		len = sprintf(p, ",nr_io_queues=%s", cfg.nr_io_queues);
+	if (c->data_digest) {
+		len = sprintf(p, ",data_digest");
 		if (len < 0)
 			return -EINVAL;
 		p += len;
@@ -653,6 +753,42 @@ static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
 			return -EINVAL;
 		}
 		break;
+	case NVMF_TRTYPE_TCP:
+		switch (e->adrfam) {
+		case NVMF_ADDR_FAMILY_IP4:
+		case NVMF_ADDR_FAMILY_IP6:
+			len = sprintf(p, ",transport=tcp");
+			if (len < 0)
+				return -EINVAL;
+			p += len;
+
+			len = sprintf(p, ",traddr=%.*s",
+				      space_strip_len(NVMF_TRADDR_SIZE, e->traddr),
+				      e->traddr);
+			if (len < 0)
+				return -EINVAL;
+			p += len;
+
+			len = sprintf(p, ",trsvcid=%.*s",
+				      space_strip_len(NVMF_TRSVCID_SIZE, e->trsvcid),
+				      e->trsvcid);
+			if (len < 0)
+				return -EINVAL;
+			p += len;
+
+			if (c->host_traddr) {
+				len = sprintf(p, ",host_traddr=%s",
+					      c->host_traddr);
+				if (len < 0)
+					return -EINVAL;
+				p += len;
+			}
+			break;
+		default:
+			fprintf(stderr, "skipping unsupported adrfam\n");
+			return -EINVAL;
+		}
+		break;
 	case NVMF_TRTYPE_FC:
 		switch (e->adrfam) {
 		case NVMF_ADDR_FAMILY_FC:
@@ -661,7 +797,7 @@ static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
 				return -EINVAL;
 			p += len;
 
-			len = sprintf(p, ",host_traddr=%s", cfg.host_traddr);
+			len = sprintf(p, ",host_traddr=%s", c->host_traddr);
 			if (len < 0)
 				return -EINVAL;
 			p+= len;
@@ -685,321 +821,2179 @@ static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
 	}
 
 	if (discover)
-		return do_discover(argstr, true);
+		return do_discover(argstr, true, c);
 	else
 		return add_ctrl(argstr);
 }
 
-static void connect_ctrls(struct nvmf_disc_rsp_page_hdr *log, int numrec)
+struct connect_job {
+	struct nvmf_disc_rsp_page_entry *e;
+	const struct config *cfg;
+	bool existing;
+	int ret;
+	double msecs;
+};
+
+static void connect_one(unsigned int idx, void *arg)
 {
-	int i;
+	struct connect_job *job = (struct connect_job *)arg + idx;
+	struct timespec start, end;
+
+	if (job->existing)
+		return;
 
-	for (i = 0; i < numrec; i++)
-		connect_ctrl(&log->entries[i]);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	job->ret = connect_ctrl(job->e, job->cfg);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->msecs = (end.tv_sec - start.tv_sec) * 1000.0 +
+		     (end.tv_nsec - start.tv_nsec) / 1000000.0;
 }
 
-static int do_discover(char *argstr, bool connect)
+static void print_connect_summary(struct connect_job *jobs, int numrec)
 {
-	struct nvmf_disc_rsp_page_hdr *log = NULL;
-	char *dev_name;
-	int instance, numrec = 0, ret;
-
-	instance = add_ctrl(argstr);
-	if (instance < 0)
-		return instance;
+	int i, ok = 0, existing = 0;
 
-	if (asprintf(&dev_name, "/dev/nvmf%d", instance) < 0)
-		return errno;
-	ret = nvmf_get_log_page_discovery(dev_name, &log, &numrec);
-	free(dev_name);
-	remove_ctrl(instance);
+	for (i = 0; i < numrec; i++) {
+		if (jobs[i].ret >= 0)
+			ok++;
+		if (jobs[i].existing)
+			existing++;
+	}
 
-	switch (ret) {
-	case DISC_OK:
-		if (connect)
-			connect_ctrls(log, numrec);
-		else if (cfg.raw)
-			save_discovery_log(log, numrec);
+	printf("connect-all: %d of %d connected (%d already connected)\n",
+	       ok, numrec, existing);
+	for (i = 0; i < numrec; i++) {
+		struct nvmf_disc_rsp_page_entry *e = jobs[i].e;
+
+		printf("  %-5s %.*s:%.*s %s ", trtype_str(e->trtype),
+		       space_strip_len(NVMF_TRADDR_SIZE, e->traddr), e->traddr,
+		       space_strip_len(NVMF_TRSVCID_SIZE, e->trsvcid), e->trsvcid,
+		       e->subnqn);
+		if (jobs[i].existing)
+			printf("nvmf%d (existing)", jobs[i].ret);
+		else if (jobs[i].ret < 0)
+			printf("failed (%s)", strerror(-jobs[i].ret));
+		else if (e->subtype == NVME_NQN_DISC)
+			printf("referral");
 		else
-			print_discovery_log(log, numrec);
-		break;
-	case DISC_GET_NUMRECS:
-		fprintf(stderr,
-			"Get number of discovery log entries failed.\n");
-		break;
-	case DISC_GET_LOG:
-		fprintf(stderr, "Get discovery log entries failed.\n");
-		break;
-	case DISC_NO_LOG:
+			printf("nvmf%d", jobs[i].ret);
+		printf(" %.3f ms\n", jobs[i].msecs);
+	}
+}
+
+static int scan_sys_nvme_filter(const struct dirent *d)
+{
+	if (!strcmp(d->d_name, "."))
+		return 0;
+	if (!strcmp(d->d_name, ".."))
+		return 0;
+	return 1;
+}
+
+/* Transport names as written to /dev/nvme-fabrics and shown in sysfs */
+static const char *trtype_transport(__u8 trtype)
+{
+	switch (trtype) {
+	case NVMF_TRTYPE_RDMA:
+		return "rdma";
+	case NVMF_TRTYPE_FC:
+		return "fc";
+	case NVMF_TRTYPE_TCP:
+		return "tcp";
+	case NVMF_TRTYPE_LOOP:
+		return "loop";
+	default:
+		return NULL;
+	}
+}
+
+static void conn_key(char *key, size_t len, const char *nqn,
+		     const char *transport, const char *traddr,
+		     const char *trsvcid, const char *host_traddr)
+{
+	snprintf(key, len, "%s\t%s\t%s\t%s\t%s", nqn, transport,
+		 traddr ? traddr : "", trsvcid ? trsvcid : "",
+		 host_traddr ? host_traddr : "");
+}
+
+/*
+ * Index the fabrics controllers that already exist by (subnqn, transport,
+ * traddr, trsvcid, host_traddr). The data pointer carries the instance
+ * number plus one so that nvmf0 is not stored as NULL.
+ */
+static int build_conn_index(struct hash_table *conns)
+{
+	char nqn[NVMF_NQN_FIELD_LEN], transport[32], address[BUF_SIZE];
+	char key[NVMF_NQN_FIELD_LEN + BUF_SIZE + 40];
+	char *traddr, *trsvcid, *host_traddr, *opts, *p;
+	struct dirent **devices;
+	int i, n, instance;
+
+	n = scandir(SYS_NVMF, &devices, scan_sys_nvme_filter, alphasort);
+	if (n < 0)
+		n = 0;
+
+	if (hash_init(conns, n)) {
+		for (i = 0; i < n; i++)
+			free(devices[i]);
+		free(devices);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *ctrl = devices[i]->d_name;
+
+		if (sscanf(ctrl, "nvmf%d", &instance) != 1 ||
+		    read_ctrl_attr(ctrl, "subsysnqn", nqn, sizeof(nqn)) ||
+		    read_ctrl_attr(ctrl, "transport", transport,
+				   sizeof(transport)) ||
+		    read_ctrl_attr(ctrl, "address", address, sizeof(address)))
+			goto next;
+
+		traddr = trsvcid = host_traddr = NULL;
+		opts = address;
+		while ((p = strsep(&opts, ",")) != NULL) {
+			if (!strncmp(p, "traddr=", 7))
+				traddr = p + 7;
+			else if (!strncmp(p, "trsvcid=", 8))
+				trsvcid = p + 8;
+			else if (!strncmp(p, "host_traddr=", 12))
+				host_traddr = p + 12;
+		}
+
+		conn_key(key, sizeof(key), nqn, transport, traddr, trsvcid,
+			 host_traddr);
+		hash_insert(conns, key, (void *)(long)(instance + 1));
+next:
+		free(devices[i]);
+	}
+	if (n)
+		free(devices);
+	return 0;
+}
+
+/*
+ * Look up the controller connect_ctrl() would create for @e. Returns its
+ * instance or -1.
+ */
+static int find_existing_ctrl(struct hash_table *conns,
+			      struct nvmf_disc_rsp_page_entry *e,
+			      const struct config *c)
+{
+	char key[NVMF_NQN_FIELD_LEN + BUF_SIZE + 40];
+	char nqn[NVMF_NQN_FIELD_LEN + 1];
+	char traddr[NVMF_TRADDR_SIZE + 1], trsvcid[NVMF_TRSVCID_SIZE + 1];
+	const char *transport = trtype_transport(e->trtype);
+	void *data;
+
+	if (!conns || !transport || e->subtype == NVME_NQN_DISC)
+		return -1;
+
+	snprintf(nqn, sizeof(nqn), "%.*s",
+		 (int)strnlen(e->subnqn, NVMF_NQN_FIELD_LEN), e->subnqn);
+	snprintf(traddr, sizeof(traddr), "%.*s",
+		 space_strip_len(NVMF_TRADDR_SIZE, e->traddr), e->traddr);
+	snprintf(trsvcid, sizeof(trsvcid), "%.*s",
+		 space_strip_len(NVMF_TRSVCID_SIZE, e->trsvcid), e->trsvcid);
+
+	/* mirror what connect_ctrl() puts into the connect string */
+	switch (e->trtype) {
+	case NVMF_TRTYPE_LOOP:
+		conn_key(key, sizeof(key), nqn, transport, NULL, NULL, NULL);
+		break;
+	case NVMF_TRTYPE_FC:
+		conn_key(key, sizeof(key), nqn, transport, traddr, NULL,
+			 c->host_traddr);
+		break;
+	case NVMF_TRTYPE_TCP:
+		conn_key(key, sizeof(key), nqn, transport, traddr, trsvcid,
+			 c->host_traddr);
+		break;
+	default:
+		conn_key(key, sizeof(key), nqn, transport, traddr, trsvcid,
+			 NULL);
+		break;
+	}
+
+	data = hash_lookup(conns, key);
+	return data ? (int)(long)data - 1 : -1;
+}
+
+#define DISC_KEY_LEN	(NVMF_NQN_FIELD_LEN + NVMF_TRADDR_SIZE + \
+			 NVMF_TRSVCID_SIZE + 3)
+
+static void disc_entry_key(char *key, size_t len,
+			   struct nvmf_disc_rsp_page_entry *e)
+{
+	snprintf(key, len, "%.*s\t%.*s\t%.*s",
+		 (int)strnlen(e->subnqn, NVMF_NQN_FIELD_LEN), e->subnqn,
+		 space_strip_len(NVMF_TRADDR_SIZE, e->traddr), e->traddr,
+		 space_strip_len(NVMF_TRSVCID_SIZE, e->trsvcid), e->trsvcid);
+}
+
+/*
+ * Two discovery controllers (or two ports of the same one) usually report
+ * the same subsystems; only the first (subnqn, traddr, trsvcid) is kept.
+ */
+static int queue_connect_jobs(struct connect_job **jobs, int *n,
+			      struct hash_table *seen, struct hash_table *conns,
+			      struct nvmf_disc_rsp_page_hdr *log, int numrec,
+			      const struct config *c)
+{
+	char key[DISC_KEY_LEN];
+	struct connect_job *tmp;
+	int i;
+
+	tmp = realloc(*jobs, (*n + numrec) * sizeof(*tmp));
+	if (!tmp)
+		return -ENOMEM;
+	*jobs = tmp;
+
+	for (i = 0; i < numrec; i++) {
+		struct nvmf_disc_rsp_page_entry *e = &log->entries[i];
+
+		disc_entry_key(key, sizeof(key), e);
+		if (hash_insert(seen, key, NULL) == -EEXIST)
+			continue;
+
+		memset(&tmp[*n], 0, sizeof(tmp[*n]));
+		tmp[*n].e = e;
+		tmp[*n].cfg = c;
+		if (!c->duplicate_connect) {
+			tmp[*n].ret = find_existing_ctrl(conns, e, c);
+			tmp[*n].existing = tmp[*n].ret >= 0;
+		}
+		(*n)++;
+	}
+	return 0;
+}
+
+/*
+ * Each add_ctrl() blocks until the kernel has finished the fabric
+ * handshake, so with many subsystems behind one discovery controller the
+ * connects are spread over up to --parallel workers.
+ */
+static void run_connect_jobs(struct connect_job *jobs, int n,
+			     unsigned int workers)
+{
+	if (!workers)
+		workers = 1;
+	if (workers > PARALLEL_MAX_WORKERS)
+		workers = PARALLEL_MAX_WORKERS;
+	parallel_for(n, workers, connect_one, jobs);
+
+	print_connect_summary(jobs, n);
+}
+
+static void connect_ctrls(struct nvmf_disc_rsp_page_hdr *log, int numrec,
+			  const struct config *c)
+{
+	struct connect_job *jobs = NULL;
+	struct hash_table seen = { NULL }, conns = { NULL };
+	int i, n = 0;
+
+	if (hash_init(&seen, numrec) || build_conn_index(&conns) ||
+	    queue_connect_jobs(&jobs, &n, &seen, &conns, log, numrec, c)) {
+		for (i = 0; i < numrec; i++)
+			connect_ctrl(&log->entries[i], c);
+		goto out;
+	}
+
+	run_connect_jobs(jobs, n, c->parallel);
+out:
+	hash_free(&conns, NULL);
+	hash_free(&seen, NULL);
+	free(jobs);
+}
+
+/*
+ * Create a temporary discovery controller, read its log page and delete
+ * the controller again. The log is handed back to the caller to free.
+ */
+static int fetch_discovery_log(const char *argstr,
+			       struct nvmf_disc_rsp_page_hdr **logp,
+			       int *numrec)
+{
+	char *dev_name;
+	int instance, ret;
+
+	instance = add_ctrl(argstr);
+	if (instance < 0)
+		return instance;
+
+	if (asprintf(&dev_name, "/dev/nvmf%d", instance) < 0)
+		return errno;
+	ret = nvmf_get_log_page_discovery(dev_name, argstr, logp, numrec);
+	free(dev_name);
+	remove_ctrl(instance);
+	return ret;
+}
+
+static void print_discovery_error(int ret)
+{
+	switch (ret) {
+	case DISC_GET_NUMRECS:
+		fprintf(stderr,
+			"Get number of discovery log entries failed.\n");
+		break;
+	case DISC_GET_LOG:
+		fprintf(stderr, "Get discovery log entries failed.\n");
+		break;
+	case DISC_NO_LOG:
 		fprintf(stderr, "No discovery log entries to fetch.\n");
 		break;
 	case DISC_NOT_EQUAL:
 		fprintf(stderr,
-		"Numrec values of last two get dicovery log page not equal\n");
+		"Discovery log kept changing while it was read, giving up\n");
 		break;
 	default:
 		fprintf(stderr, "Get dicovery log page failed: %d\n", ret);
 		break;
 	}
+}
+
+static int do_discover(char *argstr, bool connect, const struct config *c)
+{
+	struct nvmf_disc_rsp_page_hdr *log = NULL;
+	int numrec = 0, ret;
+
+	ret = fetch_discovery_log(argstr, &log, &numrec);
+	if (ret < 0)
+		return ret;
+
+	if (ret != DISC_OK)
+		print_discovery_error(ret);
+	else if (connect)
+		connect_ctrls(log, numrec, c);
+	else if (c->raw)
+		save_discovery_log(log, numrec, c->raw);
+	else
+		print_discovery_log(log, numrec);
+
+	free(log);
+	return ret;
+}
+
+/* One line of discovery.conf, parsed up front. */
+struct disc_target {
+	struct config cfg;
+	char argstr[BUF_SIZE];
+	char *args;
+	struct nvmf_disc_rsp_page_hdr *log;
+	int numrec;
+	int ret;
+};
+
+static void discover_one(unsigned int idx, void *arg)
+{
+	struct disc_target *t = (struct disc_target *)arg + idx;
+
+	t->ret = fetch_discovery_log(t->argstr, &t->log, &t->numrec);
+}
+
+static int parse_conf_file(const char *desc,
+		const struct argconfig_commandline_options *opts,
+		struct disc_target **targetsp, int *nr)
+{
+	struct disc_target *targets = NULL, *tmp, *t;
+	struct config base = cfg;
+	char line[256], *ptr, *args, **argv;
+	int argc, n = 0, ret = 0;
+	FILE *f;
+
+	f = fopen(PATH_NVMF_DISC, "r");
+	if (f == NULL) {
+		fprintf(stderr, "No discover params given and no %s conf\n",
+			PATH_NVMF_DISC);
+		return -EINVAL;
+	}
+
+	argv = calloc(MAX_DISC_ARGS, BUF_SIZE);
+	if (!argv) {
+		fprintf(stderr, "failed to allocate argv vector\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		tmp = realloc(targets, (n + 1) * sizeof(*targets));
+		if (!tmp) {
+			ret = -ENOMEM;
+			break;
+		}
+		targets = tmp;
+
+		args = strdup(line);
+		if (!args) {
+			fprintf(stderr, "failed to strdup args\n");
+			ret = -ENOMEM;
+			break;
+		}
+
+		t = &targets[n];
+		memset(t, 0, sizeof(*t));
+		t->args = args;
+
+		argc = 0;
+		argv[argc++] = "discover";
+		while ((ptr = strsep(&args, " =\n")) != NULL)
+			argv[argc++] = ptr;
+
+		/* every line starts from the command line options */
+		cfg = base;
+		argconfig_parse(argc, argv, desc, opts, &cfg, sizeof(cfg));
+
+		ret = build_options(t->argstr, BUF_SIZE);
+		if (ret) {
+			free(t->args);
+			continue;
+		}
+		t->cfg = cfg;
+		n++;
+	}
+	free(argv);
+out:
+	fclose(f);
+	cfg = base;
+	*targetsp = targets;
+	*nr = n;
+	return n ? 0 : ret;
+}
+
+/*
+ * Discovery against every line of discovery.conf runs at once. For
+ * connect-all the returned entries are then merged, so a subsystem
+ * reachable through several discovery controllers is only connected once.
+ */
+static int discover_from_conf_file(const char *desc,
+		const struct argconfig_commandline_options *opts, bool connect)
+{
+	struct disc_target *targets = NULL;
+	struct connect_job *jobs = NULL;
+	struct hash_table seen = { NULL }, conns = { NULL };
+	unsigned int workers;
+	int i, n, nr_jobs = 0, ret;
+
+	ret = parse_conf_file(desc, opts, &targets, &n);
+	if (ret || !n)
+		goto out;
+
+	workers = n < PARALLEL_MAX_WORKERS ? n : PARALLEL_MAX_WORKERS;
+	parallel_for(n, workers, discover_one, targets);
+
+	if (connect && (hash_init(&seen, 256) || build_conn_index(&conns))) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct disc_target *t = &targets[i];
+
+		if (t->ret) {
+			if (t->ret > 0)
+				print_discovery_error(t->ret);
+			ret = t->ret;
+			continue;
+		}
+
+		if (!connect) {
+			if (t->cfg.raw)
+				save_discovery_log(t->log, t->numrec,
+						   t->cfg.raw);
+			else
+				print_discovery_log(t->log, t->numrec);
+		} else if (queue_connect_jobs(&jobs, &nr_jobs, &seen, &conns,
+					      t->log, t->numrec, &t->cfg)) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (connect && nr_jobs)
+		run_connect_jobs(jobs, nr_jobs, cfg.parallel);
+out:
+	hash_free(&conns, NULL);
+	hash_free(&seen, NULL);
+	free(jobs);
+	for (i = 0; targets && i < n; i++) {
+		free(targets[i].log);
+		free(targets[i].args);
+	}
+	free(targets);
+	return ret;
+}
+
+static volatile sig_atomic_t persistent_stop;
+
+static void persistent_sighandler(int sig)
+{
+	persistent_stop = 1;
+}
+
+/*
+ * Bring the connect side in line with a new discovery log: connect what
+ * is listed but not connected yet and, with --remove-stale, delete the
+ * controllers of entries that disappeared since @old.
+ */
+static void persistent_apply(struct nvmf_disc_rsp_page_hdr *old, int oldn,
+			     struct nvmf_disc_rsp_page_hdr *new, int newn,
+			     const struct config *c)
+{
+	struct hash_table keys = { NULL }, conns = { NULL };
+	struct connect_job *jobs = NULL;
+	char key[DISC_KEY_LEN];
+	int i, n = 0, instance;
+
+	if (hash_init(&keys, newn) || build_conn_index(&conns))
+		goto out;
+
+	jobs = calloc(newn ? newn : 1, sizeof(*jobs));
+	if (!jobs)
+		goto out;
+
+	for (i = 0; i < newn; i++) {
+		struct nvmf_disc_rsp_page_entry *e = &new->entries[i];
+
+		disc_entry_key(key, sizeof(key), e);
+		if (hash_insert(&keys, key, NULL) == -EEXIST)
+			continue;
+		if (find_existing_ctrl(&conns, e, c) >= 0)
+			continue;
+		jobs[n].e = e;
+		jobs[n].cfg = c;
+		n++;
+	}
+	if (n)
+		run_connect_jobs(jobs, n, c->parallel);
+
+	for (i = 0; c->remove_stale && i < oldn; i++) {
+		struct nvmf_disc_rsp_page_entry *e = &old->entries[i];
+
+		disc_entry_key(key, sizeof(key), e);
+		if (hash_contains(&keys, key))
+			continue;
+		instance = find_existing_ctrl(&conns, e, c);
+		if (instance < 0)
+			continue;
+		if (remove_ctrl(instance))
+			fprintf(stderr, "failed to remove nvmf%d\n", instance);
+		else
+			printf("removed nvmf%d (%s)\n", instance, e->subnqn);
+	}
+out:
+	hash_free(&conns, NULL);
+	hash_free(&keys, NULL);
+	free(jobs);
+}
+
+/*
+ * Create the discovery controller and ask it for Discovery Log Page
+ * Change notices. Returns the instance, and whether notices are
+ * enabled in @aen.
+ */
+static int persistent_attach(const char *argstr, bool *aen)
+{
+	char dev_name[32];
+	int instance, fd, err;
+
+	instance = add_ctrl(argstr);
+	if (instance < 0)
+		return instance;
+
+	*aen = false;
+	snprintf(dev_name, sizeof(dev_name), "/dev/nvmf%d", instance);
+	fd = open(dev_name, O_RDWR);
+	if (fd >= 0) {
+		err = nvme_set_feature(fd, 0, NVME_FEAT_ASYNC_EVENT,
+				       NVME_AEN_CFG_DISC_CHANGE, false, 0,
+				       NULL, NULL);
+		*aen = !err;
+		close(fd);
+	}
+	if (!*aen)
+		fprintf(stderr, "%s: discovery log change events unavailable, "
+			"polling every %d seconds\n", dev_name, PERSISTENT_POLL);
+	printf("persistent discovery controller nvmf%d\n", instance);
+	return instance;
+}
+
+static bool disc_log_changed_aen(const char *aen)
+{
+	unsigned long result = strtoul(aen, NULL, 0);
+
+	return (result & 0xff07) == NVME_AER_NOTICE_DISC_CHANGED;
+}
+
+/*
+ * discover --persistent: keep the discovery controller around and
+ * re-read its log whenever it signals a change (the kernel forwards the
+ * AEN as an NVME_AEN uevent), applying only the difference. Runs until
+ * SIGINT/SIGTERM, then deletes the discovery controller.
+ */
+static int discover_persistent(char *argstr, const struct config *c)
+{
+	struct nvmf_disc_rsp_page_hdr *log = NULL, *new;
+	struct nvme_uevent ev;
+	char dev_name[32];
+	int instance = -1, numrec = 0, new_numrec, uev, ret = 0, inst;
+	bool refresh = false, aen = false;
+	time_t last = 0;
+
+	uev = nvme_uevent_open();
+	if (uev < 0) {
+		fprintf(stderr, "failed to open uevent socket: %s\n",
+			strerror(-uev));
+		return uev;
+	}
+
+	signal(SIGINT, persistent_sighandler);
+	signal(SIGTERM, persistent_sighandler);
+
+	while (!persistent_stop) {
+		if (instance < 0) {
+			instance = persistent_attach(argstr, &aen);
+			if (instance < 0) {
+				sleep(PERSISTENT_RETRY);
+				continue;
+			}
+			refresh = true;
+		}
+
+		if (!aen && time(NULL) - last >= PERSISTENT_POLL)
+			refresh = true;
+
+		if (refresh) {
+			refresh = false;
+			last = time(NULL);
+			new = NULL;
+			new_numrec = 0;
+			snprintf(dev_name, sizeof(dev_name), "/dev/nvmf%d",
+				 instance);
+			ret = nvmf_get_log_page_discovery(dev_name, argstr,
+							  &new, &new_numrec);
+			if (ret == DISC_OK || ret == DISC_NO_LOG) {
+				if (ret == DISC_NO_LOG)
+					new_numrec = 0;
+				persistent_apply(log, numrec, new, new_numrec,
+						 c);
+				free(log);
+				log = new;
+				numrec = new_numrec;
+			} else if (ret > 0)
+				print_discovery_error(ret);
+		}
+
+		ret = nvme_uevent_recv(uev, &ev, 1000);
+		if (ret == -ENOBUFS) {
+			refresh = true;
+			continue;
+		}
+		if (ret < 0)
+			break;
+		if (!ret || !nvme_uevent_is_ctrl(&ev, &inst) || inst != instance)
+			continue;
+
+		if (!strcmp(ev.action, "remove")) {
+			fprintf(stderr, "discovery controller nvmf%d lost\n",
+				instance);
+			instance = -1;
+		} else if (ev.aen[0] && disc_log_changed_aen(ev.aen))
+			refresh = true;
+	}
+
+	if (instance >= 0)
+		remove_ctrl(instance);
+	close(uev);
+	free(log);
+	return ret < 0 ? ret : 0;
+}
+
+static int ctrl_queue_entries(int instance)
+{
+	char dev_name[32];
+	__u32 cap;
+	int fd, ret = -1;
+
+	snprintf(dev_name, sizeof(dev_name), "/dev/nvmf%d", instance);
+	fd = open(dev_name, O_RDWR);
+	if (fd < 0)
+		return -1;
+	if (!nvme_get_property(fd, NVME_REG_CAP, &cap))
+		ret = NVME_CAP_MQES(cap) + 1;
+	close(fd);
+	return ret;
+}
+
+/* Largest queue an existing controller of @nqn accepts (MQES + 1), or -1 */
+static int subsys_queue_entries(const char *nqn)
+{
+	struct dirent **devices;
+	char subsysnqn[NVMF_NQN_FIELD_LEN];
+	int i, n, instance, ret = -1;
+
+	n = scandir(SYS_NVMF, &devices, scan_sys_nvme_filter, alphasort);
+	if (n < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (ret < 0 &&
+		    sscanf(devices[i]->d_name, "nvmf%d", &instance) == 1 &&
+		    !read_ctrl_attr(devices[i]->d_name, "subsysnqn",
+				    subsysnqn, sizeof(subsysnqn)) &&
+		    !strcmp(subsysnqn, nqn))
+			ret = ctrl_queue_entries(instance);
+		free(devices[i]);
+	}
+	free(devices);
+	return ret;
+}
+
+static bool is_auto(const char *val)
+{
+	return val && !strcmp(val, "auto");
+}
+
+/* Values --auto-queues picked; the config strings point into it */
+struct auto_queue_vals {
+	char nr_io[12];
+	char queue_size[12];
+	char nr_write[12];
+	char nr_poll[12];
+	int cpus;
+	int node;
+};
+
+/*
+ * --auto-queues: size the I/O queues from the host instead of letting the
+ * driver create one per CPU. The queue count follows the CPUs of the NUMA
+ * node the host_traddr interface sits on (all online CPUs if that is not
+ * known), capped at AUTO_MAX_IO_QUEUES; depth splits AUTO_DEPTH_BUDGET
+ * entries over those queues and is clamped to MQES when another
+ * controller of the same subsystem already tells us what it is.
+ * "--nr-write-queues=auto" and "--nr-poll-queues=auto" add dedicated
+ * queues carved out of the same count. Explicit values are left alone.
+ *
+ * The chosen values are formatted into @v, which must live as long as @c
+ * is used.
+ */
+static void auto_queues(struct config *c, const char *nqn,
+			struct auto_queue_vals *v)
+{
+	int io, write = 0, poll = 0, depth, entries = -1;
+
+	v->node = c->host_traddr ? nvme_addr_numa_node(c->host_traddr) : -1;
+	v->cpus = nvme_node_cpus(v->node);
+
+	io = c->nr_io_queues ? atoi(c->nr_io_queues) :
+		(v->cpus < AUTO_MAX_IO_QUEUES ? v->cpus : AUTO_MAX_IO_QUEUES);
+	if (io < 1)
+		io = 1;
+
+	if (is_auto(c->nr_write_queues) && io > 1) {
+		write = io / 2;
+		io -= write;
+	}
+	if (is_auto(c->nr_poll_queues)) {
+		poll = io / 4 ? io / 4 : 1;
+		if (poll > AUTO_MAX_POLL_QUEUES)
+			poll = AUTO_MAX_POLL_QUEUES;
+	}
+
+	depth = AUTO_DEPTH_BUDGET / (io + write);
+	if (depth < AUTO_MIN_QUEUE_SIZE)
+		depth = AUTO_MIN_QUEUE_SIZE;
+	if (depth > AUTO_MAX_QUEUE_SIZE)
+		depth = AUTO_MAX_QUEUE_SIZE;
+	if (nqn)
+		entries = subsys_queue_entries(nqn);
+	if (entries > 0 && depth > entries)
+		depth = entries;
+
+	if (!c->nr_io_queues) {
+		snprintf(v->nr_io, sizeof(v->nr_io), "%d", io);
+		c->nr_io_queues = v->nr_io;
+	}
+	if (!c->queue_size) {
+		snprintf(v->queue_size, sizeof(v->queue_size), "%d", depth);
+		c->queue_size = v->queue_size;
+	}
+	if (is_auto(c->nr_write_queues)) {
+		snprintf(v->nr_write, sizeof(v->nr_write), "%d", write);
+		c->nr_write_queues = write ? v->nr_write : NULL;
+	}
+	if (is_auto(c->nr_poll_queues)) {
+		snprintf(v->nr_poll, sizeof(v->nr_poll), "%d", poll);
+		c->nr_poll_queues = v->nr_poll;
+	}
+}
+
+static void show_auto_queues(FILE *out, const struct config *c,
+			     const struct auto_queue_vals *v)
+{
+	fprintf(out, "auto-queues: %s I/O x %s entries", c->nr_io_queues,
+		c->queue_size);
+	if (c->nr_write_queues)
+		fprintf(out, ", %s write", c->nr_write_queues);
+	if (c->nr_poll_queues)
+		fprintf(out, ", %s poll", c->nr_poll_queues);
+	if (v->node >= 0)
+		fprintf(out, " (%d CPUs on node %d)\n", v->cpus, v->node);
+	else
+		fprintf(out, " (%d CPUs)\n", v->cpus);
+}
+
+static int check_auto_queues(const struct config *c)
+{
+	if (!c->auto_queues &&
+	    (is_auto(c->nr_write_queues) || is_auto(c->nr_poll_queues))) {
+		fprintf(stderr, "\"auto\" queue counts need --auto-queues\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* Print the --timing table and release the recorder */
+static int stats_finish(int ret)
+{
+	fabrics_stats_report();
+	fabrics_stats_exit();
+	return ret;
+}
+
+int discover(const char *desc, int argc, char **argv, bool connect)
+{
+	struct auto_queue_vals queues;
+	char argstr[BUF_SIZE];
+	int ret;
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"transport",   't', "LIST", CFG_STRING, &cfg.transport,   required_argument, "transport type" },
+		{"traddr",      'a', "LIST", CFG_STRING, &cfg.traddr,      required_argument, "transport address" },
+		{"trsvcid",     's', "LIST", CFG_STRING, &cfg.trsvcid,     required_argument, "transport service id (e.g. IP port)" },
+		{"host-traddr", 'w', "LIST", CFG_STRING, &cfg.host_traddr, required_argument, "host traddr (e.g. FC WWN's)" },
+		{"hostnqn",     'q', "LIST", CFG_STRING, &cfg.hostnqn,     required_argument, "user-defined hostnqn (if default not used)" },
+		{"hostid",      'I', "LIST", CFG_STRING, &cfg.hostid,      required_argument, "user-defined hostid (if default not used)"},
+		{"queue-size",  'Q', "LIST", CFG_STRING, &cfg.queue_size,  required_argument, "number of io queue elements to use (default 128)" },
+		{"nr-io-queues",'i', "LIST", CFG_STRING, &cfg.nr_io_queues,required_argument, "number of io queues to use (default is core count)" },
+		{"raw",         'r', "LIST", CFG_STRING, &cfg.raw,         required_argument, "raw output file" },
+		{"nr-write-queues", 'W', "LIST", CFG_STRING, &cfg.nr_write_queues, required_argument, "number of write queues to use (default 0)" },
+		{"nr-poll-queues",  'P', "LIST", CFG_STRING, &cfg.nr_poll_queues,  required_argument, "number of poll queues to use (default 0)" },
+		{"tos",         'T', "LIST", CFG_STRING, &cfg.tos,         required_argument, "type of service (tcp)" },
+		{"hdr_digest",  'g', "",     CFG_NONE,   &cfg.hdr_digest,  no_argument,       "enable transport protocol header digest (tcp)" },
+		{"data_digest", 'G', "",     CFG_NONE,   &cfg.data_digest, no_argument,       "enable transport protocol data digest (tcp)" },
+		{"parallel",    'C', "NUM",  CFG_POSITIVE, &cfg.parallel,  required_argument, "number of connects to run at once (connect-all)" },
+		{"duplicate_connect", 'D', "", CFG_NONE, &cfg.duplicate_connect, no_argument, "connect even if a matching controller already exists (connect-all)" },
+		{"persistent",  'p', "",     CFG_NONE, &cfg.persistent,    no_argument,       "keep the discovery controller and follow log changes" },
+		{"remove-stale",'R', "",     CFG_NONE, &cfg.remove_stale,  no_argument,       "with --persistent, disconnect entries that leave the log" },
+		{"auto-queues", 'A', "",     CFG_NONE, &cfg.auto_queues,   no_argument,       "choose queue count and size from the host topology" },
+		{"log",         0,   "FILE", CFG_STRING, &cfg.log,         required_argument, "append a JSON record of every fabrics operation to FILE" },
+		{"timing",      0,   "",     CFG_NONE,   &cfg.timing,      no_argument,       "print per target timing of fabrics operations" },
+		{NULL},
+	};
+
+	memset(&cfg, 0, sizeof(cfg));
+	argconfig_parse(argc, argv, desc, command_line_options, &cfg,
+			sizeof(cfg));
+
+	cfg.nqn = NVME_DISC_SUBSYS_NAME;
+
+	if (cfg.persistent && runner) {
+		fprintf(stderr, "--persistent can not be used from %s\n",
+			runner);
+		return -EINVAL;
+	}
+
+	ret = fabrics_stats_init(cfg.log, cfg.timing);
+	if (ret)
+		return ret;
+
+	ret = check_auto_queues(&cfg);
+	if (ret)
+		return stats_finish(ret);
+	if (cfg.auto_queues && (connect || cfg.persistent)) {
+		auto_queues(&cfg, NULL, &queues);
+		show_auto_queues(stdout, &cfg, &queues);
+	}
+
+	if (cfg.persistent) {
+		if (!cfg.transport && !cfg.traddr) {
+			fprintf(stderr, "--persistent needs a discovery "
+				"controller (-t/-a)\n");
+			return stats_finish(-EINVAL);
+		}
+		ret = build_options(argstr, BUF_SIZE);
+		if (ret)
+			return stats_finish(ret);
+		return stats_finish(discover_persistent(argstr, &cfg));
+	}
+
+	if (!cfg.transport && !cfg.traddr) {
+		return stats_finish(discover_from_conf_file(desc, command_line_options,
+				connect));
+	} else {
+		ret = build_options(argstr, BUF_SIZE);
+		if (ret)
+			return stats_finish(ret);
+
+		return stats_finish(do_discover(argstr, connect, &cfg));
+	}
+}
+
+struct manifest_job {
+	struct config cfg;
+	struct auto_queue_vals queues;
+	char argstr[BUF_SIZE];
+	int line;
+	bool existing;
+	int ret;
+	int attempts;
+	double msecs;
+};
+
+/* Same key build_conn_index() uses, for a target given as options */
+static void cfg_conn_key(const struct config *c, char *key, size_t len)
+{
+	const char *trsvcid = c->trsvcid;
+
+	if (!strcmp(c->transport, "loop")) {
+		conn_key(key, len, c->nqn, c->transport, NULL, NULL, NULL);
+	} else if (!strcmp(c->transport, "fc")) {
+		conn_key(key, len, c->nqn, c->transport, c->traddr, NULL,
+			 c->host_traddr);
+	} else if (!strcmp(c->transport, "tcp")) {
+		conn_key(key, len, c->nqn, c->transport, c->traddr, trsvcid,
+			 c->host_traddr);
+	} else {
+		if (!trsvcid && !strcmp(c->transport, "rdma"))
+			trsvcid = "4420";
+		conn_key(key, len, c->nqn, c->transport, c->traddr, trsvcid,
+			 NULL);
+	}
+}
+
+/*
+ * Catch unknown options and missing values before handing an entry to
+ * argconfig_parse(), which would print the usage text and give up.
+ */
+static int manifest_check_args(const struct manifest_entry *e,
+		const struct argconfig_commandline_options *opts,
+		const char *path)
+{
+	const struct argconfig_commandline_options *o;
+	const char *a;
+	int i;
+
+	for (i = 1; i < e->argc; i++) {
+		a = e->argv[i];
+		if (a[0] != '-' || !a[1]) {
+			fprintf(stderr, "%s:%d: unexpected '%s'\n", path,
+				e->line, a);
+			return -EINVAL;
+		}
+		for (o = opts; o->option; o++) {
+			if (a[1] == '-' ? !strcmp(a + 2, o->option) :
+			    a[2] ? !strcmp(a + 1, o->option) :
+			    a[1] == o->short_option)
+				break;
+		}
+		if (!o->option) {
+			fprintf(stderr, "%s:%d: unknown option '%s'\n", path,
+				e->line, a);
+			return -EINVAL;
+		}
+		if (!strcmp(o->option, "manifest") ||
+		    !strcmp(o->option, "parallel") ||
+		    !strcmp(o->option, "log") || !strcmp(o->option, "timing")) {
+			fprintf(stderr, "%s:%d: '%s' applies to the whole "
+				"manifest, give it on the command line\n",
+				path, e->line, a);
+			return -EINVAL;
+		}
+		if (o->argument_type == required_argument &&
+		    ++i == e->argc) {
+			fprintf(stderr, "%s:%d: '%s' needs a value\n", path,
+				e->line, a);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Turn every manifest entry into a connect string. Nothing is connected
+ * unless all entries are valid; each problem is reported with its line.
+ */
+static int manifest_prepare(const char *desc,
+		const struct argconfig_commandline_options *opts,
+		const char *path, struct manifest *m,
+		struct manifest_job *jobs)
+{
+	struct config base = cfg;
+	struct hash_table seen;
+	int i, ret, errors = 0;
+	long first;
+
+	if (hash_init(&seen, m->n))
+		return -ENOMEM;
+
+	for (i = 0; i < m->n; i++) {
+		struct manifest_job *job = &jobs[i];
+
+		job->line = m->entries[i].line;
+		ret = manifest_check_args(&m->entries[i], opts, path);
+		if (ret)
+			goto bad;
+
+		/* every entry starts from the command line options */
+		cfg = base;
+		argconfig_parse(m->entries[i].argc, m->entries[i].argv, desc,
+				opts, &cfg, sizeof(cfg));
+		if (!cfg.nqn) {
+			fprintf(stderr, "%s:%d: need a -n argument\n", path,
+				job->line);
+			goto bad;
+		}
+		ret = check_auto_queues(&cfg);
+		if (ret)
+			goto bad;
+		if (cfg.auto_queues) {
+			/* stdout carries the report, which may be JSON */
+			auto_queues(&cfg, cfg.nqn, &job->queues);
+			fprintf(stderr, "%s:%d: ", path, job->line);
+			show_auto_queues(stderr, &cfg, &job->queues);
+		}
+		ret = build_options(job->argstr, BUF_SIZE);
+		if (ret) {
+			fprintf(stderr, "%s:%d: invalid target\n", path,
+				job->line);
+			goto bad;
+		}
+		job->cfg = cfg;
+
+		first = (long)hash_lookup(&seen, job->argstr);
+		if (first) {
+			fprintf(stderr, "%s:%d: same target as line %ld\n",
+				path, job->line, first);
+			goto bad;
+		}
+		hash_insert(&seen, job->argstr, (void *)(long)job->line);
+		continue;
+bad:
+		errors++;
+	}
+
+	hash_free(&seen, NULL);
+	cfg = base;
+	if (errors) {
+		fprintf(stderr, "%s: %d invalid target(s), nothing connected\n",
+			path, errors);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static bool connect_retryable(int err)
+{
+	switch (err) {
+	case -EAGAIN:
+	case -EBUSY:
+	case -EINTR:
+	case -EIO:
+	case -ETIMEDOUT:
+	case -ECONNREFUSED:
+	case -ECONNRESET:
+	case -EHOSTUNREACH:
+	case -ENETUNREACH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void manifest_connect_one(unsigned int idx, void *arg)
+{
+	struct manifest_job *job = (struct manifest_job *)arg + idx;
+	unsigned int delay = MANIFEST_BACKOFF;
+	struct timespec start, end;
+
+	if (job->existing)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		job->attempts++;
+		job->ret = add_ctrl(job->argstr);
+		if (job->ret >= 0 || job->attempts > MANIFEST_RETRIES ||
+		    !connect_retryable(job->ret))
+			break;
+		sleep(delay);
+		delay *= 2;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->msecs = (end.tv_sec - start.tv_sec) * 1000.0 +
+		     (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+static void manifest_report(struct manifest_job *jobs, int n)
+{
+	struct json_object *root, *t;
+	struct json_array *targets;
+	char dev[32];
+	int i;
+
+	root = json_create_object();
+	targets = json_create_array();
+	for (i = 0; i < n; i++) {
+		const struct config *c = &jobs[i].cfg;
+
+		t = json_create_object();
+		json_object_add_value_int(t, "line", jobs[i].line);
+		json_object_add_value_string(t, "nqn", c->nqn);
+		json_object_add_value_string(t, "transport", c->transport);
+		if (c->traddr)
+			json_object_add_value_string(t, "traddr", c->traddr);
+		if (c->trsvcid)
+			json_object_add_value_string(t, "trsvcid", c->trsvcid);
+		if (c->host_traddr)
+			json_object_add_value_string(t, "host_traddr",
+						     c->host_traddr);
+		if (jobs[i].ret >= 0) {
+			snprintf(dev, sizeof(dev), "nvmf%d", jobs[i].ret);
+			json_object_add_value_int(t, "instance", jobs[i].ret);
+			json_object_add_value_string(t, "device", dev);
+			json_object_add_value_string(t, "status",
+				jobs[i].existing ? "existing" : "connected");
+		} else {
+			json_object_add_value_string(t, "status", "failed");
+			json_object_add_value_string(t, "error",
+						     strerror(-jobs[i].ret));
+		}
+		json_object_add_value_int(t, "attempts", jobs[i].attempts);
+		/* json.c prints floats without decimals */
+		json_object_add_value_int(t, "usecs",
+					  (long long)(jobs[i].msecs * 1000));
+		json_array_add_value_object(targets, t);
+	}
+	json_object_add_value_array(root, "targets", targets);
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
+/*
+ * connect --manifest: the host NQN and host ID files are read once for
+ * all targets, every entry is validated before the first connect, and
+ * the connects then run on a worker pool. A connect that fails with a
+ * transient error is retried with exponential backoff. Targets that
+ * already have a matching controller are reported instead of connected
+ * again, unless --duplicate_connect is given.
+ */
+static int connect_manifest(const char *desc,
+		const struct argconfig_commandline_options *opts)
+{
+	struct manifest_job *jobs;
+	struct hash_table conns;
+	bool have_conns = false;
+	struct manifest m;
+	char key[NVMF_NQN_FIELD_LEN + BUF_SIZE + 40];
+	void *data;
+	int i, ret, failed = 0;
+
+	if (!cfg.hostnqn)
+		nvmf_hostnqn_file();
+	if (!cfg.hostid)
+		nvmf_hostid_file();
+
+	ret = manifest_load(cfg.manifest, &m);
+	if (ret)
+		return ret;
+	if (!m.n) {
+		fprintf(stderr, "%s: no targets\n", cfg.manifest);
+		manifest_free(&m);
+		return -EINVAL;
+	}
+
+	jobs = calloc(m.n, sizeof(*jobs));
+	if (!jobs) {
+		manifest_free(&m);
+		return -ENOMEM;
+	}
+
+	ret = manifest_prepare(desc, opts, cfg.manifest, &m, jobs);
+	if (ret)
+		goto out;
+
+	if (!cfg.duplicate_connect && !build_conn_index(&conns))
+		have_conns = true;
+	for (i = 0; have_conns && i < m.n; i++) {
+		if (jobs[i].cfg.duplicate_connect)
+			continue;
+		cfg_conn_key(&jobs[i].cfg, key, sizeof(key));
+		data = hash_lookup(&conns, key);
+		if (data) {
+			jobs[i].existing = true;
+			jobs[i].ret = (int)(long)data - 1;
+		}
+	}
+	if (have_conns)
+		hash_free(&conns, NULL);
+
+	parallel_for(m.n, cfg.parallel, manifest_connect_one, jobs);
+
+	manifest_report(jobs, m.n);
+	for (i = 0; i < m.n; i++)
+		if (jobs[i].ret < 0)
+			failed++;
+	ret = failed ? -EIO : 0;
+out:
+	free(jobs);
+	manifest_free(&m);
+	return ret;
+}
+
+int connect(const char *desc, int argc, char **argv)
+{
+	struct auto_queue_vals queues;
+	char argstr[BUF_SIZE];
+	int instance, ret;
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"transport",       't', "LIST", CFG_STRING, &cfg.transport,       required_argument, "transport type" },
+		{"nqn",             'n', "LIST", CFG_STRING, &cfg.nqn,             required_argument, "nqn name" },
+		{"traddr",          'a', "LIST", CFG_STRING, &cfg.traddr,          required_argument, "transport address" },
+		{"trsvcid",         's', "LIST", CFG_STRING, &cfg.trsvcid,         required_argument, "transport service id (e.g. IP port)" },
+		{"host-traddr",     'w', "LIST", CFG_STRING, &cfg.host_traddr,     required_argument, "host traddr (e.g. FC WWN's)" },
+		{"hostnqn",         'q', "LIST", CFG_STRING, &cfg.hostnqn,         required_argument, "user-defined hostnqn" },
+		{"hostid",          'I', "LIST", CFG_STRING, &cfg.hostid,      required_argument, "user-defined hostid (if default not used)"},
+		{"nr-io-queues",    'i', "LIST", CFG_STRING, &cfg.nr_io_queues,    required_argument, "number of io queues to use (default is core count)" },
+		{"queue-size",      'Q', "LIST", CFG_STRING, &cfg.queue_size,      required_argument, "number of io queue elements to use (default 128)" },
+		{"keep-alive-tmo",  'k', "LIST", CFG_STRING, &cfg.keep_alive_tmo,  required_argument, "keep alive timeout period in seconds" },
+		{"reconnect-delay", 'c', "LIST", CFG_STRING, &cfg.reconnect_delay, required_argument, "reconnect timeout period in seconds" },
+		{"ctrl-loss-tmo",   'l', "LIST", CFG_STRING, &cfg.ctrl_loss_tmo,   required_argument, "controller loss timeout period in seconds" },
+		{"nr-write-queues", 'W', "LIST", CFG_STRING, &cfg.nr_write_queues, required_argument, "number of write queues to use (default 0)" },
+		{"nr-poll-queues",  'P', "LIST", CFG_STRING, &cfg.nr_poll_queues,  required_argument, "number of poll queues to use (default 0)" },
+		{"tos",             'T', "LIST", CFG_STRING, &cfg.tos,             required_argument, "type of service (tcp)" },
+		{"hdr_digest",      'g', "",     CFG_NONE,   &cfg.hdr_digest,      no_argument,       "enable transport protocol header digest (tcp)" },
+		{"data_digest",     'G', "",     CFG_NONE,   &cfg.data_digest,     no_argument,       "enable transport protocol data digest (tcp)" },
+		{"duplicate_connect", 'D', "", CFG_NONE, &cfg.duplicate_connect, no_argument, "allow duplicate connections between same transport host and subsystem port" },
+		{"auto-queues",     'A', "",     CFG_NONE,   &cfg.auto_queues,     no_argument,       "choose queue count and size from the host topology" },
+		{"log",             0,   "FILE", CFG_STRING, &cfg.log,             required_argument, "append a JSON record of every fabrics operation to FILE" },
+		{"timing",          0,   "",     CFG_NONE,   &cfg.timing,          no_argument,       "print per target timing of fabrics operations" },
+		{"manifest",        'm', "FILE", CFG_STRING, &cfg.manifest,        required_argument, "connect every target listed in FILE (JSON or discovery.conf syntax)" },
+		{"parallel",        'C', "NUM",  CFG_POSITIVE, &cfg.parallel,      required_argument, "number of manifest targets to connect at once" },
+		{NULL},
+	};
+
+	memset(&cfg, 0, sizeof(cfg));
+	argconfig_parse(argc, argv, desc, command_line_options, &cfg,
+			sizeof(cfg));
+
+	ret = fabrics_stats_init(cfg.log, cfg.timing);
+	if (ret)
+		return ret;
+
+	if (cfg.manifest)
+		return stats_finish(connect_manifest(desc,
+						     command_line_options));
+
+	ret = check_auto_queues(&cfg);
+	if (ret)
+		return stats_finish(ret);
+
+	if (!cfg.nqn) {
+		fprintf(stderr, "need a -n argument\n");
+		return stats_finish(-EINVAL);
+	}
+
+	if (cfg.auto_queues) {
+		auto_queues(&cfg, cfg.nqn, &queues);
+		show_auto_queues(stdout, &cfg, &queues);
+	}
+
+	ret = build_options(argstr, BUF_SIZE);
+	if (ret)
+		return stats_finish(ret);
+
+	instance = add_ctrl(argstr);
+	if (instance < 0)
+		return stats_finish(instance);
+
+	if (cfg.auto_queues) {
+		int entries = ctrl_queue_entries(instance);
+
+		if (entries > 0 && entries < atoi(cfg.queue_size))
+			printf("nvmf%d: queue size limited to %d by MQES\n",
+			       instance, entries);
+	}
+	return stats_finish(0);
+}
+
+struct disconnect_job {
+	int instance;
+	int ret;
+};
+
+static void disconnect_one(unsigned int idx, void *arg)
+{
+	struct disconnect_job *job = (struct disconnect_job *)arg + idx;
+
+	job->ret = remove_ctrl(job->instance);
+}
+
+/*
+ * Delete every controller whose subsystem NQN matches @pattern (a glob
+ * for match_wildcard(), or NULL for all controllers). Matches are
+ * collected in one pass over /sys/class/nvmf and then deleted
+ * concurrently, since each delete_controller write blocks until the
+ * teardown is done.
+ *
+ * Returns the number of controllers successfully disconnected, or a
+ * negative errno if the controllers could not be listed.
+ */
+static int disconnect_by_nqn(const char *pattern)
+{
+	struct dirent **devices = NULL;
+	struct disconnect_job *jobs;
+	char subsysnqn[NVMF_NQN_FIELD_LEN];
+	int i, n, nr_jobs = 0, instance, ret = 0;
+
+	if (pattern && strlen(pattern) > NVMF_NQN_SIZE)
+		return -EINVAL;
+
+	n = scandir(SYS_NVMF, &devices, scan_sys_nvme_filter, alphasort);
+	if (n < 0)
+		return -errno;
+
+	jobs = calloc(n ? n : 1, sizeof(*jobs));
+	if (!jobs) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *ctrl = devices[i]->d_name;
+
+		if (sscanf(ctrl, "nvmf%d", &instance) != 1)
+			continue;
+		if (pattern &&
+		    (read_ctrl_attr(ctrl, "subsysnqn", subsysnqn,
+				    sizeof(subsysnqn)) ||
+		     !match_wildcard(pattern, subsysnqn)))
+			continue;
+		jobs[nr_jobs++].instance = instance;
+	}
+
+	parallel_for(nr_jobs, nr_jobs < PARALLEL_MAX_WORKERS ?
+		     nr_jobs : PARALLEL_MAX_WORKERS, disconnect_one, jobs);
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (!jobs[i].ret)
+			ret++;
+		else
+			fprintf(stderr, "Failed to disconnect nvmf%d: %s\n",
+				jobs[i].instance, strerror(jobs[i].ret));
+	}
+	free(jobs);
+free:
+	for (i = 0; i < n; i++)
+		free(devices[i]);
+	free(devices);
+
+	return ret;
+}
+
+static int disconnect_by_device(char *device)
+{
+	int instance;
+	int ret;
+
+	device = basename(device);
+	ret = sscanf(device, "nvmf%d", &instance);
+	if (ret < 0)
+		return ret;
+	if (!ret)
+		return -1;
+
+	return remove_ctrl(instance);
+}
+
+int disconnect(const char *desc, int argc, char **argv)
+{
+	const char *nqn = "nqn name, may contain * and ? wildcards";
+	const char *device = "nvme device";
+	const char *all = "disconnect all fabrics controllers";
+	const char *log = "append a JSON record of every delete to FILE";
+	const char *timing = "print per target timing of the deletes";
+	int ret = 0;
+
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"nqn",    'n', "LIST", CFG_STRING, &cfg.nqn,    required_argument, nqn},
+		{"device", 'd', "LIST", CFG_STRING, &cfg.device, required_argument, device},
+		{"all",    'A', "",     CFG_NONE,   &cfg.all,    no_argument,       all},
+		{"log",    0,   "FILE", CFG_STRING, &cfg.log,    required_argument, log},
+		{"timing", 0,   "",     CFG_NONE,   &cfg.timing, no_argument,       timing},
+		{NULL},
+	};
+
+	memset(&cfg, 0, sizeof(cfg));
+	argconfig_parse(argc, argv, desc, command_line_options, &cfg,
+			sizeof(cfg));
+
+	ret = fabrics_stats_init(cfg.log, cfg.timing);
+	if (ret)
+		return ret;
+
+	if (!cfg.nqn && !cfg.device && !cfg.all) {
+		fprintf(stderr, "need a -n, -d or --all argument\n");
+		return stats_finish(-EINVAL);
+	}
+
+	if (cfg.all) {
+		ret = disconnect_by_nqn(NULL);
+		if (ret < 0)
+			fprintf(stderr, "Failed to disconnect all controllers\n");
+		else {
+			printf("disconnected %d controller(s)\n", ret);
+			ret = 0;
+		}
+		return stats_finish(ret);
+	}
+
+	if (cfg.nqn) {
+		ret = disconnect_by_nqn(cfg.nqn);
+		if (ret < 0)
+			fprintf(stderr, "Failed to disconnect by NQN: %s\n",
+				cfg.nqn);
+		else {
+			printf("NQN:%s disconnected %d controller(s)\n", cfg.nqn, ret);
+			ret = 0;
+		}
+	}
+
+	if (cfg.device) {
+		ret = disconnect_by_device(cfg.device);
+		if (ret)
+			fprintf(stderr,
+				"Failed to disconnect by device name: %s\n",
+				cfg.device);
+	}
+
+	return stats_finish(ret);
+}
+
+struct reconnect_job {
+	int instance;
+	char state[32];
+	char argstr[BUF_SIZE];
+	const struct config *cfg;
+	unsigned int seed;
+	int ret;
+	int attempts;
+	double msecs;
+};
+
+static void msleep(unsigned int ms)
+{
+	struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (ms % 1000) * 1000000L,
+	};
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+/* @ms less a random part of up to @jitter percent of it */
+static unsigned int jittered(unsigned int ms, unsigned int jitter,
+			     unsigned int *seed)
+{
+	unsigned int spread = (unsigned long long)ms * jitter / 100;
 
-	return ret;
+	if (!spread)
+		return ms;
+	return ms - spread + rand_r(seed) % (spread + 1);
 }
 
-static int discover_from_conf_file(const char *desc, char *argstr,
-		const struct argconfig_commandline_options *opts, bool connect)
+/*
+ * Rebuild the connect string of an existing controller from sysfs. The
+ * kernel does not export every connect option (queue counts, digests),
+ * those fall back to their defaults.
+ */
+static int ctrl_connect_args(const char *ctrl, char *argstr, size_t len)
 {
-	FILE *f;
-	char line[256], *ptr, *args, **argv;
-	int argc, err, ret = 0;
+	static const struct {
+		const char *attr;
+		const char *opt;
+	} optional[] = {
+		{ "hostnqn",		"hostnqn" },
+		{ "hostid",		"hostid" },
+		{ "kato",		"keep_alive_tmo" },
+		{ "reconnect_delay",	"reconnect_delay" },
+		{ "ctrl_loss_tmo",	"ctrl_loss_tmo" },
+	};
+	char nqn[NVMF_NQN_FIELD_LEN], transport[16], address[BUF_SIZE / 2];
+	char val[NVMF_NQN_FIELD_LEN];
+	char *opts, *p, *host_traddr = NULL, *src_addr = NULL;
+	size_t n;
+	int i;
 
-	f = fopen(PATH_NVMF_DISC, "r");
-	if (f == NULL) {
-		fprintf(stderr, "No discover params given and no %s conf\n",
-			PATH_NVMF_DISC);
-		return -EINVAL;
-	}
+	if (read_ctrl_attr(ctrl, "subsysnqn", nqn, sizeof(nqn)) ||
+	    read_ctrl_attr(ctrl, "transport", transport, sizeof(transport)) ||
+	    read_ctrl_attr(ctrl, "address", address, sizeof(address)))
+		return -ENOENT;
 
-	while (fgets(line, sizeof(line), f) != NULL) {
-		if (line[0] == '#' || line[0] == '\n')
+	n = snprintf(argstr, len, "nqn=%s,transport=%s", nqn, transport);
+
+	/*
+	 * "address" also carries read-only fields, such as the src_addr a
+	 * live TCP controller is bound to, that /dev/nvme-fabrics rejects.
+	 * Keep the connect options only; src_addr stands in for a missing
+	 * host_traddr so the new controller leaves from the same address.
+	 */
+	opts = address;
+	while ((p = strsep(&opts, ",")) != NULL) {
+		if (!strncmp(p, "traddr=", 7) || !strncmp(p, "trsvcid=", 8) ||
+		    !strncmp(p, "host_iface=", 11))
+			n += snprintf(argstr + n, len - n, ",%s", p);
+		else if (!strncmp(p, "host_traddr=", 12))
+			host_traddr = p + 12;
+		else if (!strncmp(p, "src_addr=", 9))
+			src_addr = p + 9;
+	}
+	if (host_traddr || src_addr)
+		n += snprintf(argstr + n, len - n, ",host_traddr=%s",
+			      host_traddr ? host_traddr : src_addr);
+	for (i = 0; i < ARRAY_SIZE(optional); i++) {
+		if (read_ctrl_attr(ctrl, optional[i].attr, val, sizeof(val)) ||
+		    !val[0] || !strcmp(val, "off"))
 			continue;
+		n += snprintf(argstr + n, len - n, ",%s=%s", optional[i].opt,
+			      val);
+	}
+	if (!read_ctrl_attr(ctrl, "sqsize", val, sizeof(val)) && atoi(val) > 0)
+		n += snprintf(argstr + n, len - n, ",queue_size=%d",
+			      atoi(val) + 1);
+	return n < len ? 0 : -E2BIG;
+}
 
-		args = strdup(line);
-		if (!args) {
-			fprintf(stderr, "failed to strdup args\n");
-			ret = -ENOMEM;
-			goto out;
-		}
+/*
+ * add_ctrl(), retried on transient errors up to c->retries times with
+ * exponential, jittered backoff starting at c->backoff ms.
+ */
+static int add_ctrl_backoff(const char *argstr, const struct config *c,
+			    unsigned int *seed, int *attempts)
+{
+	unsigned int delay = c->backoff;
+	int ret;
 
-		argv = calloc(MAX_DISC_ARGS, BUF_SIZE);
-		if (!argv) {
-			fprintf(stderr, "failed to allocate argv vector\n");
-			free(args);
-			ret = -ENOMEM;
-			goto out;
-		}
+	for (;;) {
+		(*attempts)++;
+		ret = add_ctrl(argstr);
+		if (ret >= 0 || *attempts > c->retries ||
+		    !connect_retryable(ret))
+			return ret;
+		msleep(jittered(delay, c->jitter, seed));
+		delay = delay < RECONNECT_BACKOFF_MAX / 2 ?
+			delay * 2 : RECONNECT_BACKOFF_MAX;
+	}
+}
 
-		argc = 0;
-		argv[argc++] = "discover";
-		while ((ptr = strsep(&args, " =\n")) != NULL)
-			argv[argc++] = ptr;
+static void reconnect_one(unsigned int idx, void *arg)
+{
+	struct reconnect_job *job = (struct reconnect_job *)arg + idx;
+	const struct config *c = job->cfg;
+	struct timespec start, end;
+	int ret;
 
-		argconfig_parse(argc, argv, desc, opts, &cfg, sizeof(cfg));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = remove_ctrl(job->instance);
+	if (ret) {
+		job->ret = -ret;
+		goto out;
+	}
 
-		err = build_options(argstr, BUF_SIZE);
-		if (err) {
-			ret = err;
-			continue;
-		}
+	job->ret = add_ctrl_backoff(job->argstr, c, &job->seed, &job->attempts);
+out:
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->msecs = (end.tv_sec - start.tv_sec) * 1000.0 +
+		     (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
 
-		err = do_discover(argstr, connect);
-		if (err) {
-			ret = err;
-			continue;
-		}
+/*
+ * Hosts that lost the same fabric all come back at once. Spread their
+ * start over --stagger seconds by a hash of the host NQN, so the same
+ * host always lands in the same slot and different hosts rarely share
+ * one.
+ */
+static unsigned int reconnect_stagger_ms(const struct config *c,
+					 struct dirent **devices, int n)
+{
+	char hostnqn[NVMF_NQN_SIZE] = "";
+	int i;
 
-		free(args);
-		free(argv);
-	}
+	if (!c->stagger)
+		return 0;
 
-out:
-	fclose(f);
-	return ret;
+	if (c->hostnqn || nvmf_hostnqn_file())
+		snprintf(hostnqn, sizeof(hostnqn), "%s", c->hostnqn);
+	for (i = 0; !hostnqn[0] && i < n; i++)
+		read_ctrl_attr(devices[i]->d_name, "hostnqn", hostnqn,
+			       sizeof(hostnqn));
+	hostnqn[strcspn(hostnqn, "\n")] = '\0';
+
+	return hash_str(hostnqn) % (c->stagger * 1000);
 }
 
-int discover(const char *desc, int argc, char **argv, bool connect)
+int reconnect(const char *desc, int argc, char **argv)
 {
-	char argstr[BUF_SIZE];
-	int ret;
+	const char *nqn = "only controllers of subsystems matching this NQN "
+			  "(may contain * and ? wildcards)";
+	const char *parallel = "number of controllers to reconnect at once";
+	const char *retries = "connect attempts after the first one";
+	const char *backoff = "ms to wait before the first retry, doubled "
+			      "on each further retry";
+	const char *jitter = "percent of every wait that is randomized";
+	const char *stagger = "delay the start by up to this many seconds, "
+			      "chosen from a hash of the host NQN";
+	struct reconnect_job *jobs;
+	struct dirent **devices;
+	unsigned int delay;
+	int i, n, nr_jobs = 0, instance, ok = 0, ret;
+	char nqnbuf[NVMF_NQN_FIELD_LEN];
+
 	const struct argconfig_commandline_options command_line_options[] = {
-		{"transport",   't', "LIST", CFG_STRING, &cfg.transport,   required_argument, "transport type" },
-		{"traddr",      'a', "LIST", CFG_STRING, &cfg.traddr,      required_argument, "transport address" },
-		{"trsvcid",     's', "LIST", CFG_STRING, &cfg.trsvcid,     required_argument, "transport service id (e.g. IP port)" },
-		{"host-traddr", 'w', "LIST", CFG_STRING, &cfg.host_traddr, required_argument, "host traddr (e.g. FC WWN's)" },
-		{"hostnqn",     'q', "LIST", CFG_STRING, &cfg.hostnqn,     required_argument, "user-defined hostnqn (if default not used)" },
-		{"hostid",      'I', "LIST", CFG_STRING, &cfg.hostid,      required_argument, "user-defined hostid (if default not used)"},
-		{"queue-size",  'Q', "LIST", CFG_STRING, &cfg.queue_size,  required_argument, "number of io queue elements to use (default 128)" },
-		{"nr-io-queues",'i', "LIST", CFG_STRING, &cfg.nr_io_queues,required_argument, "number of io queues to use (default is core count)" },
-		{"raw",         'r', "LIST", CFG_STRING, &cfg.raw,         required_argument, "raw output file" },
+		{"nqn",      'n', "LIST", CFG_STRING,   &cfg.nqn,      required_argument, nqn},
+		{"hostnqn",  'q', "LIST", CFG_STRING,   &cfg.hostnqn,  required_argument, "host NQN used for --stagger"},
+		{"parallel", 'C', "NUM",  CFG_POSITIVE, &cfg.parallel, required_argument, parallel},
+		{"retries",  'r', "NUM",  CFG_POSITIVE, &cfg.retries,  required_argument, retries},
+		{"backoff",  'b', "MS",   CFG_POSITIVE, &cfg.backoff,  required_argument, backoff},
+		{"jitter",   'j', "PCT",  CFG_POSITIVE, &cfg.jitter,   required_argument, jitter},
+		{"stagger",  's', "SEC",  CFG_POSITIVE, &cfg.stagger,  required_argument, stagger},
+		{"log",      0,   "FILE", CFG_STRING,   &cfg.log,      required_argument, "append a JSON record of every fabrics operation to FILE"},
+		{"timing",   0,   "",     CFG_NONE,     &cfg.timing,   no_argument,       "print per target timing of fabrics operations"},
 		{NULL},
 	};
 
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.parallel = RECONNECT_PARALLEL;
+	cfg.retries = RECONNECT_RETRIES;
+	cfg.backoff = RECONNECT_BACKOFF;
+	cfg.jitter = RECONNECT_JITTER;
+
 	argconfig_parse(argc, argv, desc, command_line_options, &cfg,
 			sizeof(cfg));
+	if (cfg.jitter > 100) {
+		fprintf(stderr, "--jitter is a percentage (0-100)\n");
+		return -EINVAL;
+	}
+	if (!cfg.parallel)
+		cfg.parallel = 1;
 
-	cfg.nqn = NVME_DISC_SUBSYS_NAME;
+	ret = fabrics_stats_init(cfg.log, cfg.timing);
+	if (ret)
+		return ret;
 
-	if (!cfg.transport && !cfg.traddr) {
-		return discover_from_conf_file(desc, argstr,
-				command_line_options, connect);
-	} else {
-		ret = build_options(argstr, BUF_SIZE);
-		if (ret)
-			return ret;
+	n = scandir(SYS_NVMF, &devices, scan_sys_nvme_filter, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "Failed to scan %s: %s\n", SYS_NVMF,
+			strerror(errno));
+		return stats_finish(-errno);
+	}
+
+	jobs = calloc(n ? n : 1, sizeof(*jobs));
+	if (!jobs) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *ctrl = devices[i]->d_name;
+		struct reconnect_job *job = &jobs[nr_jobs];
+
+		if (sscanf(ctrl, "nvmf%d", &instance) != 1 ||
+		    read_ctrl_attr(ctrl, "state", job->state,
+				   sizeof(job->state)) ||
+		    !strcmp(job->state, "live") ||
+		    !strcmp(job->state, "deleting"))
+			continue;
+		if (cfg.nqn &&
+		    (read_ctrl_attr(ctrl, "subsysnqn", nqnbuf, sizeof(nqnbuf)) ||
+		     !match_wildcard(cfg.nqn, nqnbuf)))
+			continue;
+		if (ctrl_connect_args(ctrl, job->argstr, sizeof(job->argstr))) {
+			fprintf(stderr, "%s: cannot tell how it was connected, "
+				"skipped\n", ctrl);
+			continue;
+		}
+		job->instance = instance;
+		job->cfg = &cfg;
+		job->seed = time(NULL) ^ (getpid() << 8) ^ instance;
+		nr_jobs++;
+	}
+
+	if (!nr_jobs) {
+		printf("no controllers to reconnect\n");
+		goto free_jobs;
+	}
+
+	delay = reconnect_stagger_ms(&cfg, devices, n);
+	if (delay) {
+		printf("reconnect: starting in %u.%03u s\n", delay / 1000,
+		       delay % 1000);
+		msleep(delay);
+	}
+
+	parallel_for(nr_jobs, cfg.parallel, reconnect_one, jobs);
 
-		return do_discover(argstr, connect);
+	for (i = 0; i < nr_jobs; i++) {
+		printf("  nvmf%d (%s) ", jobs[i].instance, jobs[i].state);
+		if (jobs[i].ret >= 0) {
+			printf("-> nvmf%d", jobs[i].ret);
+			ok++;
+		} else {
+			printf("failed (%s)", strerror(-jobs[i].ret));
+		}
+		printf(" after %d attempt(s), %.3f ms\n", jobs[i].attempts,
+		       jobs[i].msecs);
 	}
+	printf("reconnect: %d of %d controller(s) reconnected\n", ok, nr_jobs);
+	ret = ok == nr_jobs ? 0 : -EIO;
+free_jobs:
+	free(jobs);
+free:
+	for (i = 0; i < n; i++)
+		free(devices[i]);
+	free(devices);
+	return stats_finish(ret);
 }
 
-int connect(const char *desc, int argc, char **argv)
-{
+#define MONITOR_POLL		1000	/* ms between controller state samples */
+
+/* What monitor knows about a fabrics controller while it exists */
+struct monitor_ctrl {
+	char state[32];
+	char last_state[32];	/* the last state before deleting */
+	char nqn[NVMF_NQN_FIELD_LEN];
 	char argstr[BUF_SIZE];
-	int instance, ret;
-	const struct argconfig_commandline_options command_line_options[] = {
-		{"transport",       't', "LIST", CFG_STRING, &cfg.transport,       required_argument, "transport type" },
-		{"nqn",             'n', "LIST", CFG_STRING, &cfg.nqn,             required_argument, "nqn name" },
-		{"traddr",          'a', "LIST", CFG_STRING, &cfg.traddr,          required_argument, "transport address" },
-		{"trsvcid",         's', "LIST", CFG_STRING, &cfg.trsvcid,         required_argument, "transport service id (e.g. IP port)" },
-		{"host-traddr",     'w', "LIST", CFG_STRING, &cfg.host_traddr,     required_argument, "host traddr (e.g. FC WWN's)" },
-		{"hostnqn",         'q', "LIST", CFG_STRING, &cfg.hostnqn,         required_argument, "user-defined hostnqn" },
-		{"hostid",          'I', "LIST", CFG_STRING, &cfg.hostid,      required_argument, "user-defined hostid (if default not used)"},
-		{"nr-io-queues",    'i', "LIST", CFG_STRING, &cfg.nr_io_queues,    required_argument, "number of io queues to use (default is core count)" },
-		{"queue-size",      'Q', "LIST", CFG_STRING, &cfg.queue_size,      required_argument, "number of io queue elements to use (default 128)" },
-		{"keep-alive-tmo",  'k', "LIST", CFG_STRING, &cfg.keep_alive_tmo,  required_argument, "keep alive timeout period in seconds" },
-		{"reconnect-delay", 'c', "LIST", CFG_STRING, &cfg.reconnect_delay, required_argument, "reconnect timeout period in seconds" },
-		{"ctrl-loss-tmo",   'l', "LIST", CFG_STRING, &cfg.ctrl_loss_tmo,   required_argument, "controller loss timeout period in seconds" },
-		{"duplicate_connect", 'D', "", CFG_NONE, &cfg.duplicate_connect, no_argument, "allow duplicate connections between same transport host and subsystem port" },
-		{NULL},
-	};
+};
 
-	argconfig_parse(argc, argv, desc, command_line_options, &cfg,
-			sizeof(cfg));
+static struct monitor_ctrl *monitor_track(struct hash_table *ctrls,
+					  const char *name)
+{
+	struct monitor_ctrl *m = hash_lookup(ctrls, name);
+
+	if (!m) {
+		m = calloc(1, sizeof(*m));
+		if (!m)
+			return NULL;
+		if (hash_insert(ctrls, name, m)) {
+			free(m);
+			return NULL;
+		}
+	}
+	read_ctrl_attr(name, "state", m->state, sizeof(m->state));
+	if (m->state[0] && strncmp(m->state, "deleting", 8))
+		memcpy(m->last_state, m->state, sizeof(m->last_state));
+	if (!m->nqn[0])
+		read_ctrl_attr(name, "subsysnqn", m->nqn, sizeof(m->nqn));
+	if (!m->argstr[0] &&
+	    ctrl_connect_args(name, m->argstr, sizeof(m->argstr)))
+		m->argstr[0] = '\0';
+	return m;
+}
 
-	ret = build_options(argstr, BUF_SIZE);
-	if (ret)
-		return ret;
+static void monitor_timestamp(char *buf, size_t len)
+{
+	struct timespec ts;
+	struct tm tm;
+	size_t n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+	n = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(buf + n, len - n, ".%03ld", ts.tv_nsec / 1000000);
+}
 
-	if (!cfg.nqn) {
-		fprintf(stderr, "need a -n argument\n");
-		return -EINVAL;
+static void monitor_print(const struct nvme_uevent *ev, const char *state,
+			  const char *nqn, int fmt)
+{
+	struct json_object *root;
+	char stamp[32];
+
+	monitor_timestamp(stamp, sizeof(stamp));
+	if (fmt != JSON) {
+		printf("%s %-6s %-10s %s", stamp, ev->action, ev->devname,
+		       ev->subsystem);
+		if (state && state[0])
+			printf(" state=%s", state);
+		if (ev->event[0])
+			printf(" event=%s", ev->event);
+		if (ev->aen[0])
+			printf(" aen=%s", ev->aen);
+		if (nqn && nqn[0])
+			printf(" nqn=%s", nqn);
+		printf("\n");
+		fflush(stdout);
+		return;
 	}
 
-	instance = add_ctrl(argstr);
-	if (instance < 0)
-		return instance;
-	return 0;
+	root = json_create_object();
+	json_object_add_value_string(root, "timestamp", stamp);
+	json_object_add_value_int(root, "seqnum", ev->seqnum);
+	json_object_add_value_string(root, "action", ev->action);
+	json_object_add_value_string(root, "device", ev->devname);
+	json_object_add_value_string(root, "subsystem", ev->subsystem);
+	if (state && state[0])
+		json_object_add_value_string(root, "state", state);
+	if (ev->event[0])
+		json_object_add_value_string(root, "event", ev->event);
+	if (ev->aen[0])
+		json_object_add_value_string(root, "aen", ev->aen);
+	if (nqn && nqn[0])
+		json_object_add_value_string(root, "nqn", nqn);
+	json_print_object(root, NULL);
+	printf("\n");
+	fflush(stdout);
+	json_free_object(root);
 }
 
-static int scan_sys_nvme_filter(const struct dirent *d)
+/*
+ * Run --exec through the shell with the event in the environment. The
+ * monitor does not wait for it; children are reaped in the main loop.
+ */
+static void monitor_exec(const char *cmd, const struct nvme_uevent *ev,
+			 const char *state, const char *nqn)
 {
-	if (!strcmp(d->d_name, "."))
-		return 0;
-	if (!strcmp(d->d_name, ".."))
-		return 0;
-	return 1;
+	char seqnum[24];
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return;
+	}
+	if (pid)
+		return;
+
+	snprintf(seqnum, sizeof(seqnum), "%llu", ev->seqnum);
+	setenv("NVME_ACTION", ev->action, 1);
+	setenv("NVME_DEVICE", ev->devname, 1);
+	setenv("NVME_SUBSYSTEM", ev->subsystem, 1);
+	setenv("NVME_SEQNUM", seqnum, 1);
+	setenv("NVME_STATE", state ? state : "", 1);
+	setenv("NVME_SUBSYSNQN", nqn ? nqn : "", 1);
+	setenv("NVME_EVENT", ev->event, 1);
+	setenv("NVME_AEN", ev->aen, 1);
+	execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+	_exit(127);
 }
 
 /*
- * Returns 1 if disconnect occurred, 0 otherwise.
+ * A controller the kernel gave up on (ctrl_loss_tmo expired while it was
+ * still connecting) is created again from its saved connect options, in
+ * a child so the monitor keeps reading events meanwhile. A controller
+ * removed while live was deleted on purpose and stays gone.
+ *
+ * The kernel moves the controller to "deleting" before removing it, and
+ * a sample may catch that, so the decision is made on the state it was
+ * in before. A controller disconnected by hand while it was connecting
+ * looks the same, and is created again too.
  */
-static int disconnect_subsys(char *nqn, char *ctrl)
+static void monitor_reconnect(const char *name, struct monitor_ctrl *m,
+			      const struct config *c)
 {
-	char *sysfs_nqn_path = NULL, *sysfs_del_path = NULL;
-	char subsysnqn[NVMF_NQN_SIZE] = {};
-	int fd, ret = 0;
+	unsigned int seed;
+	int attempts = 0, ret;
+	pid_t pid;
 
-	if (asprintf(&sysfs_nqn_path, "%s/%s/subsysnqn", SYS_NVMF, ctrl) < 0)
-		goto free;
-	if (asprintf(&sysfs_del_path, "%s/%s/delete_controller", SYS_NVMF, ctrl) < 0)
-		goto free;
+	if (!m->argstr[0] || strcmp(m->last_state, "connecting"))
+		return;
 
-	fd = open(sysfs_nqn_path, O_RDONLY);
-	if (fd < 0)
-		goto free;
+	/* the child must not repeat what the monitor has buffered */
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return;
+	}
+	if (pid)
+		return;
+
+	seed = time(NULL) ^ (getpid() << 8);
+	ret = add_ctrl_backoff(m->argstr, c, &seed, &attempts);
+	if (ret >= 0)
+		printf("reconnect: %s -> nvmf%d after %d attempt(s)\n", name,
+		       ret, attempts);
+	else
+		fprintf(stderr, "reconnect: %s failed after %d attempt(s): "
+			"%s\n", name, attempts, strerror(-ret));
+	/* _exit() skips stdio, and stdout may be a pipe */
+	fflush(stdout);
+	_exit(ret < 0);
+}
 
-	if (read(fd, subsysnqn, NVMF_NQN_SIZE) < 0)
-		goto close;
+static void monitor_event(struct nvme_uevent *ev, struct hash_table *ctrls,
+			  const struct config *c, int fmt)
+{
+	struct monitor_ctrl *m = NULL;
+	const char *state = NULL, *nqn = NULL;
+	bool is_ctrl, removed;
+	int instance, nsid;
+
+	is_ctrl = nvme_uevent_is_ctrl(ev, &instance);
+	removed = !strcmp(ev->action, "remove");
+
+	if (is_ctrl) {
+		m = removed ? hash_remove(ctrls, ev->devname) :
+			      monitor_track(ctrls, ev->devname);
+		if (m) {
+			state = m->state;
+			nqn = m->nqn;
+		}
+	}
 
-	subsysnqn[strcspn(subsysnqn, "\n")] = '\0';
-	if (strcmp(subsysnqn, nqn))
-		goto close;
+	monitor_print(ev, state, nqn, fmt);
 
-	if (!remove_ctrl_by_path(sysfs_del_path))
-		ret = 1;
- close:
-	close(fd);
- free:
-	free(sysfs_del_path);
-	free(sysfs_nqn_path);
-	return ret;
+	if (c->invalidate) {
+		if (is_ctrl || nvme_uevent_is_ns(ev, &instance, &nsid))
+			nvme_scan_invalidate(ev->devname);
+		if (strcmp(ev->action, "change"))
+			nvme_resolve_invalidate();
+	}
+	if (c->exec)
+		monitor_exec(c->exec, ev, state, nqn);
+	if (m && removed) {
+		if (c->reconnect)
+			monitor_reconnect(ev->devname, m, c);
+		free(m);
+	}
 }
 
 /*
- * Returns the number of controllers successfully disconnected.
+ * Refresh the state of every controller under /sys/class/nvmf. With
+ * @report, after the kernel dropped events, controllers that appeared
+ * or vanished meanwhile are also handled as if their add or remove
+ * event had arrived.
  */
-static int disconnect_by_nqn(char *nqn)
+static void monitor_rescan(struct hash_table *ctrls, const struct config *c,
+			   int fmt, bool report)
 {
+	struct hash_table seen = { NULL };
+	struct nvme_uevent ev;
 	struct dirent **devices = NULL;
-	int i, n, ret = 0;
-
-	if (strlen(nqn) > NVMF_NQN_SIZE)
-		return -EINVAL;
+	struct hash_entry *e;
+	unsigned int b;
+	int i, n;
 
 	n = scandir(SYS_NVMF, &devices, scan_sys_nvme_filter, alphasort);
 	if (n < 0)
-		return n;
+		n = 0;
+	if (hash_init(&seen, n + 1))
+		goto free;
 
-	for (i = 0; i < n; i++)
-		ret += disconnect_subsys(nqn, devices[i]->d_name);
+	for (i = 0; i < n; i++) {
+		hash_insert(&seen, devices[i]->d_name, NULL);
+		if (!report || hash_contains(ctrls, devices[i]->d_name)) {
+			monitor_track(ctrls, devices[i]->d_name);
+			continue;
+		}
+		memset(&ev, 0, sizeof(ev));
+		strcpy(ev.action, "add");
+		strcpy(ev.subsystem, "nvmf");
+		snprintf(ev.devname, sizeof(ev.devname), "%.*s",
+			 (int)sizeof(ev.devname) - 1, devices[i]->d_name);
+		monitor_event(&ev, ctrls, c, fmt);
+	}
 
+	if (!report)
+		goto free_seen;
+restart:
+	hash_for_each(ctrls, b, e) {
+		if (hash_contains(&seen, e->key))
+			continue;
+		memset(&ev, 0, sizeof(ev));
+		strcpy(ev.action, "remove");
+		strcpy(ev.subsystem, "nvmf");
+		snprintf(ev.devname, sizeof(ev.devname), "%s", e->key);
+		monitor_event(&ev, ctrls, c, fmt);
+		goto restart;
+	}
+free_seen:
+	hash_free(&seen, NULL);
+free:
 	for (i = 0; i < n; i++)
 		free(devices[i]);
 	free(devices);
+}
 
-	return ret;
+static void monitor_reap(void)
+{
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
 }
 
-static int disconnect_by_device(char *device)
+int monitor(const char *desc, int argc, char **argv)
 {
-	int instance;
-	int ret;
+	const char *exec = "run CMD through /bin/sh for every event, "
+			   "with the event in NVME_* environment variables";
+	const char *reconnect = "create controllers the kernel gave up "
+				"reconnecting again";
+	const char *invalidate = "drop cached identify data and device "
+				 "names of the devices an event is about";
+	struct hash_table ctrls = { NULL };
+	struct nvme_uevent ev;
+	int fd, fmt, ret;
 
-	device = basename(device);
-	ret = sscanf(device, "nvmf%d", &instance);
-	if (ret < 0)
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"exec",          'x', "CMD", CFG_STRING,   &cfg.exec,          required_argument, exec},
+		{"reconnect",     'r', "",    CFG_NONE,     &cfg.reconnect,     no_argument,       reconnect},
+		{"invalidate",    'i', "",    CFG_NONE,     &cfg.invalidate,    no_argument,       invalidate},
+		{"retries",       0,   "NUM", CFG_POSITIVE, &cfg.retries,       required_argument, "connect attempts after the first one, with --reconnect"},
+		{"backoff",       0,   "MS",  CFG_POSITIVE, &cfg.backoff,       required_argument, "ms to wait before the first retry, doubled on each further retry"},
+		{"output-format", 'o', "FMT", CFG_STRING,   &cfg.output_format, required_argument, "Output format: normal|json"},
+		{NULL},
+	};
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.retries = RECONNECT_RETRIES;
+	cfg.backoff = RECONNECT_BACKOFF;
+	cfg.jitter = RECONNECT_JITTER;
+	cfg.output_format = "normal";
+
+	ret = argconfig_parse(argc, argv, desc, command_line_options, &cfg,
+			      sizeof(cfg));
+	if (ret)
 		return ret;
-	if (!ret)
-		return -1;
 
-	return remove_ctrl(instance);
+	fmt = validate_output_format(cfg.output_format);
+	if (fmt != JSON && fmt != NORMAL)
+		return -EINVAL;
+
+	fd = nvme_uevent_open();
+	if (fd < 0) {
+		fprintf(stderr, "failed to open uevent socket: %s\n",
+			strerror(-fd));
+		return fd;
+	}
+	ret = hash_init(&ctrls, 64);
+	if (ret)
+		goto close_fd;
+
+	signal(SIGINT, persistent_sighandler);
+	signal(SIGTERM, persistent_sighandler);
+
+	/* subscribe before the first scan so nothing falls in between */
+	monitor_rescan(&ctrls, &cfg, fmt, false);
+	while (!persistent_stop) {
+		ret = nvme_uevent_recv(fd, &ev, MONITOR_POLL);
+		monitor_reap();
+		if (ret == -ENOBUFS) {
+			fprintf(stderr, "monitor: events lost, rescanning\n");
+			monitor_rescan(&ctrls, &cfg, fmt, true);
+			continue;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "uevent receive failed: %s\n",
+				strerror(-ret));
+			break;
+		}
+		if (ret)
+			monitor_event(&ev, &ctrls, &cfg, fmt);
+		else
+			monitor_rescan(&ctrls, &cfg, fmt, false);
+	}
+	if (ret >= 0)
+		ret = 0;
+
+	hash_free(&ctrls, free);
+close_fd:
+	close(fd);
+	return ret;
 }
 
-int disconnect(const char *desc, int argc, char **argv)
+static const struct {
+	const char *attr;
+	int width;
+} health_attrs[] = {
+	{ "kato",		8 },
+	{ "reconnect_delay",	10 },
+	{ "ctrl_loss_tmo",	9 },
+};
+
+/*
+ * One row per fabrics controller with its state and the timers that
+ * decide how it recovers, followed by the per target timing folded from
+ * a --log file if one is given.
+ */
+int fabric_health(const char *desc, int argc, char **argv)
 {
-	const char *nqn = "nqn name";
-	const char *device = "nvme device";
-	int ret = 0;
+	const char *log = "JSON log written by --log of connect, discover "
+			  "or disconnect";
+	struct dirent **devices;
+	char state[32], transport[16], address[NVMF_TRADDR_SIZE * 2];
+	char nqn[NVMF_NQN_FIELD_LEN], val[32];
+	int i, j, n, live = 0, ret = 0;
+	struct config health = { NULL };
 
 	const struct argconfig_commandline_options command_line_options[] = {
-		{"nqn",    'n', "LIST", CFG_STRING, &cfg.nqn,    required_argument, nqn},
-		{"device", 'd', "LIST", CFG_STRING, &cfg.device, required_argument, device},
+		{"log", 'l', "FILE", CFG_STRING, &health.log, required_argument, log},
 		{NULL},
 	};
 
-	argconfig_parse(argc, argv, desc, command_line_options, &cfg,
-			sizeof(cfg));
-	if (!cfg.nqn && !cfg.device) {
-		fprintf(stderr, "need a -n or -d argument\n");
-		return -EINVAL;
+	argconfig_parse(argc, argv, desc, command_line_options, &health,
+			sizeof(health));
+
+	/* no nvme-fabrics module loaded simply means no controllers */
+	n = scandir(SYS_NVMF, &devices, scan_sys_nvme_filter, alphasort);
+	if (n < 0 && errno != ENOENT) {
+		fprintf(stderr, "Failed to scan %s: %s\n", SYS_NVMF,
+			strerror(errno));
+		return -errno;
+	}
+	if (n < 0) {
+		n = 0;
+		devices = NULL;
 	}
 
-	if (cfg.nqn) {
-		ret = disconnect_by_nqn(cfg.nqn);
-		if (ret < 0)
-			fprintf(stderr, "Failed to disconnect by NQN: %s\n",
-				cfg.nqn);
-		else {
-			printf("NQN:%s disconnected %d controller(s)\n", cfg.nqn, ret);
-			ret = 0;
+	printf("%-10s %-12s %-5s %-8s %-10s %-9s %-40s %s\n", "Controller",
+	       "State", "Trans", "KATO", "Reconnect", "Loss TMO", "Address",
+	       "Subsystem NQN");
+	for (i = 0; i < n; i++) {
+		const char *ctrl = devices[i]->d_name;
+
+		if (read_ctrl_attr(ctrl, "state", state, sizeof(state)))
+			strcpy(state, "-");
+		if (read_ctrl_attr(ctrl, "transport", transport,
+				   sizeof(transport)))
+			strcpy(transport, "-");
+		if (read_ctrl_attr(ctrl, "address", address, sizeof(address)))
+			strcpy(address, "-");
+		if (read_ctrl_attr(ctrl, "subsysnqn", nqn, sizeof(nqn)))
+			strcpy(nqn, "-");
+		if (!strcmp(state, "live"))
+			live++;
+
+		printf("%-10s %-12s %-5s", ctrl, state, transport);
+		for (j = 0; j < ARRAY_SIZE(health_attrs); j++) {
+			if (read_ctrl_attr(ctrl, health_attrs[j].attr, val,
+					   sizeof(val)))
+				strcpy(val, "-");
+			printf(" %-*s", health_attrs[j].width, val);
 		}
+		printf(" %-40s %s\n", address, nqn);
+		free(devices[i]);
 	}
+	free(devices);
+	printf("%d controller(s), %d live\n", n, live);
 
-	if (cfg.device) {
-		ret = disconnect_by_device(cfg.device);
-		if (ret)
-			fprintf(stderr,
-				"Failed to disconnect by device name: %s\n",
-				cfg.device);
+	if (health.log) {
+		ret = fabrics_stats_load(health.log);
+		if (!ret) {
+			printf("\n");
+			fabrics_stats_report();
+		}
+		fabrics_stats_exit();
 	}
-
 	return ret;
 }
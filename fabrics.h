@@ -4,5 +4,8 @@
 extern int discover(const char *desc, int argc, char **argv, bool connect);
 extern int connect(const char *desc, int argc, char **argv);
 extern int disconnect(const char *desc, int argc, char **argv);
+extern int reconnect(const char *desc, int argc, char **argv);
+extern int monitor(const char *desc, int argc, char **argv);
+extern int fabric_health(const char *desc, int argc, char **argv);
 
 #endif
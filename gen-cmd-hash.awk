@@ -0,0 +1,157 @@
+#!/usr/bin/awk -f
+#
+# Build a minimal-probe perfect hash of every command name and alias
+# from the preprocessed command headers (see cmd_list.h), keyed by
+# "<plugin> <command>", or just "<command>" for the built-in ones.
+#
+# Keys are split into buckets by hash(key, 31); each bucket is then given
+# the first odd multiplier, from 33 up, for which hash(key, multiplier)
+# puts all of its keys in free slots. Larger buckets are placed first.
+# The plugins named in the headers are listed too, so that a miss for
+# them (or for a built-in command) needs no further search.
+# The hash must match cmd_hash_key() in plugin.c:
+#
+#	h = 0; for each byte c: h = h * mul + c (mod 2^32)
+
+function hash(s, mul,    h, i, n) {
+	h = 0
+	n = length(s)
+	for (i = 1; i <= n; i++)
+		h = (h * mul + ord[substr(s, i, 1)]) % 4294967296
+	return h
+}
+
+function unquote(s) {
+	return substr(s, 2, length(s) - 2)
+}
+
+function add(plugin, name, idx,    key) {
+	key = plugin == "" ? name : plugin " " name
+	if (key in seen) {
+		printf("gen-cmd-hash: duplicate command '%s'\n", key) > "/dev/stderr"
+		failed = 1
+		exit 1
+	}
+	seen[key] = 1
+	keys[n] = key
+	kplugin[n] = plugin
+	kname[n] = name
+	kidx[n] = idx
+	n++
+}
+
+BEGIN {
+	n = ntok = nplugins = 0
+	for (i = 1; i < 256; i++)
+		ord[sprintf("%c", i)] = i
+}
+
+{
+	for (i = 1; i <= NF; i++)
+		tok[ntok++] = $i
+}
+
+END {
+	if (failed)
+		exit 1
+	for (i = 0; i < ntok; i++) {
+		if (tok[i] == "CMD_FILE") {
+			plugin = ""
+			idx = 0
+		} else if (tok[i] == "CMD_PLUGIN") {
+			plugin = unquote(tok[++i])
+			plugins[nplugins++] = plugin
+			idx = 0
+		} else if (tok[i] == "CMD_ENTRY") {
+			add(plugin, unquote(tok[++i]), idx)
+			if (i + 1 < ntok && tok[i + 1] ~ /^"/)
+				add(plugin, unquote(tok[++i]), idx)
+			idx++
+		}
+	}
+	if (failed)
+		exit 1
+
+	nbuckets = int(n / 2) + 1
+	nslots = n + int(n / 4) + 1
+
+	for (k = 0; k < n; k++) {
+		b = hash(keys[k], 31) % nbuckets
+		members[b, size[b]++] = k
+	}
+
+	# buckets by decreasing size
+	for (b = 0; b < nbuckets; b++)
+		order[b] = b
+	for (i = 1; i < nbuckets; i++) {
+		b = order[i]
+		for (j = i - 1; j >= 0 && size[order[j]] < size[b]; j--)
+			order[j + 1] = order[j]
+		order[j + 1] = b
+	}
+
+	for (i = 0; i < nbuckets; i++) {
+		b = order[i]
+		mul[b] = 33
+		if (!size[b])
+			continue
+		for (mul[b] = 33; mul[b] < 65536; mul[b] += 2) {
+			ok = 1
+			split("", taken)
+			for (j = 0; j < size[b] && ok; j++) {
+				s = hash(keys[members[b, j]], mul[b]) % nslots
+				if ((s in slot) || (s in taken))
+					ok = 0
+				taken[s] = 1
+			}
+			if (ok)
+				break
+		}
+		if (!ok) {
+			print "gen-cmd-hash: no perfect hash found" > "/dev/stderr"
+			exit 1
+		}
+		for (j = 0; j < size[b]; j++) {
+			k = members[b, j]
+			slot[hash(keys[k], mul[b]) % nslots] = k
+		}
+	}
+
+	print "/* Generated by gen-cmd-hash.awk from the command headers, do not edit */"
+	print ""
+	printf("#define CMD_HASH_BUCKETS\t%d\n", nbuckets)
+	printf("#define CMD_HASH_SLOTS\t\t%d\n", nslots)
+	print ""
+	print "static const unsigned short cmd_hash_mul[CMD_HASH_BUCKETS] = {"
+	line = "\t"
+	for (b = 0; b < nbuckets; b++) {
+		item = mul[b] ","
+		if (length(line) + length(item) > 72) {
+			print line
+			line = "\t"
+		} else if (line != "\t") {
+			line = line " "
+		}
+		line = line item
+	}
+	print line
+	print "};"
+	print ""
+	print "static const struct cmd_hash_entry cmd_hash[CMD_HASH_SLOTS] = {"
+	for (s = 0; s < nslots; s++) {
+		if (!(s in slot))
+			continue
+		k = slot[s]
+		printf("\t[%d] = { %s, \"%s\", %d },\n", s,
+		       kplugin[k] == "" ? "NULL" : "\"" kplugin[k] "\"",
+		       kname[k], kidx[k])
+	}
+	print "};"
+	print ""
+	print "/* plugins whose commands are all in cmd_hash[] */"
+	print "static const char *const cmd_hash_plugins[] = {"
+	for (i = 0; i < nplugins; i++)
+		printf("\t\"%s\",\n", plugins[i])
+	print "\tNULL"
+	print "};"
+}
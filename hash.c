@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+#define HASH_MIN_BUCKETS	16
+
+/**
+ * hash_str: - FNV-1a hash of a NUL-terminated string
+ * @str: the string to hash
+ */
+unsigned long hash_str(const char *str)
+{
+	unsigned long hash = 2166136261UL;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+/**
+ * hash_init: - prepare an empty table
+ * @h: the table to initialise
+ * @size_hint: expected number of entries, used to size the bucket array
+ *
+ * The bucket count is rounded up to a power of two so lookups can mask
+ * rather than divide. The table does not grow; callers that do not know
+ * their population up front should pass a generous hint.
+ */
+int hash_init(struct hash_table *h, unsigned int size_hint)
+{
+	unsigned int n = HASH_MIN_BUCKETS;
+
+	while (n < size_hint * 2)
+		n <<= 1;
+
+	h->buckets = calloc(n, sizeof(*h->buckets));
+	if (!h->buckets)
+		return -ENOMEM;
+	h->nbuckets = n;
+	h->count = 0;
+	return 0;
+}
+
+void hash_free(struct hash_table *h, void (*free_data)(void *data))
+{
+	struct hash_entry *e, *next;
+	unsigned int i;
+
+	if (!h->buckets)
+		return;
+
+	for (i = 0; i < h->nbuckets; i++) {
+		for (e = h->buckets[i]; e; e = next) {
+			next = e->next;
+			if (free_data)
+				free_data(e->data);
+			free(e->key);
+			free(e);
+		}
+	}
+	free(h->buckets);
+	h->buckets = NULL;
+	h->nbuckets = 0;
+	h->count = 0;
+}
+
+static struct hash_entry **hash_slot(struct hash_table *h, const char *key)
+{
+	return &h->buckets[hash_str(key) & (h->nbuckets - 1)];
+}
+
+/**
+ * hash_insert: - add @key to the table
+ * @h: the table
+ * @key: string key, copied into the table
+ * @data: value stored alongside the key
+ *
+ * Returns 0 on success, -EEXIST if @key is already present (the existing
+ * value is left untouched) or -ENOMEM.
+ */
+int hash_insert(struct hash_table *h, const char *key, void *data)
+{
+	struct hash_entry **slot = hash_slot(h, key);
+	struct hash_entry *e;
+
+	for (e = *slot; e; e = e->next)
+		if (!strcmp(e->key, key))
+			return -EEXIST;
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+	e->key = strdup(key);
+	if (!e->key) {
+		free(e);
+		return -ENOMEM;
+	}
+	e->data = data;
+	e->next = *slot;
+	*slot = e;
+	h->count++;
+	return 0;
+}
+
+static struct hash_entry *hash_find(struct hash_table *h, const char *key)
+{
+	struct hash_entry *e;
+
+	if (!h->nbuckets)
+		return NULL;
+
+	for (e = *hash_slot(h, key); e; e = e->next)
+		if (!strcmp(e->key, key))
+			return e;
+	return NULL;
+}
+
+void *hash_lookup(struct hash_table *h, const char *key)
+{
+	struct hash_entry *e = hash_find(h, key);
+
+	return e ? e->data : NULL;
+}
+
+bool hash_contains(struct hash_table *h, const char *key)
+{
+	return hash_find(h, key) != NULL;
+}
+
+/**
+ * hash_remove: - drop @key from the table
+ *
+ * Returns the data pointer that was stored with @key, or NULL if the key
+ * was not present.
+ */
+void *hash_remove(struct hash_table *h, const char *key)
+{
+	struct hash_entry **pe, *e;
+	void *data;
+
+	if (!h->nbuckets)
+		return NULL;
+
+	for (pe = hash_slot(h, key); (e = *pe); pe = &e->next) {
+		if (strcmp(e->key, key))
+			continue;
+		*pe = e->next;
+		data = e->data;
+		free(e->key);
+		free(e);
+		h->count--;
+		return data;
+	}
+	return NULL;
+}
@@ -0,0 +1,37 @@
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdbool.h>
+
+/*
+ * Small chained hash table keyed by NUL-terminated strings. Keys are
+ * copied on insert; data pointers are owned by the caller unless a
+ * destructor is handed to hash_free().
+ */
+struct hash_entry {
+	char *key;
+	void *data;
+	struct hash_entry *next;
+};
+
+struct hash_table {
+	struct hash_entry **buckets;
+	unsigned int nbuckets;
+	unsigned int count;
+};
+
+unsigned long hash_str(const char *str);
+
+int hash_init(struct hash_table *h, unsigned int size_hint);
+void hash_free(struct hash_table *h, void (*free_data)(void *data));
+
+int hash_insert(struct hash_table *h, const char *key, void *data);
+void *hash_lookup(struct hash_table *h, const char *key);
+bool hash_contains(struct hash_table *h, const char *key);
+void *hash_remove(struct hash_table *h, const char *key);
+
+#define hash_for_each(h, i, e)					\
+	for ((i) = 0; (i) < (h)->nbuckets; (i)++)		\
+		for ((e) = (h)->buckets[i]; (e); (e) = (e)->next)
+
+#endif
@@ -36,6 +36,7 @@
 
 #include "argconfig.h"
 #include "suffix.h"
+#include "nvme-scan.h"
 #include <sys/ioctl.h>
 #define CREATE_CMD
 #include "huawei-nvme.h"
@@ -66,86 +67,41 @@ struct huawei_list_element_len {
 	unsigned int array_name;
 };
 
-static const char *dev = "/dev/";
-
-/* Assume every block device starting with /dev/nvme is an nvme namespace */
-static int huawei_scan_dev_filter(const struct dirent *d)
-{
-	char path[264];
-	struct stat bd;
-	int ctrl, ns, part;
-
-	if (d->d_name[0] == '.')
-		return 0;
-
-	if (strstr(d->d_name, "nvme")) {
-		snprintf(path, sizeof(path), "%s%s", dev, d->d_name);
-		if (stat(path, &bd))
-			return 0;
-		if (!S_ISBLK(bd.st_mode))
-			return 0;
-		if (sscanf(d->d_name, "nvme%dn%dp%d", &ctrl, &ns, &part) == 3)
-			return 0;
-		return 1;
-	}
-	return 0;
-}
-
-static int huawei_get_nvme_info(int fd, struct huawei_list_item *item, const char *node)
+/*
+ * Enumeration is shared with the built-in 'list' (nvme-scan.c); all we do
+ * here is pick out Huawei controllers and pull the array and namespace
+ * names out of the vendor-specific identify fields.
+ */
+static bool huawei_decorate(const struct list_item *src,
+			    struct huawei_list_item *item)
 {
-	int err;
-	int len;
-	struct stat nvme_stat_info;
-
 	memset(item, 0, sizeof(*item));
 
-	err = nvme_identify_ctrl(fd, &item->ctrl);
-	if (err)
-		return err;
-
 	/*identify huawei device*/
-	if (strstr(item->ctrl.mn, "Huawei") == NULL) {
-		item->huawei_device = false;
-		return 0;
-	}
-	else
-		item->huawei_device = true;
-
-	item->nsid = nvme_get_nsid(fd);
-	err = nvme_identify_ns(fd, item->nsid,
-							0, &item->ns);
-	if (err)
-		return err;
-
-	err = fstat(fd, &nvme_stat_info);
-	if (err < 0)
-		return err;
-
-	strcpy(item->node, node);
-	item->block = S_ISBLK(nvme_stat_info.st_mode);
-
-	if (item->ns.vs[0] == 0) {
-
-		len = snprintf(item->ns_name, NS_NAME_LEN, "%s", "----");
-		if (len < 0)
-			return -EINVAL;
-	}
+	if (strstr(src->ctrl.mn, "Huawei") == NULL)
+		return false;
+
+	memcpy(item->node, src->node, sizeof(item->node));
+	item->ctrl = src->ctrl;
+	item->nsid = src->nsid;
+	item->ns = src->ns;
+	item->block = src->block;
+	item->huawei_device = true;
+
+	if (item->ns.vs[0] == 0)
+		snprintf(item->ns_name, NS_NAME_LEN, "%s", "----");
 	else {
 		memcpy(item->ns_name, item->ns.vs, NS_NAME_LEN);
 		item->ns_name[NS_NAME_LEN - 1] = '\0';
 	}
 
-	if (item->ctrl.vs[0] == 0) {
-
-		len = snprintf(item->array_name, ARRAY_NAME_LEN, "%s", "----");
-	if (len < 0)
-			return -EINVAL;
-	}
+	if (item->ctrl.vs[0] == 0)
+		snprintf(item->array_name, ARRAY_NAME_LEN, "%s", "----");
 	else {
 		memcpy(item->array_name, item->ctrl.vs, ARRAY_NAME_LEN);
 		item->array_name[ARRAY_NAME_LEN - 1] = '\0';
 	}
-	return 0;
+	return true;
 }
 
 static void format(char *formatter, size_t fmt_sz, char *tofmt, size_t tofmtsz)
@@ -318,11 +274,10 @@ static void huawei_print_list_items(struct huawei_list_item *list_items, unsigne
 static int huawei_list(int argc, char **argv, struct command *command,
 		struct plugin *plugin)
 {
-	char path[264];
-	struct dirent **devices;
+	struct nvme_scan scan;
 	struct huawei_list_item *list_items;
-	unsigned int i, n, fd, ret;
-    unsigned int huawei_num = 0;
+	int i, n;
+	unsigned int huawei_num = 0;
 	int fmt;
 	const char *desc = "Retrieve basic information for the given huawei device";
 	struct config {
@@ -344,25 +299,31 @@ static int huawei_list(int argc, char **argv, struct command *command,
 	if (fmt != JSON && fmt != NORMAL)
 		return -EINVAL;
 
-	n = scandir(dev, &devices, huawei_scan_dev_filter, alphasort);
+	n = nvme_scan_devices(&scan);
 	if (n <= 0)
 		return n;
 
 	list_items = calloc(n, sizeof(*list_items));
 	if (!list_items) {
 		fprintf(stderr, "can not allocate controller list payload\n");
+		nvme_scan_free(&scan);
 		return ENOMEM;
 	}
 
 	for (i = 0; i < n; i++) {
-		snprintf(path, sizeof(path), "%s%s", dev, devices[i]->d_name);
-		fd = open(path, O_RDONLY);
-		ret = huawei_get_nvme_info(fd, &list_items[huawei_num], path);
-		if (ret)
-			return ret;
-		if (list_items[huawei_num].huawei_device == true) {
-			huawei_num++;
+		if (scan.errs[i] > 0) {
+			fprintf(stderr, "%s: NVMe Status:%s(%x)\n",
+				scan.items[i].node,
+				nvme_status_to_string(scan.errs[i]),
+				scan.errs[i]);
+			continue;
+		} else if (scan.errs[i] < 0) {
+			fprintf(stderr, "can not probe %s: %s\n",
+				scan.items[i].node, strerror(-scan.errs[i]));
+			continue;
 		}
+		if (huawei_decorate(&scan.items[i], &list_items[huawei_num]))
+			huawei_num++;
 	}
 
 	if (huawei_num > 0){
@@ -372,9 +333,7 @@ static int huawei_list(int argc, char **argv, struct command *command,
 			huawei_print_list_items(list_items, huawei_num);
 	}
 
-	for (i = 0; i < n; i++)
-		free(devices[i]);
-	free(devices);
+	nvme_scan_free(&scan);
 	free(list_items);
 
 	return 0;
@@ -0,0 +1,478 @@
+/*
+ * libnvmf.c -- reentrant device and fabrics operations.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The building blocks the nvmf commands are made of, without argument
+ * parsing, global options or output, for programs that link them
+ * instead of running nvmf once per query. nvmf uses the same code.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "nvme-ioctl.h"
+#include "libnvmf.h"
+#include "common.h"
+
+#define PATH_NVME_FABRICS	"/dev/nvme-fabrics"
+#define PATH_NVMF_HOSTNQN	"/etc/nvme/hostnqn"
+#define PATH_NVMF_HOSTID	"/etc/nvme/hostid"
+#define NVMF_ARGS_SIZE		4096
+#define DISC_CHUNK_MAX		(256 * 1024)
+#define DISC_RETRIES		5
+
+/* ioctl() returns -1 with errno set, or the NVMe status */
+static int lib_ret(int err)
+{
+	return err < 0 ? -errno : err;
+}
+
+int nvmf_dev_open(const char *path, struct nvmf_dev *dev)
+{
+	const char *base = strrchr(path, '/');
+	struct stat st;
+	int nsid;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (dev->fd < 0)
+		return -errno;
+
+	if (fstat(dev->fd, &st) < 0)
+		goto err;
+	if (S_ISBLK(st.st_mode)) {
+		nsid = nvme_get_nsid(dev->fd);
+		if (nsid <= 0)
+			goto err;
+		dev->nsid = nsid;
+	} else if (!S_ISCHR(st.st_mode)) {
+		errno = ENODEV;
+		goto err;
+	}
+
+	snprintf(dev->name, sizeof(dev->name), "%s", base ? base + 1 : path);
+	return 0;
+err:
+	nsid = -errno;
+	close(dev->fd);
+	dev->fd = -1;
+	return nsid;
+}
+
+void nvmf_dev_close(struct nvmf_dev *dev)
+{
+	if (dev->fd >= 0)
+		close(dev->fd);
+	dev->fd = -1;
+}
+
+static __u32 dev_nsid(struct nvmf_dev *dev, __u32 nsid, __u32 dflt)
+{
+	if (nsid)
+		return nsid;
+	return dev->nsid ? dev->nsid : dflt;
+}
+
+int nvmf_identify_ctrl(struct nvmf_dev *dev, struct nvme_id_ctrl *ctrl)
+{
+	return lib_ret(nvme_identify_ctrl(dev->fd, ctrl));
+}
+
+int nvmf_identify_ns(struct nvmf_dev *dev, __u32 nsid, struct nvme_id_ns *ns)
+{
+	nsid = dev_nsid(dev, nsid, 0);
+	if (!nsid)
+		return -EINVAL;
+	return lib_ret(nvme_identify_ns(dev->fd, nsid, false, ns));
+}
+
+int nvmf_get_log(struct nvmf_dev *dev, __u32 nsid, __u8 log_id,
+		 __u64 offset, __u32 len, void *data)
+{
+	return lib_ret(nvme_get_log_offset(dev->fd,
+					   dev_nsid(dev, nsid, 0xffffffff),
+					   log_id, offset, len, data));
+}
+
+int nvmf_get_feature(struct nvmf_dev *dev, __u32 nsid, __u8 fid, __u8 sel,
+		     __u32 cdw11, __u32 len, void *data, __u32 *result)
+{
+	return lib_ret(nvme_get_feature(dev->fd, dev_nsid(dev, nsid, 0), fid,
+					sel, cdw11, len, data, result));
+}
+
+int nvmf_set_feature(struct nvmf_dev *dev, __u32 nsid, __u8 fid,
+		     __u32 value, bool save, __u32 len, void *data,
+		     __u32 *result)
+{
+	return lib_ret(nvme_set_feature(dev->fd, dev_nsid(dev, nsid, 0), fid,
+					value, save, len, data, result));
+}
+
+static int nvmf_rw(struct nvmf_dev *dev, __u8 opcode, __u32 nsid,
+		   __u64 slba, __u32 nlb, __u32 len, void *data)
+{
+	nsid = dev_nsid(dev, nsid, 0);
+	if (!nsid || !nlb || nlb > 0x10000)
+		return -EINVAL;
+	return lib_ret(nvme_passthru_io(dev->fd, opcode, 0, 0, nsid, 0, 0,
+					slba & 0xffffffff, slba >> 32,
+					nlb - 1, 0, 0, 0, len, data, 0, NULL,
+					0));
+}
+
+int nvmf_read(struct nvmf_dev *dev, __u32 nsid, __u64 slba, __u32 nlb,
+	      __u32 len, void *data)
+{
+	return nvmf_rw(dev, nvme_cmd_read, nsid, slba, nlb, len, data);
+}
+
+int nvmf_write(struct nvmf_dev *dev, __u32 nsid, __u64 slba, __u32 nlb,
+	       __u32 len, void *data)
+{
+	return nvmf_rw(dev, nvme_cmd_write, nsid, slba, nlb, len, data);
+}
+
+static int read_line(const char *path, char *buf, size_t len)
+{
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "re");
+	if (!f)
+		return -errno;
+	if (!fgets(buf, len, f))
+		ret = -ENODATA;
+	else
+		buf[strcspn(buf, "\n")] = '\0';
+	fclose(f);
+	return ret;
+}
+
+/**
+ * nvmf_read_hostnqn: - default host NQN from /etc/nvme/hostnqn
+ *
+ * Returns -ENOENT when the file does not exist, in which case the kernel
+ * picks its own host NQN if none is passed.
+ */
+int nvmf_read_hostnqn(char *buf, size_t len)
+{
+	return read_line(PATH_NVMF_HOSTNQN, buf, len);
+}
+
+/**
+ * nvmf_read_hostid: - default host ID from /etc/nvme/hostid
+ */
+int nvmf_read_hostid(char *buf, size_t len)
+{
+	return read_line(PATH_NVMF_HOSTID, buf, len);
+}
+
+static int add_arg(char *buf, size_t len, size_t *n, const char *name,
+		   const char *val)
+{
+	if (!val)
+		return 0;
+	*n += snprintf(buf + *n, len - *n, ",%s=%s", name, val);
+	return *n < len ? 0 : -E2BIG;
+}
+
+static int add_bool_arg(char *buf, size_t len, size_t *n, const char *name,
+			bool val)
+{
+	if (!val)
+		return 0;
+	*n += snprintf(buf + *n, len - *n, ",%s", name);
+	return *n < len ? 0 : -E2BIG;
+}
+
+/**
+ * nvmf_build_args: - connect string for /dev/nvme-fabrics
+ *
+ * Returns -EINVAL if the transport is missing, or the address for any
+ * transport but loop, and -E2BIG if @buf is too small.
+ */
+int nvmf_build_args(const struct nvmf_connect_args *a, char *buf, size_t len)
+{
+	size_t n;
+
+	if (!a->transport ||
+	    (strncmp(a->transport, "loop", 4) && !a->traddr))
+		return -EINVAL;
+
+	/* always specify nqn as first arg - this will init the string */
+	n = snprintf(buf, len, "nqn=%s", a->nqn);
+	if (n >= len)
+		return -E2BIG;
+
+	if (add_arg(buf, len, &n, "transport", a->transport) ||
+	    add_arg(buf, len, &n, "traddr", a->traddr) ||
+	    add_arg(buf, len, &n, "host_traddr", a->host_traddr) ||
+	    add_arg(buf, len, &n, "trsvcid", a->trsvcid) ||
+	    add_arg(buf, len, &n, "hostnqn", a->hostnqn) ||
+	    add_arg(buf, len, &n, "hostid", a->hostid) ||
+	    add_arg(buf, len, &n, "nr_io_queues", a->nr_io_queues) ||
+	    add_arg(buf, len, &n, "queue_size", a->queue_size) ||
+	    add_arg(buf, len, &n, "keep_alive_tmo", a->keep_alive_tmo) ||
+	    add_arg(buf, len, &n, "reconnect_delay", a->reconnect_delay) ||
+	    add_arg(buf, len, &n, "ctrl_loss_tmo", a->ctrl_loss_tmo) ||
+	    add_arg(buf, len, &n, "nr_write_queues", a->nr_write_queues) ||
+	    add_arg(buf, len, &n, "nr_poll_queues", a->nr_poll_queues) ||
+	    add_arg(buf, len, &n, "tos", a->tos) ||
+	    add_bool_arg(buf, len, &n, "hdr_digest", a->hdr_digest) ||
+	    add_bool_arg(buf, len, &n, "data_digest", a->data_digest) ||
+	    add_bool_arg(buf, len, &n, "duplicate_connect",
+			 a->duplicate_connect))
+		return -E2BIG;
+
+	return 0;
+}
+
+/**
+ * nvmf_add_ctrl: - create a fabrics controller
+ * @argstr: connect string, see nvmf_build_args()
+ *
+ * Returns the new controller instance (/dev/nvmf<instance>), or a
+ * negative errno.
+ */
+int nvmf_add_ctrl(const char *argstr)
+{
+	char buf[NVMF_ARGS_SIZE], *options, *p;
+	int fd, ret, instance;
+	ssize_t len = strlen(argstr);
+
+	fd = open(PATH_NVME_FABRICS, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (write(fd, argstr, len) != len) {
+		ret = -errno;
+		goto out;
+	}
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	buf[len] = '\0';
+	ret = -EINVAL;
+	options = buf;
+	while ((p = strsep(&options, ",\n")) != NULL) {
+		if (sscanf(p, "instance=%d", &instance) == 1) {
+			ret = instance;
+			break;
+		}
+	}
+out:
+	close(fd);
+	return ret;
+}
+
+/**
+ * nvmf_remove_ctrl: - delete a fabrics controller
+ */
+int nvmf_remove_ctrl(int instance)
+{
+	char path[64];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path),
+		 "/sys/class/nvmf/nvmf%d/delete_controller", instance);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, "1", 1) != 1)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+int nvmf_connect(const struct nvmf_connect_args *args)
+{
+	char argstr[NVMF_ARGS_SIZE];
+	int ret;
+
+	ret = nvmf_build_args(args, argstr, sizeof(argstr));
+	if (ret)
+		return ret;
+	return nvmf_add_ctrl(argstr);
+}
+
+/*
+ * Largest Get Log Page transfer the discovery controller accepts. MDTS is
+ * in units of the minimum memory page size, which fabrics controllers
+ * report as 4KiB; an MDTS of 0 means no limit, and DISC_CHUNK_MAX is used
+ * so one command never has to map an arbitrarily large buffer.
+ */
+__u32 nvmf_disc_log_chunk_size(int fd)
+{
+	struct nvme_id_ctrl ctrl;
+	__u32 chunk = DISC_CHUNK_MAX;
+
+	if (!nvme_identify_ctrl(fd, &ctrl) && ctrl.mdts &&
+	    ctrl.mdts < 20 && (4096U << ctrl.mdts) < chunk)
+		chunk = 4096U << ctrl.mdts;
+
+	/* whole records, so a chunk never splits one */
+	return chunk - chunk % sizeof(struct nvmf_disc_rsp_page_entry);
+}
+
+int nvmf_disc_log_header(int fd, __u64 *genctr, __u64 *numrec)
+{
+	struct nvmf_disc_rsp_page_hdr *log;
+	/*
+	 * we just need genctr and numrec from the header; the host
+	 * supplies its desired bytes via dwords, per NVMe spec.
+	 */
+	__u32 size = round_up((offsetof(struct nvmf_disc_rsp_page_hdr, numrec) +
+			       sizeof(log->numrec)), sizeof(__u32));
+	int err;
+
+	log = calloc(1, size);
+	if (!log)
+		return -ENOMEM;
+
+	err = lib_ret(nvme_discovery_log(fd, log, size));
+	if (!err) {
+		*genctr = le64_to_cpu(log->genctr);
+		*numrec = le64_to_cpu(log->numrec);
+	}
+	free(log);
+	return err;
+}
+
+/**
+ * nvmf_get_discovery_log: - read the whole discovery log
+ * @fd: discovery controller
+ * @logp: set to the log, to be freed by the caller
+ * @numrec: set to the number of records in it
+ *
+ * The log is read in pieces of at most the controller's MDTS using the
+ * Log Page Offset, header included. It may change while it is being
+ * read, so the header is checked again at the end and the read restarts
+ * if the generation counter moved. Returns -ENODATA for an empty log and
+ * -EAGAIN if the log kept changing.
+ *
+ * Entries are not handed out chunk by chunk: until the final header
+ * check passes, a chunk may belong to a generation that is about to be
+ * thrown away, and an entry printed or connected from it could not be
+ * taken back. A log needs thousands of entries before its size matters
+ * next to the connects made from it.
+ */
+int nvmf_get_discovery_log(int fd, struct nvmf_disc_rsp_page_hdr **logp,
+			   int *numrec)
+{
+	struct nvmf_disc_rsp_page_hdr *log;
+	__u64 genctr, nrec, genctr2, nrec2, off;
+	__u32 chunk, len, log_size;
+	int err, retry;
+
+	chunk = nvmf_disc_log_chunk_size(fd);
+
+	for (retry = 0; retry < DISC_RETRIES; retry++) {
+		err = nvmf_disc_log_header(fd, &genctr, &nrec);
+		if (err)
+			return err;
+		if (nrec == 0)
+			return -ENODATA;
+		if (nrec > (INT_MAX - sizeof(*log)) /
+			   sizeof(struct nvmf_disc_rsp_page_entry))
+			return -EOVERFLOW;
+
+		log_size = sizeof(struct nvmf_disc_rsp_page_hdr) +
+			   sizeof(struct nvmf_disc_rsp_page_entry) * nrec;
+		log = calloc(1, log_size);
+		if (!log)
+			return -ENOMEM;
+
+		for (off = 0; off < log_size; off += len) {
+			len = log_size - off < chunk ? log_size - off : chunk;
+			err = lib_ret(nvme_get_log_offset(fd, 0, NVME_LOG_DISC,
+					off, len, (char *)log + off));
+			if (err)
+				goto free;
+		}
+
+		err = nvmf_disc_log_header(fd, &genctr2, &nrec2);
+		if (err)
+			goto free;
+
+		if (genctr2 == genctr && nrec2 == nrec &&
+		    le64_to_cpu(log->genctr) == genctr &&
+		    le64_to_cpu(log->numrec) == nrec) {
+			*logp = log;
+			*numrec = nrec;
+			return 0;
+		}
+		free(log);
+	}
+	return -EAGAIN;
+free:
+	free(log);
+	return err;
+}
+
+/**
+ * nvmf_discover: - fetch the discovery log of a discovery controller
+ *
+ * Connects to the discovery controller described by @args (its nqn
+ * defaults to the well-known discovery NQN), reads the log and deletes
+ * the controller again.
+ */
+int nvmf_discover(const struct nvmf_connect_args *args,
+		  struct nvmf_disc_rsp_page_hdr **logp, int *numrec)
+{
+	struct nvmf_connect_args a = *args;
+	char path[32];
+	int instance, fd, ret;
+
+	if (!a.nqn)
+		a.nqn = NVME_DISC_SUBSYS_NAME;
+
+	instance = nvmf_connect(&a);
+	if (instance < 0)
+		return instance;
+
+	snprintf(path, sizeof(path), "/dev/nvmf%d", instance);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		ret = -errno;
+	} else {
+		ret = nvmf_get_discovery_log(fd, logp, numrec);
+		close(fd);
+	}
+	nvmf_remove_ctrl(instance);
+	return ret;
+}
+
+/**
+ * nvmf_strerror: - describe a libnvmf return value
+ * @buf: used for NVMe status values
+ */
+const char *nvmf_strerror(int err, char *buf, size_t len)
+{
+	if (err > 0) {
+		snprintf(buf, len, "NVMe status 0x%x%s", err & 0x3fff,
+			 err & NVME_SC_DNR ? " (do not retry)" : "");
+		return buf;
+	}
+	return strerror_r(-err, buf, len);
+}
@@ -0,0 +1,109 @@
+#ifndef _LIBNVMF_H
+#define _LIBNVMF_H
+
+/*
+ * libnvmf: the device and fabrics operations of nvmf as a library.
+ *
+ * Nothing here keeps global state or prints. Every call works on what
+ * the caller hands it, so threads may use the library concurrently as
+ * long as each struct nvmf_dev is used by one thread at a time. Calls
+ * return 0 on success, a positive NVMe status when the device completed
+ * the command with an error, or a negative errno.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/types.h>
+
+/* what nvme.h sets up for linux/nvme.h, for users outside nvmf */
+#ifndef _NVME_H
+#ifndef unlikely
+#define unlikely(x) x
+#endif
+#ifdef LIBUUID
+#include <uuid/uuid.h>
+#else
+typedef struct {
+	uint8_t b[16];
+} uuid_t;
+#endif
+#endif
+
+#include "linux/nvme.h"
+
+#define NVMF_HOSTID_SIZE	36
+
+/* An open controller (/dev/nvmfX) or namespace (/dev/nvmfXnY) device */
+struct nvmf_dev {
+	int	fd;
+	__u32	nsid;		/* 0 for a controller device */
+	char	name[64];
+};
+
+int nvmf_dev_open(const char *path, struct nvmf_dev *dev);
+void nvmf_dev_close(struct nvmf_dev *dev);
+
+/*
+ * @nsid 0 means the namespace of @dev, or no particular namespace
+ * (0xffffffff for features and logs) on a controller device.
+ */
+int nvmf_identify_ctrl(struct nvmf_dev *dev, struct nvme_id_ctrl *ctrl);
+int nvmf_identify_ns(struct nvmf_dev *dev, __u32 nsid, struct nvme_id_ns *ns);
+int nvmf_get_log(struct nvmf_dev *dev, __u32 nsid, __u8 log_id,
+		 __u64 offset, __u32 len, void *data);
+int nvmf_get_feature(struct nvmf_dev *dev, __u32 nsid, __u8 fid, __u8 sel,
+		     __u32 cdw11, __u32 len, void *data, __u32 *result);
+int nvmf_set_feature(struct nvmf_dev *dev, __u32 nsid, __u8 fid,
+		     __u32 value, bool save, __u32 len, void *data,
+		     __u32 *result);
+int nvmf_read(struct nvmf_dev *dev, __u32 nsid, __u64 slba, __u32 nlb,
+	      __u32 len, void *data);
+int nvmf_write(struct nvmf_dev *dev, __u32 nsid, __u64 slba, __u32 nlb,
+	       __u32 len, void *data);
+
+/*
+ * Connect options, as strings in the form the kernel takes them. NULL
+ * (or false) leaves an option at the kernel default. hostnqn and hostid
+ * are not read from /etc/nvme here; see nvmf_read_hostnqn().
+ */
+struct nvmf_connect_args {
+	const char *nqn;
+	const char *transport;
+	const char *traddr;
+	const char *trsvcid;
+	const char *host_traddr;
+	const char *hostnqn;
+	const char *hostid;
+	const char *nr_io_queues;
+	const char *queue_size;
+	const char *keep_alive_tmo;
+	const char *reconnect_delay;
+	const char *ctrl_loss_tmo;
+	const char *nr_write_queues;
+	const char *nr_poll_queues;
+	const char *tos;
+	bool hdr_digest;
+	bool data_digest;
+	bool duplicate_connect;
+};
+
+int nvmf_read_hostnqn(char *buf, size_t len);
+int nvmf_read_hostid(char *buf, size_t len);
+
+int nvmf_build_args(const struct nvmf_connect_args *args, char *buf,
+		    size_t len);
+int nvmf_add_ctrl(const char *argstr);
+int nvmf_remove_ctrl(int instance);
+int nvmf_connect(const struct nvmf_connect_args *args);
+
+__u32 nvmf_disc_log_chunk_size(int fd);
+int nvmf_disc_log_header(int fd, __u64 *genctr, __u64 *numrec);
+int nvmf_get_discovery_log(int fd, struct nvmf_disc_rsp_page_hdr **logp,
+			   int *numrec);
+int nvmf_discover(const struct nvmf_connect_args *args,
+		  struct nvmf_disc_rsp_page_hdr **logp, int *numrec);
+
+const char *nvmf_strerror(int err, char *buf, size_t len);
+
+#endif
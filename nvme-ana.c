@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "nvme-ana.h"
+#include "nvme-cache.h"
+#include "nvme-ioctl.h"
+
+/*
+ * Asymmetric Namespace Access log with a per controller cache.
+ *
+ * The full log grows with the number of namespaces, but its header
+ * carries a change count that the controller bumps whenever any group
+ * changes state or membership. A cached copy is therefore checked with a
+ * 16 byte read of the header and only re-read in full when the count
+ * moved. Cache files live under NVME_ANA_CACHE_DIR, named after the
+ * device number, and are dropped when the device node is recreated.
+ */
+
+#define ANA_CACHE_MAGIC		"NVMFANA1"
+#define ANA_LOG_INITIAL		4096
+#define ANA_LOG_MAX		(16 << 20)
+
+struct ana_cache_hdr {
+	char		magic[8];
+	uint64_t	rdev;
+	int64_t		ctime_sec;
+	int64_t		ctime_nsec;
+	uint32_t	flags;
+	uint32_t	len;
+};
+
+const char *nvme_ana_state_str(__u8 state)
+{
+	switch (state & 0xf) {
+	case NVME_ANA_OPTIMIZED:
+		return "optimized";
+	case NVME_ANA_NONOPTIMIZED:
+		return "non-optimized";
+	case NVME_ANA_INACCESSIBLE:
+		return "inaccessible";
+	case NVME_ANA_PERSISTENT_LOSS:
+		return "persistent-loss";
+	case NVME_ANA_CHANGE:
+		return "change";
+	default:
+		return "reserved";
+	}
+}
+
+/**
+ * nvme_ana_next_group: - walk the group descriptors of an ANA log
+ * @log: log read with nvme_ana_read()
+ * @desc: previous descriptor, or NULL for the first one
+ *
+ * Returns NULL after the last descriptor or if the log is truncated.
+ */
+struct nvme_ana_group_desc *nvme_ana_next_group(const struct nvme_ana_log *log,
+						struct nvme_ana_group_desc *desc)
+{
+	size_t off;
+
+	if (!desc)
+		off = sizeof(*log->hdr);
+	else
+		off = (char *)desc - (char *)log->hdr + sizeof(*desc) +
+			le32_to_cpu(desc->nnsids) * sizeof(__le32);
+
+	if (off + sizeof(*desc) > log->len)
+		return NULL;
+	desc = (struct nvme_ana_group_desc *)((char *)log->hdr + off);
+	if (off + sizeof(*desc) + le32_to_cpu(desc->nnsids) *
+	    sizeof(__le32) > log->len)
+		return NULL;
+	return desc;
+}
+
+/* Bytes needed to hold every descriptor of @hdr, as far as @len shows */
+static size_t ana_log_size(struct nvme_ana_rsp_hdr *hdr, size_t len)
+{
+	struct nvme_ana_group_desc *desc;
+	size_t off = sizeof(*hdr);
+	int i;
+
+	for (i = 0; i < le16_to_cpu(hdr->ngrps); i++) {
+		if (off + sizeof(*desc) > len)
+			return off + sizeof(*desc);
+		desc = (struct nvme_ana_group_desc *)((char *)hdr + off);
+		off += sizeof(*desc) +
+			le32_to_cpu(desc->nnsids) * sizeof(__le32);
+	}
+	return off;
+}
+
+static void ana_cache_path(char *buf, size_t len, struct stat *st)
+{
+	snprintf(buf, len, "%s/%u:%u", NVME_ANA_CACHE_DIR,
+		 major(st->st_rdev), minor(st->st_rdev));
+}
+
+static int ana_cache_load(struct stat *st, int flags, __le64 chgcnt,
+			  struct nvme_ana_log *log)
+{
+	struct ana_cache_hdr h;
+	char path[PATH_MAX];
+	void *buf;
+	int fd, ret = -ESTALE;
+
+	ana_cache_path(path, sizeof(path), st);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (read(fd, &h, sizeof(h)) != sizeof(h) ||
+	    memcmp(h.magic, ANA_CACHE_MAGIC, sizeof(h.magic)) ||
+	    h.rdev != st->st_rdev ||
+	    h.ctime_sec != st->st_ctim.tv_sec ||
+	    h.ctime_nsec != st->st_ctim.tv_nsec ||
+	    h.flags != (flags & NVME_ANA_RGO) ||
+	    h.len < sizeof(*log->hdr) || h.len > ANA_LOG_MAX)
+		goto close_fd;
+
+	buf = malloc(h.len);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto close_fd;
+	}
+	if (read(fd, buf, h.len) != h.len ||
+	    ((struct nvme_ana_rsp_hdr *)buf)->chgcnt != chgcnt) {
+		free(buf);
+		goto close_fd;
+	}
+
+	log->hdr = buf;
+	log->len = h.len;
+	log->cached = true;
+	ret = 0;
+ close_fd:
+	close(fd);
+	return ret;
+}
+
+static void ana_cache_store(struct stat *st, int flags,
+			    const struct nvme_ana_log *log)
+{
+	struct ana_cache_hdr h;
+	char path[PATH_MAX];
+	struct iovec iov[2];
+
+	if (mkdir(NVME_RUN_DIR, 0755) && errno != EEXIST)
+		return;
+	if (mkdir(NVME_ANA_CACHE_DIR, 0755) && errno != EEXIST)
+		return;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ANA_CACHE_MAGIC, sizeof(h.magic));
+	h.rdev = st->st_rdev;
+	h.ctime_sec = st->st_ctim.tv_sec;
+	h.ctime_nsec = st->st_ctim.tv_nsec;
+	h.flags = flags & NVME_ANA_RGO;
+	h.len = log->len;
+
+	iov[0].iov_base = &h;
+	iov[0].iov_len = sizeof(h);
+	iov[1].iov_base = log->hdr;
+	iov[1].iov_len = log->len;
+
+	ana_cache_path(path, sizeof(path), st);
+	nvme_cache_write(path, iov, 2, 0644);
+}
+
+/**
+ * nvme_ana_read: - get the ANA log of a controller
+ * @fd: controller or namespace device
+ * @log: filled in on success, release with nvme_ana_free()
+ * @flags: NVME_ANA_FRESH, NVME_ANA_RGO
+ *
+ * Returns 0, a positive NVMe status or a negative errno.
+ */
+int nvme_ana_read(int fd, struct nvme_ana_log *log, int flags)
+{
+	struct nvme_ana_rsp_hdr probe;
+	bool rgo = flags & NVME_ANA_RGO;
+	struct stat st;
+	size_t len = ANA_LOG_INITIAL, need;
+	void *buf = NULL, *tmp;
+	int ret;
+
+	memset(log, 0, sizeof(*log));
+	if (fstat(fd, &st))
+		return -errno;
+
+	if (!(flags & NVME_ANA_FRESH)) {
+		ret = nvme_ana_log(fd, &probe, sizeof(probe), rgo);
+		if (ret)
+			return ret;
+		if (!ana_cache_load(&st, flags, probe.chgcnt, log))
+			return 0;
+	}
+
+	for (;;) {
+		tmp = realloc(buf, len);
+		if (!tmp) {
+			ret = -ENOMEM;
+			break;
+		}
+		buf = tmp;
+		memset(buf, 0, len);
+
+		ret = nvme_ana_log(fd, buf, len, rgo);
+		if (ret)
+			break;
+		need = ana_log_size(buf, len);
+		if (need <= len) {
+			log->hdr = buf;
+			log->len = need;
+			ana_cache_store(&st, flags, log);
+			return 0;
+		}
+		if (len >= ANA_LOG_MAX) {
+			ret = -E2BIG;
+			break;
+		}
+		/* grow by at least double so a huge log needs few reads */
+		len = need > len * 2 ? need : len * 2;
+		len = (len + 3) & ~3UL;
+		if (len > ANA_LOG_MAX)
+			len = ANA_LOG_MAX;
+	}
+	free(buf);
+	return ret;
+}
+
+void nvme_ana_free(struct nvme_ana_log *log)
+{
+	free(log->hdr);
+	memset(log, 0, sizeof(*log));
+}
@@ -0,0 +1,28 @@
+#ifndef _NVME_ANA_H
+#define _NVME_ANA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nvme.h"
+#include "nvme-resolve.h"
+
+#define NVME_ANA_CACHE_DIR	NVME_RUN_DIR "/ana"
+
+/* nvme_ana_read() flags */
+#define NVME_ANA_FRESH		(1 << 0)	/* ignore the cached log */
+#define NVME_ANA_RGO		(1 << 1)	/* groups only, no NSID lists */
+
+struct nvme_ana_log {
+	struct nvme_ana_rsp_hdr *hdr;
+	size_t len;
+	bool cached;
+};
+
+int nvme_ana_read(int fd, struct nvme_ana_log *log, int flags);
+void nvme_ana_free(struct nvme_ana_log *log);
+struct nvme_ana_group_desc *nvme_ana_next_group(const struct nvme_ana_log *log,
+						struct nvme_ana_group_desc *desc);
+const char *nvme_ana_state_str(__u8 state);
+
+#endif
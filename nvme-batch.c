@@ -0,0 +1,424 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvme-batch.h"
+
+/*
+ * Reader for 'batch' scripts. Each line is one command, written either
+ * the way it would be typed after the program name:
+ *
+ *	smart-log /dev/nvme0 -o json
+ *	get-feature /dev/nvme0 -f 0x7 -H
+ *
+ * with '...' and "..." quoting and backslash escapes as in the shell, or
+ * as a JSON array of strings (JSONL):
+ *
+ *	["error-log", "/dev/nvme1", "-e", "16", "-o", "json"]
+ *
+ * Blank lines and lines starting with '#' are skipped. A leading "nvme"
+ * or "nvmf" is dropped so existing scripts can be fed in unchanged.
+ */
+
+static int batch_error(const char *path, int line, const char *what)
+{
+	fprintf(stderr, "%s:%d: %s\n", path, line, what);
+	return -EINVAL;
+}
+
+static int add_arg(struct batch_cmd *cmd, const char *s, size_t len)
+{
+	char *arg;
+
+	if (cmd->argc >= BATCH_MAX_ARGS - 1)
+		return -E2BIG;
+	arg = strndup(s, len);
+	if (!arg)
+		return -ENOMEM;
+	cmd->argv[cmd->argc++] = arg;
+	return 0;
+}
+
+static int parse_words(const char *p, char *word, const char *path, int line,
+		       struct batch_cmd *cmd)
+{
+	size_t n;
+	char c, quote;
+	int ret;
+
+	for (;;) {
+		while (isspace((unsigned char)*p))
+			p++;
+		if (!*p)
+			return 0;
+
+		n = 0;
+		quote = 0;
+		while (*p && (quote || !isspace((unsigned char)*p))) {
+			c = *p++;
+			if (c == quote)
+				quote = 0;
+			else if (!quote && (c == '\'' || c == '"'))
+				quote = c;
+			else if (c == '\\' && quote != '\'' && *p)
+				word[n++] = *p++;
+			else
+				word[n++] = c;
+		}
+		if (quote)
+			return batch_error(path, line, "unterminated quote");
+
+		ret = add_arg(cmd, word, n);
+		if (ret)
+			return ret;
+	}
+}
+
+/* Unescape a JSON string into @word; only ASCII \u escapes are accepted */
+static const char *json_string(const char *p, char *word, size_t *n)
+{
+	unsigned int u;
+	char c;
+
+	*n = 0;
+	for (p++; *p != '"'; word[(*n)++] = c) {
+		c = *p++;
+		if (!c)
+			return NULL;
+		if (c != '\\')
+			continue;
+		c = *p++;
+		switch (c) {
+		case 'n': c = '\n'; break;
+		case 't': c = '\t'; break;
+		case 'r': c = '\r'; break;
+		case 'b': c = '\b'; break;
+		case 'f': c = '\f'; break;
+		case '"': case '\\': case '/': break;
+		case 'u':
+			if (sscanf(p, "%4x", &u) != 1 || !u || u > 0x7f)
+				return NULL;
+			c = u;
+			p += 4;
+			break;
+		default:
+			return NULL;
+		}
+	}
+	return p + 1;
+}
+
+static int parse_json(const char *p, char *word, const char *path, int line,
+		      struct batch_cmd *cmd)
+{
+	size_t n;
+	int ret;
+
+	p++;
+	while (isspace((unsigned char)*p))
+		p++;
+	if (*p == ']')
+		goto out;
+
+	for (;;) {
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p == '"') {
+			p = json_string(p, word, &n);
+			if (!p)
+				return batch_error(path, line,
+					"bad string in argument array");
+			ret = add_arg(cmd, word, n);
+		} else if (*p == '-' || isdigit((unsigned char)*p)) {
+			n = strspn(p, "-+.0123456789eE");
+			ret = add_arg(cmd, p, n);
+			p += n;
+		} else {
+			return batch_error(path, line,
+				"arguments must be strings or numbers");
+		}
+		if (ret)
+			return ret;
+
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p != ',')
+			break;
+		p++;
+	}
+	if (*p != ']')
+		return batch_error(path, line, "expected ',' or ']'");
+ out:
+	p++;
+	while (isspace((unsigned char)*p))
+		p++;
+	if (*p)
+		return batch_error(path, line, "trailing data after the array");
+	return 0;
+}
+
+/**
+ * batch_parse_line: - turn one line of a batch script into an argv
+ * @buf: the line, with or without its newline
+ * @path, @line: where it came from, for error messages
+ * @cmd: filled in on success, release with batch_cmd_free(); argc is 0
+ *	 for a blank or comment line
+ */
+int batch_parse_line(const char *buf, const char *path, int line,
+		     struct batch_cmd *cmd)
+{
+	const char *p = buf + strspn(buf, " \t\r\n");
+	char *word;
+	int ret;
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->line = line;
+	if (!*p || *p == '#')
+		return 0;
+
+	cmd->argv = calloc(BATCH_MAX_ARGS, sizeof(char *));
+	word = malloc(strlen(p) + 1);
+	if (!cmd->argv || !word) {
+		free(word);
+		free(cmd->argv);
+		cmd->argv = NULL;
+		return -ENOMEM;
+	}
+
+	if (*p == '[')
+		ret = parse_json(p, word, path, line, cmd);
+	else
+		ret = parse_words(p, word, path, line, cmd);
+	free(word);
+	if (ret == -E2BIG)
+		ret = batch_error(path, line, "too many arguments");
+	if (ret) {
+		batch_cmd_free(cmd);
+		return ret;
+	}
+
+	if (cmd->argc && (!strcmp(cmd->argv[0], "nvme") ||
+			  !strcmp(cmd->argv[0], "nvmf"))) {
+		free(cmd->argv[0]);
+		memmove(cmd->argv, cmd->argv + 1, cmd->argc * sizeof(char *));
+		cmd->argc--;
+	}
+	return 0;
+}
+
+void batch_cmd_free(struct batch_cmd *cmd)
+{
+	int i;
+
+	for (i = 0; i < cmd->argc; i++)
+		free(cmd->argv[i]);
+	free(cmd->argv);
+	cmd->argv = NULL;
+	cmd->argc = 0;
+}
+
+int batch_capture_init(struct batch_capture *cap, int fd)
+{
+	char path[] = "/tmp/nvmf-batch.XXXXXX";
+
+	memset(cap, 0, sizeof(*cap));
+	cap->fd = fd;
+	cap->saved = -1;
+	cap->tmp = mkstemp(path);
+	if (cap->tmp < 0)
+		return -errno;
+	unlink(path);
+	return 0;
+}
+
+int batch_capture_begin(struct batch_capture *cap)
+{
+	fflush(NULL);
+	if (ftruncate(cap->tmp, 0) < 0 || lseek(cap->tmp, 0, SEEK_SET) < 0)
+		return -errno;
+	cap->saved = dup(cap->fd);
+	if (cap->saved < 0)
+		return -errno;
+	if (dup2(cap->tmp, cap->fd) < 0) {
+		close(cap->saved);
+		cap->saved = -1;
+		return -errno;
+	}
+	return 0;
+}
+
+/* Restore the descriptor and read what was written into cap->buf */
+int batch_capture_end(struct batch_capture *cap)
+{
+	off_t len;
+	char *buf;
+
+	fflush(NULL);
+	if (cap->saved >= 0) {
+		dup2(cap->saved, cap->fd);
+		close(cap->saved);
+		cap->saved = -1;
+	}
+
+	cap->len = 0;
+	len = lseek(cap->tmp, 0, SEEK_END);
+	if (len < 0)
+		return -errno;
+	buf = realloc(cap->buf, len + 1);
+	if (!buf)
+		return -ENOMEM;
+	cap->buf = buf;
+	if (pread(cap->tmp, buf, len, 0) != len)
+		return -EIO;
+	buf[len] = '\0';
+	cap->len = len;
+	return 0;
+}
+
+void batch_capture_free(struct batch_capture *cap)
+{
+	if (cap->saved >= 0)
+		batch_capture_end(cap);
+	if (cap->tmp >= 0)
+		close(cap->tmp);
+	free(cap->buf);
+	cap->buf = NULL;
+}
+
+void batch_print_string(FILE *out, const char *s, size_t len)
+{
+	unsigned char c;
+	size_t i;
+
+	fputc('"', out);
+	for (i = 0; i < len; i++) {
+		c = s[i];
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", out);
+		else if (c == '\t')
+			fputs("\\t", out);
+		else if (c < 0x20 || c == 0x7f)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+/*
+ * True if @s is a single JSON object or array: brackets balance outside
+ * of strings and close exactly at the end. This is not a validator, only
+ * enough to tell '-o json' output from text.
+ */
+static bool is_json(const char *s, size_t len)
+{
+	bool in_str = false;
+	int depth = 0;
+	size_t i;
+
+	if (!len || (s[0] != '{' && s[0] != '['))
+		return false;
+
+	for (i = 0; i < len; i++) {
+		if (in_str) {
+			if (s[i] == '\\')
+				i++;
+			else if (s[i] == '"')
+				in_str = false;
+			continue;
+		}
+		switch (s[i]) {
+		case '"':
+			in_str = true;
+			break;
+		case '{': case '[':
+			depth++;
+			break;
+		case '}': case ']':
+			if (--depth == 0)
+				return i == len - 1;
+			break;
+		}
+	}
+	return false;
+}
+
+/*
+ * Command output: embedded as is if it is JSON, else as a string. With
+ * @compact, whitespace outside of JSON strings is dropped so the output
+ * fits on one line.
+ */
+void batch_print_output(FILE *out, const char *s, size_t len, bool compact)
+{
+	bool in_str = false;
+	size_t i;
+
+	while (len && isspace((unsigned char)*s)) {
+		s++;
+		len--;
+	}
+	while (len && isspace((unsigned char)s[len - 1]))
+		len--;
+
+	if (!is_json(s, len)) {
+		batch_print_string(out, s, len);
+		return;
+	}
+	if (!compact) {
+		fwrite(s, 1, len, out);
+		return;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (in_str) {
+			if (s[i] == '\\')
+				fputc(s[i++], out);
+			else if (s[i] == '"')
+				in_str = false;
+		} else if (s[i] == '"') {
+			in_str = true;
+		} else if (isspace((unsigned char)s[i])) {
+			continue;
+		}
+		fputc(s[i], out);
+	}
+}
+
+/*
+ * One {line, argv, status, output, error} object for a command that ran;
+ * "line" is left out when cmd->line is 0.
+ */
+void batch_print_record(FILE *f, const struct batch_cmd *cmd, int err,
+			struct batch_capture *out, struct batch_capture *errs,
+			bool compact)
+{
+	int i;
+
+	fputc('{', f);
+	if (cmd->line)
+		fprintf(f, "\"line\":%d,", cmd->line);
+	fprintf(f, "\"argv\":[");
+	for (i = 0; i < cmd->argc; i++) {
+		if (i)
+			fputc(',', f);
+		batch_print_string(f, cmd->argv[i], strlen(cmd->argv[i]));
+	}
+	fprintf(f, "],\"status\":%d", err);
+	if (out->len) {
+		fprintf(f, ",\"output\":");
+		batch_print_output(f, out->buf, out->len, compact);
+	}
+	while (errs->len && isspace((unsigned char)errs->buf[errs->len - 1]))
+		errs->len--;
+	if (errs->len) {
+		fprintf(f, ",\"error\":");
+		batch_print_string(f, errs->buf, errs->len);
+	}
+	fputc('}', f);
+}
@@ -0,0 +1,44 @@
+#ifndef _NVME_BATCH_H
+#define _NVME_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define BATCH_MAX_ARGS	64
+
+/* One command of a batch script, as the argv it stands for */
+struct batch_cmd {
+	int line;
+	int argc;
+	char **argv;
+};
+
+int batch_parse_line(const char *buf, const char *path, int line,
+		     struct batch_cmd *cmd);
+void batch_cmd_free(struct batch_cmd *cmd);
+
+/*
+ * Redirect a file descriptor (stdout or stderr) into a temporary file
+ * while one command runs, then hand back what it wrote.
+ */
+struct batch_capture {
+	int fd;		/* descriptor being captured */
+	int saved;	/* the original, while capturing */
+	int tmp;
+	char *buf;
+	size_t len;
+};
+
+int batch_capture_init(struct batch_capture *cap, int fd);
+int batch_capture_begin(struct batch_capture *cap);
+int batch_capture_end(struct batch_capture *cap);
+void batch_capture_free(struct batch_capture *cap);
+
+void batch_print_string(FILE *out, const char *s, size_t len);
+void batch_print_output(FILE *out, const char *s, size_t len, bool compact);
+void batch_print_record(FILE *f, const struct batch_cmd *cmd, int err,
+			struct batch_capture *out, struct batch_capture *errs,
+			bool compact);
+
+#endif
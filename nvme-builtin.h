@@ -9,6 +9,7 @@
 COMMAND_LIST(
 	ENTRY("list", "List all NVMe devices and namespaces on machine", list)
 	ENTRY("list-subsys", "List nvme subsystems", list_subsys)
+	ENTRY("path-bench", "Compare read latency across the paths of a subsystem", path_bench)
 	ENTRY("id-ctrl", "Send NVMe Identify Controller", id_ctrl)
 	ENTRY("id-ns", "Send NVMe Identify Namespace, display structure", id_ns)
 	ENTRY("list-ns", "Send NVMe Identify List, display structure", list_ns)
@@ -24,6 +25,7 @@ COMMAND_LIST(
 	ENTRY("smart-log", "Retrieve SMART Log, show it", get_smart_log)
 	ENTRY("error-log", "Retrieve Error Log, show it", get_error_log)
 	ENTRY("effects-log", "Retrieve Command Effects Log, show it", get_effects_log)
+	ENTRY("ana-log", "Retrieve Asymmetric Namespace Access Log, show it", get_ana_log)
 	ENTRY("get-feature", "Get feature and show the resulting value", get_feature)
 	ENTRY("set-feature", "Set a feature and show the resulting value", set_feature)
 	ENTRY("set-property", "Set a property and show the resulting value", set_property)
@@ -55,6 +57,11 @@ COMMAND_LIST(
 	ENTRY("connect-all", "Discover and Connect to NVMeoF subsystems", connect_all_cmd)
 	ENTRY("connect", "Connect to NVMeoF subsystem", connect_cmd)
 	ENTRY("disconnect", "Disconnect from NVMeoF subsystem", disconnect_cmd)
+	ENTRY("reconnect", "Re-establish NVMeoF controllers that are not live", reconnect_cmd)
+	ENTRY("monitor", "Monitor NVMe controller and namespace events", monitor_cmd)
+	ENTRY("fabric-health", "Show state and connect timing of NVMeoF controllers", fabric_health_cmd)
+	ENTRY("batch", "Run many commands in one process sharing device handles", batch)
+	ENTRY("daemon", "Serve commands and admin passthru on a Unix socket", daemon_cmd)
 	ENTRY("gen-hostnqn", "Generate NVMeoF host NQN", gen_hostnqn_cmd)
 	ENTRY("dir-receive", "Submit a Directive Receive command, return results", dir_receive)
 	ENTRY("dir-send", "Submit a Directive Send command, return results", dir_send)
@@ -0,0 +1,60 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "nvme-cache.h"
+
+/**
+ * nvme_cache_write: - atomically replace a cache file
+ * @path: file to replace
+ * @iov: contents, in order
+ * @iovcnt: number of @iov entries
+ * @mode: permissions of the new file
+ *
+ * The contents go to a new file created next to @path with mkstemp(),
+ * which is synced and renamed over @path, so a reader sees either the
+ * old file or the complete new one and two writers never share a file.
+ *
+ * Returns 0 or a negative errno.
+ */
+int nvme_cache_write(const char *path, const struct iovec *iov, int iovcnt,
+		     mode_t mode)
+{
+	char tmp[PATH_MAX];
+	size_t done;
+	ssize_t n;
+	int fd, i, ret = 0;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+		return -ENAMETOOLONG;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+
+	for (i = 0; i < iovcnt && !ret; i++) {
+		for (done = 0; done < iov[i].iov_len; done += n) {
+			n = write(fd, (char *)iov[i].iov_base + done,
+				  iov[i].iov_len - done);
+			if (n < 0) {
+				if (errno == EINTR) {
+					n = 0;
+					continue;
+				}
+				ret = -errno;
+				break;
+			}
+		}
+	}
+	if (!ret && (fchmod(fd, mode) || fsync(fd)))
+		ret = -errno;
+	if (close(fd) && !ret)
+		ret = -errno;
+	if (!ret && rename(tmp, path))
+		ret = -errno;
+	if (ret)
+		unlink(tmp);
+	return ret;
+}
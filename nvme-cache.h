@@ -0,0 +1,10 @@
+#ifndef _NVME_CACHE_H
+#define _NVME_CACHE_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+int nvme_cache_write(const char *path, const struct iovec *iov, int iovcnt,
+		     mode_t mode);
+
+#endif
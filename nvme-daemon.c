@@ -0,0 +1,957 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "nvme-daemon.h"
+#include "nvme-batch.h"
+#include "nvme-ioctl.h"
+#include "nvme-scan.h"
+#include "nvme-uevent.h"
+#include "hash.h"
+
+/*
+ * 'daemon': answer requests on a Unix socket from a process that keeps
+ * its device handles and caches between them.
+ *
+ * A request is either a line of text, a command as 'batch' reads it,
+ * answered with one line holding the JSON record 'batch -o json' would
+ * print for it; or a binary admin command (see nvme-daemon.h) sent
+ * straight to the device and answered with its status and data.
+ *
+ * The main thread accepts connections and polls them; a client with a
+ * request pending is handed to the worker pool and polled again once its
+ * request was answered. Binary requests run in the workers in parallel;
+ * on one controller, those the Commands Supported and Effects log shows
+ * to be free of side effects share it, others run alone. Command lines
+ * go through the command code, which keeps process wide state (getopt,
+ * stdout, the device cache in nvme.c), so they run one at a time under
+ * run_lock, which also guards the name resolver.
+ *
+ * Identify data and the output of the listing and identify commands are
+ * cached until the kernel reports a change to any NVMe device.
+ */
+
+#define DAEMON_LINE_CHUNK	512
+#define DAEMON_LINE_MAX		(64 * 1024)
+#define DAEMON_RCV_TIMEOUT	5	/* secs to wait for the rest of a request */
+#define DAEMON_BACKLOG		64
+
+struct daemon_ctrl {
+	/* shared by commands free of side effects, else exclusive */
+	pthread_rwlock_t lock;
+	struct timespec last;
+
+	/* Commands Supported and Effects log, read on first use */
+	pthread_mutex_t effects_lock;
+	int effects;		/* 0: not read yet, 1: acs valid, < 0: none */
+	__u32 acs[256];
+};
+
+struct daemon_dev {
+	int fd;
+	struct daemon_ctrl *ctrl;
+};
+
+/* A cached answer: a JSON line, or a binary reply and its data */
+struct daemon_reply {
+	struct nvme_daemon_rsp rsp;
+	size_t len;
+	char data[];
+};
+
+struct daemon_client {
+	int fd;
+	bool busy;
+};
+
+/* Sent from a worker to the main thread when a request was answered */
+struct daemon_done {
+	int fd;
+	bool close;
+};
+
+struct daemon {
+	const struct nvme_daemon_opts *opts;
+
+	/* held shared while serving a request, exclusively to drop caches */
+	pthread_rwlock_t flush_lock;
+	pthread_rwlockattr_t rwattr;
+	/* command code and the resolver have process wide state */
+	pthread_mutex_t run_lock;
+	struct batch_capture out, errs;
+
+	/* protects everything below */
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	struct hash_table devs;		/* request device -> daemon_dev */
+	struct hash_table ctrls;	/* "nvmfX" -> daemon_ctrl */
+	struct hash_table cache;	/* request -> daemon_reply */
+	int *queue;
+	unsigned int nqueue;
+	bool stop;
+
+	int wake[2];
+};
+
+static const char * const daemon_cached_cmds[] = {
+	"list", "list-subsys", "list-ns", "list-ctrl", "id-ctrl", "id-ns",
+};
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_sighandler(int sig)
+{
+	daemon_stop = 1;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	n = recv(fd, buf, len, MSG_WAITALL);
+	if (n < 0)
+		return -errno;
+	return n == len ? 0 : -EPIPE;
+}
+
+static int send_all(int fd, struct iovec *iov, int cnt)
+{
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = cnt };
+	ssize_t n;
+
+	while (cnt) {
+		n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (n < 0)
+			return -errno;
+		while (cnt && n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+		msg.msg_iov = iov;
+		msg.msg_iovlen = cnt;
+	}
+	return 0;
+}
+
+/*
+ * Read one line without consuming what follows it, so a client may send
+ * several requests back to back.
+ */
+static char *daemon_read_line(int fd)
+{
+	char *buf = NULL, *tmp, *nl;
+	size_t len = 0;
+	ssize_t n;
+
+	while (len < DAEMON_LINE_MAX) {
+		tmp = realloc(buf, len + DAEMON_LINE_CHUNK + 1);
+		if (!tmp)
+			break;
+		buf = tmp;
+
+		n = recv(fd, buf + len, DAEMON_LINE_CHUNK, MSG_PEEK);
+		if (n <= 0)
+			break;
+		nl = memchr(buf + len, '\n', n);
+		if (nl)
+			n = nl - (buf + len) + 1;
+		if (recv(fd, buf + len, n, 0) != n)
+			break;
+		len += n;
+		if (nl) {
+			buf[len] = '\0';
+			return buf;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+static struct daemon_reply *daemon_cache_get(struct daemon *d,
+					     const char *key)
+{
+	struct daemon_reply *r;
+
+	pthread_mutex_lock(&d->lock);
+	r = hash_lookup(&d->cache, key);
+	pthread_mutex_unlock(&d->lock);
+	return r;
+}
+
+static void daemon_cache_put(struct daemon *d, const char *key,
+			     const struct nvme_daemon_rsp *rsp,
+			     const void *data, size_t len)
+{
+	struct daemon_reply *r;
+
+	r = malloc(sizeof(*r) + len);
+	if (!r)
+		return;
+	if (rsp)
+		r->rsp = *rsp;
+	r->len = len;
+	memcpy(r->data, data, len);
+
+	pthread_mutex_lock(&d->lock);
+	if (hash_insert(&d->cache, key, r))
+		free(r);
+	pthread_mutex_unlock(&d->lock);
+}
+
+static struct daemon_ctrl *daemon_ctrl_get(struct daemon *d, const char *path)
+{
+	struct daemon_ctrl *c;
+	const char *base = strrchr(path, '/');
+	char name[32];
+	int instance;
+
+	if (sscanf(base ? base + 1 : path, "nvmf%d", &instance) != 1)
+		return NULL;
+	snprintf(name, sizeof(name), "nvmf%d", instance);
+
+	pthread_mutex_lock(&d->lock);
+	c = hash_lookup(&d->ctrls, name);
+	if (!c) {
+		c = calloc(1, sizeof(*c));
+		if (c) {
+			pthread_rwlock_init(&c->lock, &d->rwattr);
+			pthread_mutex_init(&c->effects_lock, NULL);
+			if (hash_insert(&d->ctrls, name, c)) {
+				free(c);
+				c = NULL;
+			}
+		}
+	}
+	pthread_mutex_unlock(&d->lock);
+	return c;
+}
+
+/* Resolve a persistent key into @path; call with run_lock held */
+static const char *daemon_resolve(const char *spec, char *path, size_t len)
+{
+	if (!nvme_resolve_is_key(spec))
+		return spec;
+	return nvme_resolve_dev(spec, path, len) ? NULL : path;
+}
+
+static int daemon_dev_get(struct daemon *d, const char *spec,
+			  struct daemon_dev **devp)
+{
+	struct daemon_dev *dev, *old;
+	char buf[PATH_MAX], node[PATH_MAX];
+	const char *path;
+	int err = 0;
+
+	pthread_mutex_lock(&d->lock);
+	dev = hash_lookup(&d->devs, spec);
+	pthread_mutex_unlock(&d->lock);
+	if (dev)
+		goto out;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&d->run_lock);
+	path = daemon_resolve(spec, buf, sizeof(buf));
+	pthread_mutex_unlock(&d->run_lock);
+	if (!path) {
+		free(dev);
+		return -ENODEV;
+	}
+	if (!strchr(path, '/')) {
+		snprintf(node, sizeof(node), "/dev/%s", path);
+		path = node;
+	}
+
+	dev->ctrl = daemon_ctrl_get(d, path);
+	dev->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (dev->fd < 0)
+		err = -errno;
+	else if (!dev->ctrl)
+		err = -ENODEV;
+	if (err) {
+		if (dev->fd >= 0)
+			close(dev->fd);
+		free(dev);
+		return err;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	old = hash_lookup(&d->devs, spec);
+	if (old || hash_insert(&d->devs, spec, dev)) {
+		close(dev->fd);
+		free(dev);
+		dev = old;
+	}
+	pthread_mutex_unlock(&d->lock);
+	if (!dev)
+		return -ENOMEM;
+ out:
+	*devp = dev;
+	return 0;
+}
+
+static void daemon_dev_free(void *data)
+{
+	struct daemon_dev *dev = data;
+
+	close(dev->fd);
+	free(dev);
+}
+
+static void daemon_ctrl_free(void *data)
+{
+	struct daemon_ctrl *c = data;
+
+	pthread_rwlock_destroy(&c->lock);
+	pthread_mutex_destroy(&c->effects_lock);
+	free(c);
+}
+
+static void daemon_effects_load(struct daemon_ctrl *c, int fd)
+{
+	struct nvme_effects_log log;
+	int i;
+
+	pthread_mutex_lock(&c->effects_lock);
+	if (!c->effects) {
+		if (nvme_get_log(fd, NVME_NSID_ALL, NVME_LOG_CMD_EFFECTS,
+				 sizeof(log), &log)) {
+			c->effects = -1;
+		} else {
+			for (i = 0; i < 256; i++)
+				c->acs[i] = le32_to_cpu(log.acs[i]);
+			c->effects = 1;
+		}
+	}
+	pthread_mutex_unlock(&c->effects_lock);
+}
+
+/*
+ * Whether an admin command has to run alone on its controller: the
+ * effects log says it needs exclusive execution (CSE), or changes the
+ * namespace inventory, namespace or controller capabilities, or logical
+ * block content (NIC, NCC, CCC, LBCC), any of which a command running
+ * next to it could observe half done. Commands the log doesn't cover,
+ * or all commands when the controller has no effects log, are taken as
+ * exclusive unless they only read: Identify, Get Log Page, Get Features.
+ */
+static bool daemon_exclusive(struct daemon_ctrl *c, __u8 opcode)
+{
+	__u32 effects = c->effects > 0 ? c->acs[opcode] : 0;
+
+	if (!(effects & NVME_CMD_EFFECTS_CSUPP))
+		return opcode != nvme_admin_identify &&
+		       opcode != nvme_admin_get_log_page &&
+		       opcode != nvme_admin_get_features;
+	return effects & (NVME_CMD_EFFECTS_CSE_MASK | NVME_CMD_EFFECTS_NIC |
+			  NVME_CMD_EFFECTS_NCC | NVME_CMD_EFFECTS_CCC |
+			  NVME_CMD_EFFECTS_LBCC);
+}
+
+/*
+ * Take a controller for one command, alone if @exclusive. With a
+ * min_interval every command is exclusive, and starts no sooner than
+ * min_interval after the previous one ended.
+ */
+static void daemon_ctrl_begin(struct daemon *d, struct daemon_ctrl *c,
+			      bool exclusive)
+{
+	unsigned int interval = d->opts->min_interval;
+	struct timespec now, until;
+	long long wait;
+
+	if (!c)
+		return;
+	if (!exclusive && !interval) {
+		pthread_rwlock_rdlock(&c->lock);
+		return;
+	}
+	pthread_rwlock_wrlock(&c->lock);
+	if (!interval || !c->last.tv_sec)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wait = (c->last.tv_sec - now.tv_sec) * 1000000000LL +
+		(c->last.tv_nsec - now.tv_nsec) + interval * 1000LL;
+	if (wait > 0) {
+		until.tv_sec = wait / 1000000000LL;
+		until.tv_nsec = wait % 1000000000LL;
+		nanosleep(&until, NULL);
+	}
+}
+
+static void daemon_ctrl_end(struct daemon *d, struct daemon_ctrl *c)
+{
+	if (!c)
+		return;
+	if (d->opts->min_interval)
+		clock_gettime(CLOCK_MONOTONIC, &c->last);
+	pthread_rwlock_unlock(&c->lock);
+}
+
+static int daemon_serve_binary(struct daemon *d, int fd)
+{
+	struct nvme_daemon_rsp rsp = { .magic = NVME_DAEMON_MAGIC };
+	struct nvme_daemon_req req;
+	struct daemon_reply *r = NULL;
+	struct daemon_dev *dev;
+	struct iovec iov[2];
+	char key[128];
+	void *data = NULL;
+	bool write, cache;
+	int err;
+
+	if (recv_all(fd, &req, sizeof(req)))
+		return -EPIPE;
+	if (req.magic != NVME_DAEMON_MAGIC ||
+	    req.data_len > NVME_DAEMON_MAX_DATA)
+		return -EPROTO;
+	req.dev[sizeof(req.dev) - 1] = '\0';
+	write = req.flags & NVME_DAEMON_WRITE;
+
+	if (req.data_len) {
+		if (posix_memalign(&data, getpagesize(), req.data_len))
+			return -ENOMEM;
+		memset(data, 0, req.data_len);
+		if (write && recv_all(fd, data, req.data_len)) {
+			free(data);
+			return -EPIPE;
+		}
+	}
+
+	cache = req.opcode == nvme_admin_identify && !write &&
+		!req.cdw11 && !req.cdw12 && !req.cdw13 && !req.cdw14 &&
+		!req.cdw15;
+	if (cache) {
+		snprintf(key, sizeof(key), "identify:%s:%x:%x:%x", req.dev,
+			 req.nsid, req.cdw10, req.data_len);
+		r = daemon_cache_get(d, key);
+	}
+
+	if (r) {
+		rsp = r->rsp;
+		if (r->len)
+			memcpy(data, r->data, r->len);
+	} else {
+		err = daemon_dev_get(d, req.dev, &dev);
+		if (!err) {
+			daemon_effects_load(dev->ctrl, dev->fd);
+			daemon_ctrl_begin(d, dev->ctrl,
+				daemon_exclusive(dev->ctrl, req.opcode));
+			err = nvme_passthru(dev->fd, NVME_IOCTL_ADMIN_CMD,
+				req.opcode, 0, 0, req.nsid, 0, 0, req.cdw10,
+				req.cdw11, req.cdw12, req.cdw13, req.cdw14,
+				req.cdw15, req.data_len, data, 0, NULL,
+				req.timeout_ms, &rsp.result);
+			if (err < 0)
+				err = -errno;
+			daemon_ctrl_end(d, dev->ctrl);
+		}
+		rsp.status = err;
+		rsp.data_len = err || write ? 0 : req.data_len;
+		if (cache && !err)
+			daemon_cache_put(d, key, &rsp, data, rsp.data_len);
+	}
+
+	iov[0].iov_base = &rsp;
+	iov[0].iov_len = sizeof(rsp);
+	iov[1].iov_base = data;
+	iov[1].iov_len = rsp.data_len;
+	err = send_all(fd, iov, rsp.data_len ? 2 : 1);
+	free(data);
+	return err;
+}
+
+static bool daemon_cmd_cached(const struct batch_cmd *cmd)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(daemon_cached_cmds) /
+			      sizeof(daemon_cached_cmds[0])); i++)
+		if (!strcmp(cmd->argv[0], daemon_cached_cmds[i]))
+			return true;
+	return false;
+}
+
+/* The controller a command line addresses: its first device argument */
+static struct daemon_ctrl *daemon_cmd_ctrl(struct daemon *d,
+					   const struct batch_cmd *cmd)
+{
+	char buf[PATH_MAX];
+	const char *path;
+	int i;
+
+	for (i = 1; i < cmd->argc; i++) {
+		if (strncmp(cmd->argv[i], "/dev/", 5) &&
+		    !nvme_resolve_is_key(cmd->argv[i]))
+			continue;
+		pthread_mutex_lock(&d->run_lock);
+		path = daemon_resolve(cmd->argv[i], buf, sizeof(buf));
+		pthread_mutex_unlock(&d->run_lock);
+		return path ? daemon_ctrl_get(d, path) : NULL;
+	}
+	return NULL;
+}
+
+/* Cache key of a command line: its arguments, separated by 0x1f */
+static char *daemon_cmd_key(const struct batch_cmd *cmd)
+{
+	size_t len = 1;
+	char *key;
+	int i;
+
+	for (i = 0; i < cmd->argc; i++)
+		len += strlen(cmd->argv[i]) + 1;
+	key = calloc(1, len);
+	for (i = 0; key && i < cmd->argc; i++)
+		strcat(strcat(key, cmd->argv[i]), "\x1f");
+	return key;
+}
+
+static int daemon_serve_line(struct daemon *d, int fd)
+{
+	char *args[BATCH_MAX_ARGS], *line, *key = NULL, *resp = NULL;
+	struct daemon_reply *r = NULL;
+	struct daemon_ctrl *ctrl;
+	struct batch_cmd cmd;
+	struct iovec iov;
+	size_t len = 0;
+	FILE *f;
+	int err;
+
+	line = daemon_read_line(fd);
+	if (!line)
+		return -EPIPE;
+	f = open_memstream(&resp, &len);
+	if (!f) {
+		free(line);
+		return -ENOMEM;
+	}
+
+	/* the parser reports errors on stderr, so capture that already */
+	pthread_mutex_lock(&d->run_lock);
+	batch_capture_begin(&d->errs);
+	err = batch_parse_line(line, "request", 1, &cmd);
+	batch_capture_end(&d->errs);
+	cmd.line = 0;
+	if (err) {
+		d->out.len = 0;
+		batch_print_record(f, &cmd, err, &d->out, &d->errs, true);
+	}
+	pthread_mutex_unlock(&d->run_lock);
+	free(line);
+
+	if (err)
+		goto send;
+	if (!cmd.argc) {
+		fclose(f);
+		free(resp);
+		return 0;
+	}
+
+	if (daemon_cmd_cached(&cmd)) {
+		key = daemon_cmd_key(&cmd);
+		r = key ? daemon_cache_get(d, key) : NULL;
+	}
+	if (r) {
+		fwrite(r->data, 1, r->len, f);
+		goto send;
+	}
+
+	ctrl = daemon_cmd_ctrl(d, &cmd);
+	/* what a command line sends is unknown: take the controller alone */
+	daemon_ctrl_begin(d, ctrl, true);
+	pthread_mutex_lock(&d->run_lock);
+
+	/* getopt and handle_plugin shuffle argv; keep cmd.argv to free */
+	memcpy(args, cmd.argv, (cmd.argc + 1) * sizeof(char *));
+	batch_capture_begin(&d->out);
+	batch_capture_begin(&d->errs);
+	err = d->opts->run(cmd.argc, args);
+	batch_capture_end(&d->errs);
+	batch_capture_end(&d->out);
+	batch_print_record(f, &cmd, err, &d->out, &d->errs, true);
+
+	pthread_mutex_unlock(&d->run_lock);
+	daemon_ctrl_end(d, ctrl);
+
+	if (key && !err) {
+		fflush(f);
+		daemon_cache_put(d, key, NULL, resp, len);
+	}
+ send:
+	fputc('\n', f);
+	fclose(f);
+	iov.iov_base = resp;
+	iov.iov_len = len;
+	err = send_all(fd, &iov, 1);
+	batch_cmd_free(&cmd);
+	free(resp);
+	free(key);
+	return err;
+}
+
+static int daemon_serve(struct daemon *d, int fd)
+{
+	unsigned char c;
+	ssize_t n;
+
+	n = recv(fd, &c, 1, MSG_PEEK);
+	if (n <= 0)
+		return -EPIPE;
+	if (c == (NVME_DAEMON_MAGIC & 0xff))
+		return daemon_serve_binary(d, fd);
+	return daemon_serve_line(d, fd);
+}
+
+static void *daemon_worker(void *arg)
+{
+	struct daemon *d = arg;
+	struct daemon_done done;
+
+	for (;;) {
+		pthread_mutex_lock(&d->lock);
+		while (!d->nqueue && !d->stop)
+			pthread_cond_wait(&d->ready, &d->lock);
+		if (d->stop) {
+			pthread_mutex_unlock(&d->lock);
+			break;
+		}
+		done.fd = d->queue[0];
+		memmove(d->queue, d->queue + 1, --d->nqueue * sizeof(int));
+		pthread_mutex_unlock(&d->lock);
+
+		pthread_rwlock_rdlock(&d->flush_lock);
+		done.close = daemon_serve(d, done.fd) < 0;
+		pthread_rwlock_unlock(&d->flush_lock);
+
+		if (write(d->wake[1], &done, sizeof(done)) != sizeof(done))
+			break;
+	}
+	return NULL;
+}
+
+static int daemon_queue(struct daemon *d, int fd)
+{
+	int *q;
+
+	pthread_mutex_lock(&d->lock);
+	q = realloc(d->queue, (d->nqueue + 1) * sizeof(*q));
+	if (q) {
+		d->queue = q;
+		d->queue[d->nqueue++] = fd;
+		pthread_cond_signal(&d->ready);
+	}
+	pthread_mutex_unlock(&d->lock);
+	return q ? 0 : -ENOMEM;
+}
+
+/* Drop everything cached about devices after the kernel changed one */
+static void daemon_flush(struct daemon *d)
+{
+	struct hash_entry *e;
+	unsigned int i;
+
+	pthread_rwlock_wrlock(&d->flush_lock);
+	pthread_mutex_lock(&d->run_lock);
+	nvme_scan_invalidate(NULL);
+	nvme_resolve_invalidate();
+	d->opts->flush();
+	pthread_mutex_unlock(&d->run_lock);
+
+	pthread_mutex_lock(&d->lock);
+	hash_for_each(&d->ctrls, i, e)
+		((struct daemon_ctrl *)e->data)->effects = 0;
+	hash_free(&d->devs, daemon_dev_free);
+	hash_free(&d->cache, free);
+	hash_init(&d->devs, 32);
+	hash_init(&d->cache, 64);
+	pthread_mutex_unlock(&d->lock);
+	pthread_rwlock_unlock(&d->flush_lock);
+}
+
+static int daemon_listen(const char *path, int *lockfd)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char lock[sizeof(addr.sun_path) + 8];
+	mode_t mask;
+	int fd, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+	if (!strncmp(path, NVME_RUN_DIR "/", strlen(NVME_RUN_DIR) + 1) &&
+	    mkdir(NVME_RUN_DIR, 0755) && errno != EEXIST)
+		return -errno;
+
+	/*
+	 * The lock is held for as long as the daemon runs, so a socket left
+	 * behind without it is stale and can be replaced.
+	 */
+	snprintf(lock, sizeof(lock), "%s.lock", path);
+	*lockfd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (*lockfd < 0)
+		return -errno;
+	if (flock(*lockfd, LOCK_EX | LOCK_NB)) {
+		err = errno == EWOULDBLOCK ? -EADDRINUSE : -errno;
+		close(*lockfd);
+		return err;
+	}
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	/* requests may send any admin command: owner only */
+	mask = umask(0077);
+	err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (err || listen(fd, DAEMON_BACKLOG)) {
+		err = -errno;
+		close(fd);
+		close(*lockfd);
+		return err;
+	}
+	return fd;
+}
+
+static int daemon_init(struct daemon *d, const struct nvme_daemon_opts *opts)
+{
+	int err;
+
+	memset(d, 0, sizeof(*d));
+	d->opts = opts;
+
+	/*
+	 * Don't let a stream of requests hold off a flush, or reads hold
+	 * off a command that needs its controller alone.
+	 */
+	pthread_rwlockattr_init(&d->rwattr);
+	pthread_rwlockattr_setkind_np(&d->rwattr,
+			PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&d->flush_lock, &d->rwattr);
+	pthread_mutex_init(&d->run_lock, NULL);
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->ready, NULL);
+
+	if (hash_init(&d->devs, 32) || hash_init(&d->ctrls, 32) ||
+	    hash_init(&d->cache, 64))
+		return -ENOMEM;
+	if (pipe2(d->wake, O_CLOEXEC | O_NONBLOCK))
+		return -errno;
+
+	err = batch_capture_init(&d->out, STDOUT_FILENO);
+	if (err)
+		return err;
+	err = batch_capture_init(&d->errs, STDERR_FILENO);
+	if (err)
+		batch_capture_free(&d->out);
+	return err;
+}
+
+static void daemon_exit(struct daemon *d)
+{
+	batch_capture_free(&d->errs);
+	batch_capture_free(&d->out);
+	close(d->wake[0]);
+	close(d->wake[1]);
+	hash_free(&d->devs, daemon_dev_free);
+	hash_free(&d->ctrls, daemon_ctrl_free);
+	hash_free(&d->cache, free);
+	free(d->queue);
+	pthread_cond_destroy(&d->ready);
+	pthread_mutex_destroy(&d->lock);
+	pthread_mutex_destroy(&d->run_lock);
+	pthread_rwlock_destroy(&d->flush_lock);
+	pthread_rwlockattr_destroy(&d->rwattr);
+}
+
+/* Poll the listening socket, finished requests, uevents and idle clients */
+static int daemon_loop(struct daemon *d, int lfd, int uev)
+{
+	struct daemon_client *clients = NULL, *tmp;
+	struct nvme_uevent ev;
+	struct daemon_done done;
+	struct pollfd *pfds = NULL;
+	unsigned int nclients = 0, n, i, j;
+	int fd, ret = 0;
+
+	while (!daemon_stop) {
+		free(pfds);
+		pfds = calloc(nclients + 3, sizeof(*pfds));
+		if (!pfds) {
+			ret = -ENOMEM;
+			break;
+		}
+		pfds[0].fd = lfd;
+		pfds[1].fd = d->wake[0];
+		pfds[2].fd = uev;
+		for (i = 0, n = 3; i < nclients; i++)
+			if (!clients[i].busy)
+				pfds[n++].fd = clients[i].fd;
+		for (i = 0; i < n; i++)
+			pfds[i].events = POLLIN;
+
+		if (poll(pfds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+
+		if (pfds[2].revents) {
+			/* one flush covers a burst, and a lost one (ENOBUFS) */
+			while (nvme_uevent_recv(uev, &ev, 0) > 0)
+				;
+			daemon_flush(d);
+		}
+
+		while (read(d->wake[0], &done, sizeof(done)) == sizeof(done)) {
+			for (i = 0; i < nclients && clients[i].fd != done.fd; i++)
+				;
+			if (i == nclients)
+				continue;
+			clients[i].busy = false;
+			if (done.close) {
+				close(clients[i].fd);
+				clients[i] = clients[--nclients];
+			}
+		}
+
+		for (i = 3; i < n; i++) {
+			if (!pfds[i].revents)
+				continue;
+			for (j = 0; clients[j].fd != pfds[i].fd; j++)
+				;
+			if (!daemon_queue(d, pfds[i].fd))
+				clients[j].busy = true;
+		}
+
+		if (pfds[0].revents) {
+			fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0)
+				continue;
+			tmp = realloc(clients, (nclients + 1) * sizeof(*clients));
+			if (!tmp) {
+				close(fd);
+				continue;
+			}
+			clients = tmp;
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO,
+				   &(struct timeval){ DAEMON_RCV_TIMEOUT, 0 },
+				   sizeof(struct timeval));
+			clients[nclients].fd = fd;
+			clients[nclients].busy = false;
+			nclients++;
+		}
+	}
+
+	/* workers are gone by now; nothing is busy any more */
+	for (i = 0; i < nclients; i++)
+		close(clients[i].fd);
+	free(clients);
+	free(pfds);
+	return ret;
+}
+
+/**
+ * nvme_daemon: - serve requests on a Unix socket until SIGINT or SIGTERM
+ * @opts: socket path, worker count, rate limit and the command runner
+ */
+int nvme_daemon(const struct nvme_daemon_opts *opts)
+{
+	struct sigaction sa = { .sa_handler = daemon_sighandler };
+	sigset_t mask, old;
+	const char *path = opts->socket ? opts->socket : NVME_DAEMON_SOCKET;
+	unsigned int i, workers = opts->workers;
+	pthread_t *threads;
+	struct daemon d;
+	int lfd, lockfd, uev, fd, err;
+
+	lfd = daemon_listen(path, &lockfd);
+	if (lfd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-lfd));
+		return lfd;
+	}
+
+	err = daemon_init(&d, opts);
+	if (err) {
+		fprintf(stderr, "daemon: %s\n", strerror(-err));
+		goto close;
+	}
+
+	uev = nvme_uevent_open();
+	if (uev < 0)
+		fprintf(stderr, "uevents: %s; caches are not refreshed\n",
+			strerror(-uev));
+
+	/* commands must not wait for input from whoever started us */
+	fd = open("/dev/null", O_RDONLY);
+	if (fd >= 0) {
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* signals must interrupt the main thread's poll, not a worker */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	threads = calloc(workers, sizeof(*threads));
+	for (i = 0; threads && i < workers; i++)
+		if (pthread_create(&threads[i], NULL, daemon_worker, &d))
+			break;
+	workers = threads ? i : 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (!workers) {
+		fprintf(stderr, "daemon: failed to start workers\n");
+		err = -ENOMEM;
+	} else {
+		fprintf(stderr, "listening on %s with %u workers\n", path,
+			workers);
+		err = daemon_loop(&d, lfd, uev);
+	}
+
+	pthread_mutex_lock(&d.lock);
+	d.stop = true;
+	pthread_cond_broadcast(&d.ready);
+	pthread_mutex_unlock(&d.lock);
+	for (i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	if (uev >= 0)
+		close(uev);
+	daemon_exit(&d);
+ close:
+	close(lfd);
+	unlink(path);
+	close(lockfd);
+	return err;
+}
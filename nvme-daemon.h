@@ -0,0 +1,59 @@
+#ifndef _NVME_DAEMON_H
+#define _NVME_DAEMON_H
+
+#include <linux/types.h>
+
+#include "nvme-resolve.h"
+
+#define NVME_DAEMON_SOCKET	NVME_RUN_DIR "/daemon.sock"
+#define NVME_DAEMON_WORKERS	4
+
+/*
+ * Binary framing, in host byte order. A request is struct
+ * nvme_daemon_req, followed by data_len bytes when NVME_DAEMON_WRITE is
+ * set; the reply is struct nvme_daemon_rsp, followed by data_len bytes of
+ * data read from the device. The leading 0x7f of the magic tells binary
+ * requests apart from JSON ones, which are single lines of text.
+ */
+#define NVME_DAEMON_MAGIC	0x44564e7f	/* "\x7fNVD" */
+#define NVME_DAEMON_WRITE	(1 << 0)
+#define NVME_DAEMON_MAX_DATA	(1 << 20)
+
+struct nvme_daemon_req {
+	__u32	magic;
+	__u8	opcode;		/* admin command opcode */
+	__u8	flags;
+	__u16	rsvd;
+	__u32	nsid;
+	__u32	cdw10;
+	__u32	cdw11;
+	__u32	cdw12;
+	__u32	cdw13;
+	__u32	cdw14;
+	__u32	cdw15;
+	__u32	data_len;
+	__u32	timeout_ms;
+	char	dev[64];	/* /dev/nvmfX, nvmfXnY or a persistent key */
+};
+
+struct nvme_daemon_rsp {
+	__u32	magic;
+	__s32	status;		/* 0, an NVMe status if > 0, or -errno */
+	__u32	result;		/* completion queue entry dword 0 */
+	__u32	data_len;
+};
+
+struct nvme_daemon_opts {
+	const char *socket;
+	unsigned int workers;
+	unsigned int min_interval;	/* usecs between commands to a controller */
+
+	/* run one command line in-process, as 'batch' does */
+	int (*run)(int argc, char **argv);
+	/* drop device handles kept by run(); called between commands */
+	void (*flush)(void);
+};
+
+int nvme_daemon(const struct nvme_daemon_opts *opts);
+
+#endif
@@ -23,17 +23,13 @@
 
 static int nvme_verify_chr(int fd)
 {
-	static struct stat nvme_stat;
-	int err = fstat(fd, &nvme_stat);
+	struct stat nvme_stat;
 
-	if (err < 0) {
-		perror("fstat");
-		return errno;
-	}
+	if (fstat(fd, &nvme_stat) < 0)
+		return -1;
 	if (!S_ISCHR(nvme_stat.st_mode)) {
-		fprintf(stderr,
-			"Error: requesting reset on non-controller handle\n");
-		return ENOTBLK;
+		errno = ENOTTY;
+		return -1;
 	}
 	return 0;
 }
@@ -70,16 +66,15 @@ int nvme_ns_rescan(int fd)
 
 int nvme_get_nsid(int fd)
 {
-	static struct stat nvme_stat;
+	struct stat nvme_stat;
 	int err = fstat(fd, &nvme_stat);
 
 	if (err < 0)
 		return err;
 
 	if (!S_ISBLK(nvme_stat.st_mode)) {
-		fprintf(stderr,
-			"Error: requesting namespace-id from non-block device\n");
-		return ENOTBLK;
+		errno = ENOTBLK;
+		return -1;
 	}
 	return ioctl(fd, NVME_IOCTL_ID);
 }
@@ -381,7 +376,8 @@ int nvme_identify_ns_descs(int fd, __u32 nsid, void *data)
 	return nvme_identify(fd, nsid, NVME_ID_CNS_NS_DESC_LIST, data);
 }
 
-int nvme_get_log(int fd, __u32 nsid, __u8 log_id, __u32 data_len, void *data)
+int nvme_get_log_page(int fd, __u32 nsid, __u8 log_id, __u8 lsp,
+		      __u64 offset, bool rae, __u32 data_len, void *data)
 {
 	struct nvme_admin_cmd cmd = {
 		.opcode		= nvme_admin_get_log_page,
@@ -392,12 +388,27 @@ int nvme_get_log(int fd, __u32 nsid, __u8 log_id, __u32 data_len, void *data)
 	__u32 numd = (data_len >> 2) - 1;
 	__u16 numdu = numd >> 16, numdl = numd & 0xffff;
 
-	cmd.cdw10 = log_id | (numdl << 16);
+	cmd.cdw10 = log_id | ((lsp & 0xf) << 8) | (rae ? 1 << 15 : 0) |
+		(numdl << 16);
 	cmd.cdw11 = numdu;
+	cmd.cdw12 = offset & 0xffffffff;
+	cmd.cdw13 = offset >> 32;
 
 	return nvme_submit_admin_passthru(fd, &cmd);
 }
 
+int nvme_get_log_offset(int fd, __u32 nsid, __u8 log_id, __u64 offset,
+			__u32 data_len, void *data)
+{
+	return nvme_get_log_page(fd, nsid, log_id, 0, offset, false, data_len,
+				 data);
+}
+
+int nvme_get_log(int fd, __u32 nsid, __u8 log_id, __u32 data_len, void *data)
+{
+	return nvme_get_log_offset(fd, nsid, log_id, 0, data_len, data);
+}
+
 int nvme_fw_log(int fd, struct nvme_firmware_log_page *fw_log)
 {
 	return nvme_get_log(fd, NVME_NSID_ALL, NVME_LOG_FW_SLOT, sizeof(*fw_log), fw_log);
@@ -414,11 +425,39 @@ int nvme_smart_log(int fd, __u32 nsid, struct nvme_smart_log *smart_log)
 	return nvme_get_log(fd, nsid, NVME_LOG_SMART, sizeof(*smart_log), smart_log);
 }
 
+int nvme_ana_log(int fd, void *ana_log, __u32 len, bool rgo)
+{
+	/* retain the event, reading the log is no acknowledgment */
+	return nvme_get_log_page(fd, NVME_NSID_ALL, NVME_LOG_ANA,
+				 rgo ? NVME_ANA_LOG_RGO : 0, 0, true, len,
+				 ana_log);
+}
+
 int nvme_discovery_log(int fd, struct nvmf_disc_rsp_page_hdr *log, __u32 size)
 {
 	return nvme_get_log(fd, 0, NVME_LOG_DISC, size, log);
 }
 
+/*
+ * Fabrics Property Get. Only the low 32 bits of the completion are
+ * returned by the passthru ioctl, which covers CAP.MQES, VS, CC and CSTS.
+ */
+int nvme_get_property(int fd, int offset, __u32 *value)
+{
+	struct nvme_admin_cmd cmd = {
+		.opcode		= nvme_fabrics_command,
+		.nsid		= nvme_fabrics_type_property_get,
+		.cdw10		= offset == NVME_REG_CAP ? 1 : 0,
+		.cdw11		= offset,
+	};
+	int err;
+
+	err = nvme_submit_admin_passthru(fd, &cmd);
+	if (!err && value)
+		*value = cmd.result;
+	return err;
+}
+
 int nvme_feature(int fd, __u8 opcode, __u32 nsid, __u32 cdw10, __u32 cdw11,
 		 __u32 data_len, void *data, __u32 *result)
 {
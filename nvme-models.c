@@ -1,13 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 
+#include "nvme-models.h"
+#include "nvme-cache.h"
+#include "hash.h"
+
 static char *_fmt1 = "/sys/class/nvmf/nvmf%d/device/subsystem_vendor";
 static char *_fmt2 = "/sys/class/nvmf/nvmf%d/device/subsystem_device";
 static char *_fmt3 = "/sys/class/nvmf/nvmf%d/device/vendor";
@@ -20,204 +26,348 @@ static char fmt3[78];
 static char fmt4[78];
 static char fmt5[78];
 
-static char *device_top;
-static char *device_mid;
-static char *device_final;
-static char *class_top;
-static char *class_mid;
-static char *class_final;
-
-
-
-static void free_all(void)
+#define PCI_IDS_PATH		"/usr/share/hwdata/pci.ids"
+#define PCI_IDX_DIR		"/var/cache/nvmf"
+#define PCI_IDX_PATH		PCI_IDX_DIR "/pci.ids.idx"
+#define PCI_IDX_MAGIC		"NVMFPCI1"
+
+/*
+ * pci.ids is ~35k lines of text. Rather than scanning it for every
+ * controller we turn it once into a sorted table of
+ *
+ *	vendor			(level 1: ven)
+ *	device			(level 2: ven, dev)
+ *	subsystem		(level 3: ven, dev, subven, subdev)
+ *	class/subclass		(level 4: class, subclass)
+ *
+ * entries pointing into a string table, cache that under /var/cache and
+ * mmap it on later runs. The cache is rebuilt whenever pci.ids changes
+ * size or mtime.
+ */
+enum {
+	PCI_LVL_VENDOR	= 1,
+	PCI_LVL_DEVICE	= 2,
+	PCI_LVL_SUBSYS	= 3,
+	PCI_LVL_CLASS	= 4,
+};
+
+struct pci_idx_hdr {
+	char		magic[8];
+	uint64_t	src_mtime;
+	uint64_t	src_size;
+	uint32_t	nr_entries;
+	uint32_t	strtab_size;
+};
+
+struct pci_idx_entry {
+	uint64_t	id;	/* level << 32 | a << 16 | b */
+	uint32_t	sub;	/* subvendor << 16 | subdevice */
+	uint32_t	name;	/* offset into the string table */
+};
+
+struct pci_idx {
+	const struct pci_idx_hdr *hdr;
+	const struct pci_idx_entry *entries;
+	const char *strtab;
+	void *map;
+	size_t map_len;
+	bool mapped;
+};
+
+static struct pci_idx pci_idx;
+static bool pci_idx_loaded;
+static struct hash_table product_names;
+
+static inline uint64_t pci_id(int level, unsigned a, unsigned b)
 {
-	free(device_top);
-	device_top = NULL;
-	free(device_mid);
-	device_mid = NULL;
-	free(device_final);
-	device_final = NULL;
-	free(class_top);
-	class_top = NULL;
-	free(class_mid);
-	class_mid = NULL;
-	free(class_final);
-	class_final = NULL;
+	return (uint64_t)level << 32 | (a & 0xffff) << 16 | (b & 0xffff);
 }
 
-static char *find_data(char *data)
+static int pci_entry_cmp(const void *l, const void *r)
 {
-	while (*data != '\0') {
-		if (*data >= '0' && *data <= '9')
-			return data;
-		data++;
-	}
-	return NULL;
-}
+	const struct pci_idx_entry *a = l, *b = r;
 
-static char *locate_info(char *data, bool is_inner, bool is_class)
-{
-	char *orig = data;
-	char *locate = find_data(data);
-	if (!data)
-		return orig;
-
-	if (is_class)
-		return locate + 4;
-	if (!is_inner)
-		/* 4 to get over the number, 2 for spaces */
-		return locate + 4 + 2;
-
-	/* Inner data, has "sub_ven(space)sub_dev(space)(space)string */
-	return locate + 4 + 1 + 4 + 2;
+	if (a->id != b->id)
+		return a->id < b->id ? -1 : 1;
+	if (a->sub != b->sub)
+		return a->sub < b->sub ? -1 : 1;
+	return 0;
 }
 
-static void format_and_print(char *save)
-{
+struct pci_idx_builder {
+	struct pci_idx_entry *entries;
+	unsigned int nr, alloc;
+	char *strtab;
+	size_t str_len, str_alloc;
+};
 
-	if (!class_mid)
-		snprintf(save, 1024, "%s %s %s",
-		       locate_info(device_top, false, false),
-		       locate_info(device_mid, false, false),
-		       locate_info(device_final, true, false));
-	else
-		snprintf(save, 1024, "%s: %s %s %s",
-			 locate_info(class_mid, false, true),
-			 locate_info(device_top, false, false),
-			 locate_info(device_mid, false, false),
-			 locate_info(device_final, true, false));
-}
-
-static void format_all(char *save, char *vendor, char *device)
+static int pci_idx_add(struct pci_idx_builder *b, uint64_t id, uint32_t sub,
+		       const char *name)
 {
-	if (device_top && device_mid && device_final)
-		format_and_print(save);
+	size_t len = strlen(name) + 1;
 
-	else if (device_top && !device_mid && class_mid)
-		snprintf(save, 1024, "%s: %s Device %s",
-			 locate_info(class_mid, false, true),
-			 locate_info(device_top, false, false),
-			 device);
+	if (b->nr == b->alloc) {
+		void *tmp;
 
-	else if (!device_top && class_mid)
-		snprintf(save, 1024, "%s: Vendor %s Device %s",
-			 locate_info(class_mid, false, true),
-			 vendor,
-			 device);
-	else
-		snprintf(save, 1024, "Unknown device");
+		b->alloc = b->alloc ? b->alloc * 2 : 4096;
+		tmp = realloc(b->entries, b->alloc * sizeof(*b->entries));
+		if (!tmp)
+			return -ENOMEM;
+		b->entries = tmp;
+	}
+	if (b->str_len + len > b->str_alloc) {
+		void *tmp;
+
+		b->str_alloc = b->str_alloc ? b->str_alloc * 2 : 256 * 1024;
+		while (b->str_len + len > b->str_alloc)
+			b->str_alloc *= 2;
+		tmp = realloc(b->strtab, b->str_alloc);
+		if (!tmp)
+			return -ENOMEM;
+		b->strtab = tmp;
+	}
+
+	b->entries[b->nr].id = id;
+	b->entries[b->nr].sub = sub;
+	b->entries[b->nr].name = b->str_len;
+	b->nr++;
+	memcpy(b->strtab + b->str_len, name, len);
+	b->str_len += len;
+	return 0;
 }
 
-static int is_final_match(char *line, char *search)
+static const char *skip_spaces(const char *s)
 {
-	return !memcmp(&line[2], search, 2);
+	while (*s == ' ' || *s == '\t')
+		s++;
+	return s;
 }
 
-static int is_inner_sub_vendev(char *line, char *search, char *search2)
+/*
+ * Walk pci.ids once. Vendor blocks come first ("vvvv  name", "\tdddd  name",
+ * "\t\tssss ssss  name"), followed by the class blocks ("C cc  name",
+ * "\tss  name", "\t\tpp  name"); programming interfaces are not needed.
+ */
+static int pci_idx_parse(FILE *file, struct pci_idx_builder *b)
 {
-	char combine[10];
-	snprintf(combine, sizeof(combine), "%s %s", &search[2], &search2[2]);
-       	if (line[0] != '\t' && line[1] != '\t')
-		return 0;
+	unsigned int ven = 0, dev = 0, cls = 0, sv, sd, id;
+	bool in_class = false, have_ven = false, have_dev = false;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t amnt;
+	int n, ret = 0;
+
+	while ((amnt = getline(&line, &size, file)) != -1) {
+		if (line[amnt - 1] == '\n')
+			line[--amnt] = '\0';
+		if (!amnt || line[0] == '#')
+			continue;
 
-	return !memcmp(combine, &line[2], 9);
+		if (line[0] == 'C' && line[1] == ' ') {
+			in_class = sscanf(line + 2, "%x%n", &cls, &n) == 1;
+			have_ven = have_dev = false;
+			continue;
+		}
+
+		if (line[0] != '\t') {
+			in_class = false;
+			have_dev = false;
+			have_ven = sscanf(line, "%4x%n", &ven, &n) == 1;
+			if (have_ven)
+				ret = pci_idx_add(b, pci_id(PCI_LVL_VENDOR, ven, 0),
+						  0, skip_spaces(line + n));
+		} else if (line[1] != '\t') {
+			if (sscanf(line + 1, "%x%n", &id, &n) != 1)
+				continue;
+			if (in_class) {
+				ret = pci_idx_add(b, pci_id(PCI_LVL_CLASS, cls, id),
+						  0, skip_spaces(line + 1 + n));
+			} else if (have_ven) {
+				dev = id;
+				have_dev = true;
+				ret = pci_idx_add(b, pci_id(PCI_LVL_DEVICE, ven, dev),
+						  0, skip_spaces(line + 1 + n));
+			}
+		} else if (have_dev) {
+			if (sscanf(line + 2, "%x %x%n", &sv, &sd, &n) != 2)
+				continue;
+			ret = pci_idx_add(b, pci_id(PCI_LVL_SUBSYS, ven, dev),
+					  (sv & 0xffff) << 16 | (sd & 0xffff),
+					  skip_spaces(line + 2 + n));
+		}
+		if (ret)
+			break;
+	}
+	free(line);
+	return ret;
 }
 
-static int is_mid_level_match(char *line, char *device, bool class)
+static void pci_idx_save(void *buf, size_t len)
 {
-	if (!class)
-		return !memcmp(&line[1], &device[2], 4);
+	struct iovec iov = { buf, len };
+
+	if (mkdir(PCI_IDX_DIR, 0755) && errno != EEXIST)
+		return;
 
-	return !memcmp(&line[1], device, 2);
+	nvme_cache_write(PCI_IDX_PATH, &iov, 1, 0644);
 }
 
-static inline bool is_comment(char *line)
+static void pci_idx_set(struct pci_idx *idx, void *buf)
 {
-	return line[0] == '#';
+	idx->hdr = buf;
+	idx->entries = buf + sizeof(*idx->hdr);
+	idx->strtab = (const char *)(idx->entries + idx->hdr->nr_entries);
 }
 
-static int is_top_level_match(char *line, const char* device, bool class)
+/*
+ * Parse pci.ids into a single buffer laid out exactly like the cache file,
+ * so it can be used directly when the cache directory is not writable.
+ */
+static int pci_idx_build(struct pci_idx *idx, struct stat *src)
 {
-	if (line[0] == '\t')
-		return false;
-	if (line[0] == '#')
-		return false;
-	if (!class)
-		return !memcmp(line, &device[2], 4);
-	if (line[0] != 'C')
-		return false;
-	/* Skipping    C(SPACE)  0x */
-	return !memcmp(&line[2], &device[2], 2);
+	struct pci_idx_builder b = { 0 };
+	struct pci_idx_hdr hdr;
+	size_t len;
+	FILE *file;
+	void *buf;
+	int ret;
+
+	file = fopen(PCI_IDS_PATH, "r");
+	if (!file)
+		return -errno;
+	ret = pci_idx_parse(file, &b);
+	fclose(file);
+	if (ret)
+		goto out;
+
+	qsort(b.entries, b.nr, sizeof(*b.entries), pci_entry_cmp);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PCI_IDX_MAGIC, sizeof(hdr.magic));
+	hdr.src_mtime = src->st_mtime;
+	hdr.src_size = src->st_size;
+	hdr.nr_entries = b.nr;
+	hdr.strtab_size = b.str_len;
+
+	len = sizeof(hdr) + b.nr * sizeof(*b.entries) + b.str_len;
+	buf = malloc(len);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), b.entries, b.nr * sizeof(*b.entries));
+	memcpy(buf + sizeof(hdr) + b.nr * sizeof(*b.entries), b.strtab,
+	       b.str_len);
+
+	pci_idx_save(buf, len);
+
+	idx->map = buf;
+	idx->map_len = len;
+	idx->mapped = false;
+	pci_idx_set(idx, buf);
+out:
+	free(b.entries);
+	free(b.strtab);
+	return ret;
 }
 
-static inline int is_tab(char *line)
+static int pci_idx_map(struct pci_idx *idx, struct stat *src)
 {
-	return line[0] == '\t';
+	const struct pci_idx_hdr *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(PCI_IDX_PATH, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	hdr = map;
+	if (memcmp(hdr->magic, PCI_IDX_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->src_mtime != src->st_mtime ||
+	    hdr->src_size != src->st_size ||
+	    sizeof(*hdr) + (size_t)hdr->nr_entries * sizeof(struct pci_idx_entry) +
+	    hdr->strtab_size != st.st_size) {
+		munmap(map, st.st_size);
+		return -ESTALE;
+	}
+
+	idx->map = map;
+	idx->map_len = st.st_size;
+	idx->mapped = true;
+	pci_idx_set(idx, map);
+	return 0;
 }
 
-static inline int is_class_info(char *line)
+static struct pci_idx *pci_idx_get(void)
 {
-	return !memcmp(line, "# C class", 9);
+	struct stat src;
+
+	if (pci_idx_loaded)
+		return pci_idx.hdr ? &pci_idx : NULL;
+	pci_idx_loaded = true;
+
+	if (stat(PCI_IDS_PATH, &src))
+		return NULL;
+	if (pci_idx_map(&pci_idx, &src) && pci_idx_build(&pci_idx, &src))
+		return NULL;
+	return &pci_idx;
 }
 
-static void parse_vendor_device(char **line, FILE *file,
-			       char *device, char *subdev,
-			       char *subven)
+static const char *pci_lookup(struct pci_idx *idx, uint64_t id, uint32_t sub)
 {
-	bool device_single_found = false;
-	size_t amnt = 1024;
-	size_t found = 0;
-	char *newline;
-
-	while ((found = getline(line, &amnt, file)) != -1) {
-		newline = *line;
-		if (is_comment(newline))
-			continue;
-		if (!is_tab(newline))
-			return;
+	struct pci_idx_entry key = { .id = id, .sub = sub };
+	const struct pci_idx_entry *e;
 
-		newline[found - 1] = '\0';
-		if (!device_single_found && is_mid_level_match(newline, device, false)) {
-			device_single_found = true;
-			device_mid = strdup(newline);
-			continue;
-		}
+	if (!idx)
+		return NULL;
 
-		if (device_single_found && is_inner_sub_vendev(newline, subven, subdev)) {
-			device_final = strdup(newline);
-			break;
-		}
-	}
+	e = bsearch(&key, idx->entries, idx->hdr->nr_entries,
+		    sizeof(*e), pci_entry_cmp);
+	if (!e || e->name >= idx->hdr->strtab_size)
+		return NULL;
+	return idx->strtab + e->name;
 }
 
-static void pull_class_info(char **_newline, FILE *file, char *class)
+static void format_all(char *save, size_t len, struct pci_idx *idx,
+		       unsigned ven, unsigned dev, unsigned sv, unsigned sd,
+		       unsigned cls, const char *vendor, const char *device)
 {
-	size_t amnt;
-	size_t size = 1024;
-	bool top_found = false;
-	bool mid_found = false;
-	char *newline;
-
-	while ((amnt = getline(_newline, &size, file)) != -1) {
-		newline = *_newline;
-		newline[amnt - 1] = '\0';
-		if (!top_found && is_top_level_match(newline, class, true)) {
-			class_top = strdup(newline);
-			top_found = true;
-			continue;
-		}
-		if (!mid_found && top_found &&
-		    is_mid_level_match(newline,  &class[4], true)) {
-			class_mid = strdup(newline);
-			mid_found = true;
-			continue;
-		}
-		if (top_found && mid_found &&
-		    is_final_match(newline, &class[6])) {
-			class_final = strdup(newline);
-			break;
-		}
-	}
+	const char *ven_name, *dev_name, *sub_name, *class_name;
+
+	ven_name = pci_lookup(idx, pci_id(PCI_LVL_VENDOR, ven, 0), 0);
+	dev_name = pci_lookup(idx, pci_id(PCI_LVL_DEVICE, ven, dev), 0);
+	sub_name = pci_lookup(idx, pci_id(PCI_LVL_SUBSYS, ven, dev),
+			      (sv & 0xffff) << 16 | (sd & 0xffff));
+	class_name = pci_lookup(idx, pci_id(PCI_LVL_CLASS, cls >> 16,
+					     (cls >> 8) & 0xff), 0);
+
+	if (ven_name && dev_name) {
+		if (class_name)
+			snprintf(save, len, "%s: %s %s%s%s", class_name,
+				 ven_name, dev_name, sub_name ? " " : "",
+				 sub_name ? sub_name : "");
+		else
+			snprintf(save, len, "%s %s%s%s", ven_name, dev_name,
+				 sub_name ? " " : "", sub_name ? sub_name : "");
+	} else if (ven_name && class_name)
+		snprintf(save, len, "%s: %s Device %s", class_name, ven_name,
+			 device);
+	else if (class_name)
+		snprintf(save, len, "%s: Vendor %s Device %s", class_name,
+			 vendor, device);
+	else
+		snprintf(save, len, "Unknown device");
 }
 
 static int read_sys_node(char *where, char *save, size_t savesz)
@@ -244,20 +394,15 @@ static int read_sys_node(char *where, char *save, size_t savesz)
 
 char *nvme_product_name(int id)
 {
-	char *line;
-	ssize_t amnt;
-	FILE *file = fopen("/usr/share/hwdata/pci.ids", "r");
 	char vendor[7] = { 0 };
 	char device[7] = { 0 };
 	char sub_device[7] = { 0 };
 	char sub_vendor[7] = { 0 };
 	char class[13] = { 0 };
-	size_t size = 1024;
+	char key[48], *name;
+	unsigned long cls;
 	char ret;
 
-	if (!file)
-		goto error1;
-
 	snprintf(fmt1, 78, _fmt1, id);
 	snprintf(fmt2, 78, _fmt2, id);
 	snprintf(fmt3, 78, _fmt3, id);
@@ -272,28 +417,30 @@ char *nvme_product_name(int id)
 	if (ret)
 		goto error1;
 
+	/* several controllers of one model: only resolve the name once */
+	snprintf(key, sizeof(key), "%s:%s:%s:%s:%s", vendor, device,
+		 sub_vendor, sub_device, class);
+	if (!product_names.buckets && hash_init(&product_names, 32))
+		goto error1;
+	name = hash_lookup(&product_names, key);
+	if (name)
+		return strdup(name);
 
-	line = malloc(1024);
-	if (!line)
+	name = malloc(1024);
+	if (!name)
 		goto error1;
 
-	while ((amnt = getline(&line, &size, file)) != -1) {
-		if (is_comment(line) && !is_class_info(line))
-			continue;
-		if (is_top_level_match(line, vendor, false)) {
-			line[amnt - 1] = '\0';
-			device_top = strdup(line);
-			parse_vendor_device(&line, file,
-					    device,
-					    sub_device,
-					    sub_vendor);
-		}
-		if (is_class_info(line))
-			pull_class_info(&line, file, class);
+	cls = strtoul(class, NULL, 16);
+	format_all(name, 1024, pci_idx_get(),
+		   strtoul(vendor, NULL, 16), strtoul(device, NULL, 16),
+		   strtoul(sub_vendor, NULL, 16), strtoul(sub_device, NULL, 16),
+		   cls, vendor, device);
+
+	if (hash_insert(&product_names, key, name)) {
+		free(name);
+		goto error1;
 	}
-	format_all(line, vendor, device);
-	free_all();
-	return line;
+	return strdup(name);
  error1:
 	return strdup("Unknown Device");
 }
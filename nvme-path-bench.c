@@ -0,0 +1,231 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvme-path-bench.h"
+#include "nvme-ioctl.h"
+
+/*
+ * Short read workload against a single controller path, issued as I/O
+ * passthrough on that controller's generic device for the namespace
+ * (ng<ctrl>n<ns>), which only ever uses its own path.
+ * Every path is given the same seed and therefore reads the same LBAs in
+ * the same order, so the paths of a subsystem only differ in the path
+ * itself: host port, fabric and target port. The warmup reads cycle over
+ * the same LBAs, and path_bench_prime() reads all of them once before any
+ * path is timed, so no path is the one that finds the target's cache cold.
+ */
+
+static __u64 now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int cmp_lat(const void *a, const void *b)
+{
+	__u32 x = *(const __u32 *)a, y = *(const __u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted latencies, in tenths of a percent */
+static __u32 percentile(const __u32 *lat, __u32 n, unsigned int permille)
+{
+	__u64 rank = ((__u64)n * permille + 999) / 1000;
+
+	return lat[rank ? rank - 1 : 0];
+}
+
+/* The count LBAs every path reads, in order */
+static __u64 *bench_lbas(const struct path_bench_opts *opts)
+{
+	unsigned int seed = opts->seed;
+	__u32 nlb = opts->data_size >> opts->lba_shift;
+	__u64 *lbas, slots, r;
+	__u32 i;
+
+	lbas = calloc(opts->count, sizeof(*lbas));
+	if (!lbas)
+		return NULL;
+
+	slots = opts->nsze / nlb;
+	if (!slots)
+		slots = 1;
+	for (i = 0; i < opts->count; i++) {
+		r = (__u64)rand_r(&seed) << 31 | rand_r(&seed);
+		lbas[i] = r % slots * nlb;
+	}
+	return lbas;
+}
+
+static int bench_read(int fd, const struct path_bench_opts *opts, __u64 lba,
+		      void *buf)
+{
+	__u32 nlb = opts->data_size >> opts->lba_shift;
+	int err;
+
+	err = nvme_passthru_io(fd, nvme_cmd_read, 0, 0, opts->nsid,
+			       0, 0, lba & 0xffffffff, lba >> 32,
+			       nlb - 1, 0, 0, 0, opts->data_size, buf,
+			       0, NULL, 0);
+	return err < 0 ? -errno : err;
+}
+
+/*
+ * Find the generic device of nsid behind ctrl. Its name follows the
+ * namespace's node under the controller, "nvmf<subsys>c<ctrl>n<head>"
+ * with multipath or "nvmf<ctrl>n<head>" without. Kernels without generic
+ * devices leave only the controller character device, which accepts I/O
+ * passthrough when the controller has a single namespace.
+ */
+static int bench_path(const char *ctrl, __u32 nsid, char *path, size_t len)
+{
+	struct dirent **ents;
+	char attr[300], buf[16];
+	int i, n, fd, inst, a, b, c, head = -1, nr_ns = 0;
+
+	if (sscanf(ctrl, "nvmf%d", &inst) != 1)
+		return -EINVAL;
+
+	snprintf(attr, sizeof(attr), "/sys/class/nvmf/%s", ctrl);
+	n = scandir(attr, &ents, NULL, alphasort);
+	if (n < 0)
+		return -errno;
+	for (i = 0; i < n; i++) {
+		const char *d = ents[i]->d_name;
+
+		if (sscanf(d, "nvmf%dc%dn%d", &a, &b, &c) == 3 ||
+		    sscanf(d, "nvmf%dn%d", &a, &c) == 2) {
+			nr_ns++;
+			snprintf(attr, sizeof(attr), "/sys/class/nvmf/%s/%s/nsid",
+				 ctrl, d);
+			fd = open(attr, O_RDONLY);
+			if (fd >= 0) {
+				memset(buf, 0, sizeof(buf));
+				if (read(fd, buf, sizeof(buf) - 1) > 0 &&
+				    strtoul(buf, NULL, 0) == nsid)
+					head = c;
+				close(fd);
+			}
+		}
+		free(ents[i]);
+	}
+	free(ents);
+
+	if (head < 0)
+		return -ENXIO;
+	snprintf(path, len, "/dev/ng%dn%d", inst, head);
+	if (!access(path, F_OK))
+		return 0;
+	if (nr_ns > 1)
+		return -EPROTONOSUPPORT;
+	snprintf(path, len, "/dev/%s", ctrl);
+	return 0;
+}
+
+static int bench_open(const char *ctrl, __u32 nsid)
+{
+	char path[300];
+	int fd, err;
+
+	err = bench_path(ctrl, nsid, path, sizeof(path));
+	if (err)
+		return err;
+	fd = open(path, O_RDONLY);
+	return fd < 0 ? -errno : fd;
+}
+
+int path_bench_prime(const char *ctrl, const struct path_bench_opts *opts)
+{
+	__u64 *lbas;
+	void *buf = NULL;
+	__u32 i;
+	int fd, err = 0;
+
+	fd = bench_open(ctrl, opts->nsid);
+	if (fd < 0)
+		return fd;
+
+	lbas = bench_lbas(opts);
+	if (!lbas || posix_memalign(&buf, getpagesize(), opts->data_size)) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < opts->count && !err; i++)
+		err = bench_read(fd, opts, lbas[i], buf);
+out:
+	free(buf);
+	free(lbas);
+	close(fd);
+	return err;
+}
+
+int path_bench_run(const char *ctrl, const struct path_bench_opts *opts,
+		   struct path_bench_result *res)
+{
+	__u64 start, begin = 0, sum = 0;
+	__u64 *lbas = NULL;
+	__u32 *lat = NULL;
+	void *buf = NULL;
+	__u32 i;
+	int fd, err = 0;
+
+	memset(res, 0, sizeof(*res));
+
+	fd = bench_open(ctrl, opts->nsid);
+	if (fd < 0)
+		return res->err = fd;
+
+	lbas = bench_lbas(opts);
+	lat = calloc(opts->count, sizeof(*lat));
+	if (!lbas || !lat ||
+	    posix_memalign(&buf, getpagesize(), opts->data_size)) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < opts->warmup && !err; i++)
+		err = bench_read(fd, opts, lbas[i % opts->count], buf);
+
+	begin = now_usecs();
+	for (i = 0; i < opts->count && !err; i++) {
+		start = now_usecs();
+		err = bench_read(fd, opts, lbas[i], buf);
+		if (!err)
+			lat[res->ios++] = now_usecs() - start;
+	}
+
+	if (!res->ios)
+		goto out;
+
+	res->elapsed = now_usecs() - begin;
+	if (!res->elapsed)
+		res->elapsed = 1;
+	for (i = 0; i < res->ios; i++)
+		sum += lat[i];
+	qsort(lat, res->ios, sizeof(*lat), cmp_lat);
+
+	res->iops = (__u64)res->ios * 1000000 / res->elapsed;
+	res->avg = sum / res->ios;
+	res->min = lat[0];
+	res->p50 = percentile(lat, res->ios, 500);
+	res->p90 = percentile(lat, res->ios, 900);
+	res->p99 = percentile(lat, res->ios, 990);
+	res->p999 = percentile(lat, res->ios, 999);
+	res->max = lat[res->ios - 1];
+out:
+	res->err = err;
+	free(buf);
+	free(lat);
+	free(lbas);
+	close(fd);
+	return err;
+}
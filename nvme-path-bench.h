@@ -0,0 +1,36 @@
+#ifndef _NVME_PATH_BENCH_H
+#define _NVME_PATH_BENCH_H
+
+#include <linux/types.h>
+
+struct path_bench_opts {
+	__u32	nsid;
+	__u32	count;		/* timed reads per path */
+	__u32	warmup;		/* untimed reads before the timed ones */
+	__u32	data_size;	/* bytes per read, a multiple of the LBA size */
+	__u32	lba_shift;
+	__u64	nsze;		/* namespace size in LBAs */
+	unsigned int seed;
+};
+
+/* Latencies in microseconds */
+struct path_bench_result {
+	int	err;		/* NVMe status if > 0, -errno if < 0 */
+	__u32	ios;
+	__u64	elapsed;
+	__u32	iops;
+	__u32	avg;
+	__u32	min;
+	__u32	p50;
+	__u32	p90;
+	__u32	p99;
+	__u32	p999;
+	__u32	max;
+};
+
+/* Read every LBA of the workload once, untimed, through ctrl */
+int path_bench_prime(const char *ctrl, const struct path_bench_opts *opts);
+int path_bench_run(const char *ctrl, const struct path_bench_opts *opts,
+		   struct path_bench_result *res);
+
+#endif
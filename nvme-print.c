@@ -6,6 +6,7 @@
 #include "nvme-print.h"
 #include "json.h"
 #include "nvme-models.h"
+#include "suffix.h"
 
 static long double int128_to_double(__u8 *data)
 {
@@ -600,6 +601,7 @@ void show_nvme_id_ns(struct nvme_id_ns *ns, unsigned int mode)
 	printf("nabspf  : %d\n", le16_to_cpu(ns->nabspf));
 	printf("noiob   : %d\n", le16_to_cpu(ns->noiob));
 	printf("nvmcap  : %.0Lf\n", int128_to_double(ns->nvmcap));
+	printf("anagrpid: %u\n", le32_to_cpu(ns->anagrpid));
 
 	printf("nguid   : ");
 	for (i = 0; i < 16; i++)
@@ -749,6 +751,51 @@ void show_nvme_id_ns_descs(void *data)
 	}
 }
 
+static void nguid_to_str(__u8 *nguid, char *str)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		str += sprintf(str, "%02x", nguid[i]);
+}
+
+void show_nvme_ns_list_detail(struct ns_list_item *items, int n)
+{
+	char usage[128], format[128], nguid[33];
+	int i;
+
+	printf("%-10s %-26s %-16s %-32s\n",
+		"NSID", "Usage", "Format", "NGUID");
+	printf("%-10s %-26s %-16s %-32s\n", "----------",
+		"--------------------------", "----------------",
+		"--------------------------------");
+
+	for (i = 0; i < n; i++) {
+		struct nvme_id_ns *ns = &items[i].ns;
+		long long lba = 1 << ns->lbaf[(ns->flbas & 0x0f)].ds;
+		double nsze = le64_to_cpu(ns->nsze) * lba;
+		double nuse = le64_to_cpu(ns->nuse) * lba;
+		const char *s_suffix = suffix_si_get(&nsze);
+		const char *u_suffix = suffix_si_get(&nuse);
+		const char *l_suffix = suffix_binary_get(&lba);
+
+		if (items[i].err) {
+			printf("%-10u %s\n", items[i].nsid, items[i].err > 0 ?
+				nvme_status_to_string(items[i].err) :
+				strerror(-items[i].err));
+			continue;
+		}
+
+		sprintf(usage, "%6.2f %2sB / %6.2f %2sB", nuse, u_suffix,
+			nsze, s_suffix);
+		sprintf(format, "%3.0f %2sB + %2d B", (double)lba, l_suffix,
+			le16_to_cpu(ns->lbaf[(ns->flbas & 0x0f)].ms));
+		nguid_to_str(ns->nguid, nguid);
+		printf("%-10u %-26s %-16s %-32s\n", items[i].nsid, usage,
+			format, nguid);
+	}
+}
+
 static void print_ps_power_and_scale(__le16 ctr_power, __u8 scale)
 {
 	__u16 power = le16_to_cpu(ctr_power);
@@ -876,6 +923,10 @@ void __show_nvme_id_ctrl(struct nvme_id_ctrl *ctrl, unsigned int mode, void (*ve
 		show_nvme_id_ctrl_sanicap(ctrl->sanicap);
 	printf("hmminds : %d\n", le32_to_cpu(ctrl->hmminds));
 	printf("hmmaxd  : %d\n", le16_to_cpu(ctrl->hmmaxd));
+	printf("anatt   : %d\n", ctrl->anatt);
+	printf("anacap  : %#x\n", ctrl->anacap);
+	printf("anagrpmax : %d\n", le32_to_cpu(ctrl->anagrpmax));
+	printf("nanagrpid : %d\n", le32_to_cpu(ctrl->nanagrpid));
 	printf("sqes    : %#x\n", ctrl->sqes);
 	if (human)
 		show_nvme_id_ctrl_sqes(ctrl->sqes);
@@ -1039,6 +1090,31 @@ void show_effects_log(struct nvme_effects_log_page *effects)
 	}
 }
 
+void show_ana_log(struct nvme_ana_log *log, const char *devname)
+{
+	struct nvme_ana_group_desc *desc = NULL;
+	__u32 i, nnsids;
+
+	printf("Asymmetric Namespace Access Log for NVMe device: %s%s\n",
+	       devname, log->cached ? " (cached)" : "");
+	printf("chgcnt  : %"PRIu64"\n", (uint64_t)le64_to_cpu(log->hdr->chgcnt));
+	printf("ngrps   : %u\n", le16_to_cpu(log->hdr->ngrps));
+	while ((desc = nvme_ana_next_group(log, desc))) {
+		nnsids = le32_to_cpu(desc->nnsids);
+		printf("\ngrpid   : %u\n", le32_to_cpu(desc->grpid));
+		printf("nnsids  : %u\n", nnsids);
+		printf("chgcnt  : %"PRIu64"\n", (uint64_t)le64_to_cpu(desc->chgcnt));
+		printf("state   : %s (%#x)\n", nvme_ana_state_str(desc->state),
+		       desc->state & 0xf);
+		if (!nnsids)
+			continue;
+		printf("nsids   :");
+		for (i = 0; i < nnsids; i++)
+			printf(" %u", le32_to_cpu(desc->nsids[i]));
+		printf("\n");
+	}
+}
+
 uint64_t int48_to_long(__u8 *data)
 {
 	int i;
@@ -1453,82 +1529,88 @@ void nvme_feature_show_fields(__u32 fid, unsigned int result, unsigned char *buf
 	}
 }
 
-void json_print_list_items(struct list_item *list_items, unsigned len)
+struct json_object *json_list_item(struct list_item *item)
 {
-	struct json_object *root;
-	struct json_array *devices;
 	struct json_object *device_attrs;
 	char formatter[41] = { 0 };
-	int index, i = 0;
+	int index = -1;
 	char *product;
 	long long int lba;
 	double nsze;
 	double nuse;
 
-	root = json_create_object();
-	devices = json_create_array();
-	for (i = 0; i < len; i++) {
-		device_attrs = json_create_object();
-
-		json_object_add_value_string(device_attrs,
-					     "DevicePath",
-					     list_items[i].node);
+	device_attrs = json_create_object();
 
-		format(formatter, sizeof(formatter),
-			   list_items[i].ctrl.fr,
-			   sizeof(list_items[i].ctrl.fr));
+	json_object_add_value_string(device_attrs,
+				     "DevicePath",
+				     item->node);
 
-		json_object_add_value_string(device_attrs,
-					     "Firmware",
-					     formatter);
+	format(formatter, sizeof(formatter),
+		   item->ctrl.fr,
+		   sizeof(item->ctrl.fr));
 
-		if (sscanf(list_items[i].node, "/dev/nvmf%d", &index) == 1)
-			json_object_add_value_int(device_attrs,
-						  "Index",
-						  index);
+	json_object_add_value_string(device_attrs,
+				     "Firmware",
+				     formatter);
 
-		format(formatter, sizeof(formatter),
-		       list_items[i].ctrl.mn,
-		       sizeof(list_items[i].ctrl.mn));
-
-		json_object_add_value_string(device_attrs,
-					     "ModelNumber",
-					     formatter);
-
-		product = nvme_product_name(index);
-
-		json_object_add_value_string(device_attrs,
-					     "ProductName",
-					     product);
-
-		format(formatter, sizeof(formatter),
-		       list_items[i].ctrl.sn,
-		       sizeof(list_items[i].ctrl.sn));
-
-		json_object_add_value_string(device_attrs,
-					     "SerialNumber",
-					     formatter);
-
-		json_array_add_value_object(devices, device_attrs);
-
-		lba = 1 << list_items[i].ns.lbaf[(list_items[i].ns.flbas & 0x0f)].ds;
-		nsze = le64_to_cpu(list_items[i].ns.nsze) * lba;
-		nuse = le64_to_cpu(list_items[i].ns.nuse) * lba;
-		json_object_add_value_int(device_attrs,
-					  "UsedBytes",
-					  nuse);
-		json_object_add_value_int(device_attrs,
-					  "MaximiumLBA",
-					  le64_to_cpu(list_items[i].ns.nsze));
-		json_object_add_value_int(device_attrs,
-					  "PhysicalSize",
-					  nsze);
+	if (sscanf(item->node, "/dev/nvmf%d", &index) == 1)
 		json_object_add_value_int(device_attrs,
-					  "SectorSize",
-					  lba);
+					  "Index",
+					  index);
+
+	format(formatter, sizeof(formatter),
+	       item->ctrl.mn,
+	       sizeof(item->ctrl.mn));
+
+	json_object_add_value_string(device_attrs,
+				     "ModelNumber",
+				     formatter);
+
+	product = nvme_product_name(index);
+
+	json_object_add_value_string(device_attrs,
+				     "ProductName",
+				     product);
+
+	format(formatter, sizeof(formatter),
+	       item->ctrl.sn,
+	       sizeof(item->ctrl.sn));
+
+	json_object_add_value_string(device_attrs,
+				     "SerialNumber",
+				     formatter);
+
+	lba = 1 << item->ns.lbaf[(item->ns.flbas & 0x0f)].ds;
+	nsze = le64_to_cpu(item->ns.nsze) * lba;
+	nuse = le64_to_cpu(item->ns.nuse) * lba;
+	json_object_add_value_int(device_attrs,
+				  "UsedBytes",
+				  nuse);
+	json_object_add_value_int(device_attrs,
+				  "MaximiumLBA",
+				  le64_to_cpu(item->ns.nsze));
+	json_object_add_value_int(device_attrs,
+				  "PhysicalSize",
+				  nsze);
+	json_object_add_value_int(device_attrs,
+				  "SectorSize",
+				  lba);
+
+	free((void*)product);
+	return device_attrs;
+}
 
-		free((void*)product);
-	}
+void json_print_list_items(struct list_item *list_items, unsigned len)
+{
+	struct json_object *root;
+	struct json_array *devices;
+	int i = 0;
+
+	root = json_create_object();
+	devices = json_create_array();
+	for (i = 0; i < len; i++)
+		json_array_add_value_object(devices,
+					    json_list_item(&list_items[i]));
 	if (i)
 		json_object_add_value_array(root, "Devices", devices);
 	json_print_object(root, NULL);
@@ -1566,6 +1648,7 @@ void json_nvme_id_ns(struct nvme_id_ns *ns, unsigned int mode)
 	json_object_add_value_int(root, "nabspf", le16_to_cpu(ns->nabspf));
 	json_object_add_value_int(root, "noiob", le16_to_cpu(ns->noiob));
 	json_object_add_value_float(root, "nvmcap", nvmcap);
+	json_object_add_value_int(root, "anagrpid", le32_to_cpu(ns->anagrpid));
 
 	memset(eui64, 0, sizeof(eui64_buf));
 	for (i = 0; i < sizeof(ns->eui64); i++)
@@ -1657,6 +1740,10 @@ void json_nvme_id_ctrl(struct nvme_id_ctrl *ctrl, unsigned int mode, void (*vs)(
 	json_object_add_value_int(root, "mntmt", le16_to_cpu(ctrl->mntmt));
 	json_object_add_value_int(root, "mxtmt", le16_to_cpu(ctrl->mxtmt));
 	json_object_add_value_int(root, "sanicap", le32_to_cpu(ctrl->sanicap));
+	json_object_add_value_int(root, "anatt", ctrl->anatt);
+	json_object_add_value_int(root, "anacap", ctrl->anacap);
+	json_object_add_value_int(root, "anagrpmax", le32_to_cpu(ctrl->anagrpmax));
+	json_object_add_value_int(root, "nanagrpid", le32_to_cpu(ctrl->nanagrpid));
 	json_object_add_value_int(root, "sqes", ctrl->sqes);
 	json_object_add_value_int(root, "cqes", ctrl->cqes);
 	json_object_add_value_int(root, "maxcmd", le16_to_cpu(ctrl->maxcmd));
@@ -1901,6 +1988,47 @@ void json_smart_log(struct nvme_smart_log *smart, unsigned int nsid, const char
 	json_free_object(root);
 }
 
+static struct json_array *json_ana_groups(struct nvme_ana_log *log)
+{
+	struct nvme_ana_group_desc *desc = NULL;
+	struct json_object *grp;
+	struct json_array *groups, *nsids;
+	__u32 i, nnsids;
+
+	groups = json_create_array();
+	while ((desc = nvme_ana_next_group(log, desc))) {
+		nnsids = le32_to_cpu(desc->nnsids);
+		grp = json_create_object();
+		json_object_add_value_int(grp, "grpid", le32_to_cpu(desc->grpid));
+		json_object_add_value_int(grp, "nnsids", nnsids);
+		json_object_add_value_int(grp, "chgcnt", le64_to_cpu(desc->chgcnt));
+		json_object_add_value_string(grp, "state",
+					     nvme_ana_state_str(desc->state));
+		nsids = json_create_array();
+		for (i = 0; i < nnsids; i++)
+			json_array_add_value_int(nsids,
+				(long long)le32_to_cpu(desc->nsids[i]));
+		json_object_add_value_array(grp, "nsids", nsids);
+		json_array_add_value_object(groups, grp);
+	}
+	return groups;
+}
+
+void json_ana_log(struct nvme_ana_log *log, const char *devname)
+{
+	struct json_object *root;
+
+	root = json_create_object();
+	json_object_add_value_string(root, "device", devname);
+	json_object_add_value_int(root, "chgcnt", le64_to_cpu(log->hdr->chgcnt));
+	json_object_add_value_int(root, "ngrps", le16_to_cpu(log->hdr->ngrps));
+	json_object_add_value_array(root, "groups", json_ana_groups(log));
+
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
 void json_print_nvme_subsystem_list(struct subsys_list_item *slist, int n)
 {
 	struct json_object *root;
@@ -1935,6 +2063,10 @@ void json_print_nvme_subsystem_list(struct subsys_list_item *slist, int n)
 					slist[i].ctrls[j].transport);
 			json_object_add_value_string(path_attrs, "Address",
 					slist[i].ctrls[j].address);
+			if (slist[i].ctrls[j].ana)
+				json_object_add_value_array(path_attrs,
+					"ANAGroups",
+					json_ana_groups(slist[i].ctrls[j].ana));
 			json_array_add_value_object(paths, path_attrs);
 		}
 		if (j) {
@@ -1950,6 +2082,54 @@ void json_print_nvme_subsystem_list(struct subsys_list_item *slist, int n)
 	json_print_object(root, NULL);
 }
 
+void json_nvme_ns_list_detail(struct ns_list_item *items, int n, const char *devname)
+{
+	struct json_object *root;
+	struct json_array *namespaces;
+	struct json_object *ns_attrs;
+	char nguid[33];
+	int i;
+
+	root = json_create_object();
+	namespaces = json_create_array();
+
+	json_object_add_value_string(root, "Device", devname);
+
+	for (i = 0; i < n; i++) {
+		struct nvme_id_ns *ns = &items[i].ns;
+		long long lba = 1 << ns->lbaf[(ns->flbas & 0x0f)].ds;
+
+		ns_attrs = json_create_object();
+		json_object_add_value_int(ns_attrs, "NSID", items[i].nsid);
+		if (items[i].err) {
+			json_object_add_value_string(ns_attrs, "Error",
+				items[i].err > 0 ?
+				nvme_status_to_string(items[i].err) :
+				strerror(-items[i].err));
+			json_array_add_value_object(namespaces, ns_attrs);
+			continue;
+		}
+
+		nguid_to_str(ns->nguid, nguid);
+		json_object_add_value_int(ns_attrs, "UsedBytes",
+			le64_to_cpu(ns->nuse) * lba);
+		json_object_add_value_int(ns_attrs, "MaximumLBA",
+			le64_to_cpu(ns->nsze));
+		json_object_add_value_int(ns_attrs, "PhysicalSize",
+			le64_to_cpu(ns->nsze) * lba);
+		json_object_add_value_int(ns_attrs, "SectorSize", lba);
+		json_object_add_value_int(ns_attrs, "MetadataSize",
+			le16_to_cpu(ns->lbaf[(ns->flbas & 0x0f)].ms));
+		json_object_add_value_string(ns_attrs, "NGUID", nguid);
+		json_array_add_value_object(namespaces, ns_attrs);
+	}
+
+	json_object_add_value_array(root, "Namespaces", namespaces);
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
 void show_registers_cap(struct nvme_bar_cap *cap)
 {
 	printf("\tMemory Page Size Maximum      (MPSMAX): %u bytes\n", 1 <<  (12 + ((cap->mpsmax_mpsmin & 0xf0) >> 4)));
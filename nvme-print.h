@@ -3,6 +3,7 @@
 
 #include "nvme.h"
 #include "json.h"
+#include "nvme-ana.h"
 #include <inttypes.h>
 
 enum {
@@ -26,8 +27,10 @@ void show_error_log(struct nvme_error_log_page *err_log, int entries, const char
 void show_smart_log(struct nvme_smart_log *smart, unsigned int nsid, const char *devname);
 void show_fw_log(struct nvme_firmware_log_page *fw_log, const char *devname);
 void show_effects_log(struct nvme_effects_log_page *effects);
+void show_ana_log(struct nvme_ana_log *log, const char *devname);
 void show_ctrl_registers(void *bar, unsigned int mode, bool fabrics);
 void show_nvme_id_ns_descs(void *data);
+void show_nvme_ns_list_detail(struct ns_list_item *items, int n);
 
 void nvme_feature_show_fields(__u32 fid, unsigned int result, unsigned char *buf);
 void nvme_directive_show_fields(__u8 dtype, __u8 doper, unsigned int result, unsigned char *buf);
@@ -42,9 +45,12 @@ void json_nvme_resv_report(struct nvme_reservation_status *status, int bytes, __
 void json_error_log(struct nvme_error_log_page *err_log, int entries, const char *devname);
 void json_smart_log(struct nvme_smart_log *smart, unsigned int nsid, const char *devname);
 void json_fw_log(struct nvme_firmware_log_page *fw_log, const char *devname);
+struct json_object *json_list_item(struct list_item *item);
 void json_print_list_items(struct list_item *items, unsigned amnt);
 void json_nvme_id_ns_descs(void *data);
+void json_ana_log(struct nvme_ana_log *log, const char *devname);
 void json_print_nvme_subsystem_list(struct subsys_list_item *slist, int n);
+void json_nvme_ns_list_detail(struct ns_list_item *items, int n, const char *devname);
 
 
 #endif
@@ -0,0 +1,495 @@
+/*
+ * nvme-resolve.c -- map persistent identifiers to device nodes.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Device names like /dev/nvmf3n1 are handed out in probe order and change
+ * across reboots and fabric reconnects. This file lets every command that
+ * goes through open_dev() accept one of
+ *
+ *	serial:<controller serial number>	-> /dev/nvmfX
+ *	nguid:<namespace NGUID>			-> /dev/nvmfXnY
+ *	eui64:<namespace EUI-64>		-> /dev/nvmfXnY
+ *	uuid:<namespace UUID>			-> /dev/nvmfXnY
+ *
+ * instead. The identifiers are collected once from sysfs (falling back to
+ * the Namespace Identification Descriptor list for namespaces whose sysfs
+ * node does not export them) into a hash index, which is saved under
+ * /run so later invocations skip the scan until /dev changes.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-resolve.h"
+#include "nvme-cache.h"
+#include "hash.h"
+#include "common.h"
+
+#define SYS_NVMF		"/sys/class/nvmf"
+#define SYS_BLOCK		"/sys/block"
+#define RESOLVE_CACHE		NVME_RUN_DIR "/resolve.cache"
+#define RESOLVE_MAGIC		"nvmf-resolve 1"
+#define RESOLVE_KEY_LEN		128
+
+static const char * const resolve_prefixes[] = {
+	"serial:", "nguid:", "eui64:", "uuid:",
+};
+
+static struct hash_table resolve_index;
+static struct timespec resolve_dev_mtime;
+static bool resolve_fresh;
+
+bool nvme_resolve_is_key(const char *spec)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(resolve_prefixes); i++)
+		if (!strncmp(spec, resolve_prefixes[i],
+			     strlen(resolve_prefixes[i])))
+			return true;
+	return false;
+}
+
+/*
+ * Identifiers show up in several spellings: sysfs prints NGUIDs and UUIDs
+ * dashed, EUI-64s space separated, and users paste whatever 'nvme ns-descs'
+ * or a vendor tool gave them. Compare hex identifiers on their digits only.
+ */
+static int resolve_make_key(const char *prefix, const char *value,
+			    char *key, size_t len)
+{
+	size_t n = snprintf(key, len, "%s", prefix);
+
+	if (n >= len)
+		return -EINVAL;
+
+	if (!strcmp(prefix, "serial:")) {
+		while (isspace((unsigned char)*value))
+			value++;
+		n += snprintf(key + n, len - n, "%s", value);
+		if (n >= len)
+			return -EINVAL;
+		while (n > strlen(prefix) && isspace((unsigned char)key[n - 1]))
+			key[--n] = '\0';
+		return n > strlen(prefix) ? 0 : -EINVAL;
+	}
+
+	for (; *value; value++) {
+		if (!isxdigit((unsigned char)*value))
+			continue;
+		if (n + 1 >= len)
+			return -EINVAL;
+		key[n++] = tolower((unsigned char)*value);
+	}
+	key[n] = '\0';
+
+	/* an all-zero identifier means "not reported" */
+	if (strspn(key + strlen(prefix), "0") == strlen(key + strlen(prefix)))
+		return -EINVAL;
+	return 0;
+}
+
+static int resolve_spec_key(const char *spec, char *key, size_t len)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(resolve_prefixes); i++) {
+		size_t plen = strlen(resolve_prefixes[i]);
+
+		if (!strncmp(spec, resolve_prefixes[i], plen))
+			return resolve_make_key(resolve_prefixes[i],
+						spec + plen, key, len);
+	}
+	return -EINVAL;
+}
+
+static void resolve_add(const char *prefix, const char *value,
+			const char *path)
+{
+	char key[RESOLVE_KEY_LEN];
+	char *p;
+
+	if (resolve_make_key(prefix, value, key, sizeof(key)))
+		return;
+
+	p = strdup(path);
+	if (!p)
+		return;
+	/* several controllers of one subsystem share a serial; first wins */
+	if (hash_insert(&resolve_index, key, p))
+		free(p);
+}
+
+static int read_sysfs_attr(const char *dir, const char *name,
+			   char *buf, size_t len)
+{
+	char path[320];
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret <= 0)
+		return -EIO;
+
+	buf[ret] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static void hex_string(const __u8 *data, int len, char *out)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		out += sprintf(out, "%02x", data[i]);
+}
+
+static void resolve_add_ns_descs(void *data, const char *path)
+{
+	char str[2 * NVME_NIDT_NGUID_LEN + 1];
+	int pos, len;
+
+	for (pos = 0; pos < NVME_IDENTIFY_DATA_SIZE; pos += len) {
+		struct nvme_ns_id_desc *cur = data + pos;
+		__u8 *id = data + pos + sizeof(*cur);
+
+		if (cur->nidl == 0)
+			break;
+		len = sizeof(*cur) + cur->nidl;
+		if (pos + len > NVME_IDENTIFY_DATA_SIZE)
+			break;
+
+		switch (cur->nidt) {
+		case NVME_NIDT_EUI64:
+			hex_string(id, NVME_NIDT_EUI64_LEN, str);
+			resolve_add("eui64:", str, path);
+			break;
+		case NVME_NIDT_NGUID:
+			hex_string(id, NVME_NIDT_NGUID_LEN, str);
+			resolve_add("nguid:", str, path);
+			break;
+		case NVME_NIDT_UUID:
+			hex_string(id, NVME_NIDT_UUID_LEN, str);
+			resolve_add("uuid:", str, path);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * Older kernels don't export the namespace identifiers in sysfs; ask the
+ * device instead. The descriptor list is preferred, Identify Namespace
+ * covers 1.2 controllers that don't implement it.
+ */
+static void resolve_ns_from_device(const char *path)
+{
+	struct nvme_id_ns ns;
+	void *descs;
+	char str[2 * sizeof(ns.nguid) + 1];
+	int fd, nsid;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	nsid = nvme_get_nsid(fd);
+	if (nsid <= 0)
+		goto close_fd;
+
+	if (posix_memalign(&descs, getpagesize(), NVME_IDENTIFY_DATA_SIZE))
+		goto close_fd;
+
+	memset(descs, 0, NVME_IDENTIFY_DATA_SIZE);
+	if (!nvme_identify_ns_descs(fd, nsid, descs)) {
+		resolve_add_ns_descs(descs, path);
+	} else if (!nvme_identify_ns(fd, nsid, 0, &ns)) {
+		hex_string(ns.nguid, sizeof(ns.nguid), str);
+		resolve_add("nguid:", str, path);
+		hex_string(ns.eui64, sizeof(ns.eui64), str);
+		resolve_add("eui64:", str, path);
+	}
+	free(descs);
+close_fd:
+	close(fd);
+}
+
+static int scan_ctrl_filter(const struct dirent *d)
+{
+	int id, n = 0;
+
+	return sscanf(d->d_name, "nvmf%d%n", &id, &n) == 1 && !d->d_name[n];
+}
+
+static int scan_ns_filter(const struct dirent *d)
+{
+	int ctrl, ns, n = 0;
+
+	return sscanf(d->d_name, "nvmf%dn%d%n", &ctrl, &ns, &n) == 2 &&
+		!d->d_name[n];
+}
+
+static void resolve_scan_ctrls(void)
+{
+	struct nvme_id_ctrl ctrl;
+	struct dirent **ctrls;
+	char dir[280], path[280], sn[sizeof(ctrl.sn) + 1];
+	int i, n, fd;
+
+	n = scandir(SYS_NVMF, &ctrls, scan_ctrl_filter, alphasort);
+	if (n < 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		snprintf(dir, sizeof(dir), "%s/%s", SYS_NVMF, ctrls[i]->d_name);
+		snprintf(path, sizeof(path), "/dev/%s", ctrls[i]->d_name);
+
+		if (!read_sysfs_attr(dir, "serial", sn, sizeof(sn))) {
+			resolve_add("serial:", sn, path);
+			continue;
+		}
+
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			continue;
+		if (!nvme_identify_ctrl(fd, &ctrl)) {
+			memcpy(sn, ctrl.sn, sizeof(ctrl.sn));
+			sn[sizeof(ctrl.sn)] = '\0';
+			resolve_add("serial:", sn, path);
+		}
+		close(fd);
+	}
+
+	for (i = 0; i < n; i++)
+		free(ctrls[i]);
+	free(ctrls);
+}
+
+static void resolve_scan_namespaces(void)
+{
+	struct dirent **nss;
+	char dir[280], path[280], buf[64];
+	int i, n, found;
+
+	n = scandir(SYS_BLOCK, &nss, scan_ns_filter, alphasort);
+	if (n < 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		snprintf(dir, sizeof(dir), "%s/%s", SYS_BLOCK, nss[i]->d_name);
+		snprintf(path, sizeof(path), "/dev/%s", nss[i]->d_name);
+
+		found = 0;
+		if (!read_sysfs_attr(dir, "nguid", buf, sizeof(buf))) {
+			resolve_add("nguid:", buf, path);
+			found++;
+		}
+		if (!read_sysfs_attr(dir, "eui", buf, sizeof(buf))) {
+			resolve_add("eui64:", buf, path);
+			found++;
+		}
+		if (!read_sysfs_attr(dir, "uuid", buf, sizeof(buf))) {
+			resolve_add("uuid:", buf, path);
+			found++;
+		}
+		if (!found)
+			resolve_ns_from_device(path);
+	}
+
+	for (i = 0; i < n; i++)
+		free(nss[i]);
+	free(nss);
+}
+
+static int dev_mtime(struct timespec *ts)
+{
+	struct stat st;
+
+	if (stat("/dev", &st) < 0)
+		return -errno;
+	*ts = st.st_mtim;
+	return 0;
+}
+
+static void resolve_save(void)
+{
+	struct hash_entry *e;
+	struct iovec iov;
+	unsigned int i;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	if (mkdir(NVME_RUN_DIR, 0755) && errno != EEXIST)
+		return;
+
+	f = open_memstream(&buf, &len);
+	if (!f)
+		return;
+	fprintf(f, "%s %ld %ld\n", RESOLVE_MAGIC,
+		(long)resolve_dev_mtime.tv_sec, resolve_dev_mtime.tv_nsec);
+	hash_for_each(&resolve_index, i, e)
+		fprintf(f, "%s\t%s\n", e->key, (char *)e->data);
+
+	if (!fclose(f)) {
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		nvme_cache_write(RESOLVE_CACHE, &iov, 1, 0644);
+	}
+	free(buf);
+}
+
+/*
+ * The saved index is trusted as long as nothing was created or removed
+ * in /dev since it was written; any add/remove of a device node bumps
+ * the directory mtime.
+ */
+static int resolve_load(void)
+{
+	char line[RESOLVE_KEY_LEN + 300], *tab;
+	size_t mlen = strlen(RESOLVE_MAGIC);
+	long sec, nsec;
+	FILE *f;
+	int ret = -ESTALE;
+
+	f = fopen(RESOLVE_CACHE, "r");
+	if (!f)
+		return -errno;
+
+	if (!fgets(line, sizeof(line), f) ||
+	    strncmp(line, RESOLVE_MAGIC, mlen) ||
+	    sscanf(line + mlen, "%ld %ld", &sec, &nsec) != 2)
+		goto out;
+	if (sec != resolve_dev_mtime.tv_sec ||
+	    nsec != resolve_dev_mtime.tv_nsec)
+		goto out;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *p;
+
+		line[strcspn(line, "\n")] = '\0';
+		tab = strchr(line, '\t');
+		if (!tab)
+			continue;
+		*tab++ = '\0';
+		p = strdup(tab);
+		if (p && hash_insert(&resolve_index, line, p))
+			free(p);
+	}
+	ret = 0;
+out:
+	fclose(f);
+	return ret;
+}
+
+static int resolve_build(void)
+{
+	int ret;
+
+	hash_free(&resolve_index, free);
+	ret = hash_init(&resolve_index, 64);
+	if (ret)
+		return ret;
+
+	resolve_scan_ctrls();
+	resolve_scan_namespaces();
+	resolve_fresh = true;
+	resolve_save();
+	return 0;
+}
+
+static int resolve_prepare(void)
+{
+	int ret;
+
+	if (resolve_index.buckets)
+		return 0;
+
+	ret = dev_mtime(&resolve_dev_mtime);
+	if (ret)
+		return ret;
+
+	ret = hash_init(&resolve_index, 64);
+	if (ret)
+		return ret;
+
+	if (!resolve_load())
+		return 0;
+	return resolve_build();
+}
+
+/**
+ * nvme_resolve_dev: - translate an identifier into a device node path
+ * @spec: "serial:", "nguid:", "eui64:" or "uuid:" followed by the value
+ * @path: buffer receiving the /dev path
+ * @len: size of @path
+ *
+ * Returns 0 on success, -EINVAL for a malformed @spec and -ENODEV when no
+ * device carries the identifier.
+ */
+int nvme_resolve_dev(const char *spec, char *path, size_t len)
+{
+	char key[RESOLVE_KEY_LEN];
+	struct stat st;
+	char *dev;
+	int ret;
+
+	ret = resolve_spec_key(spec, key, sizeof(key));
+	if (ret)
+		return ret;
+
+	ret = resolve_prepare();
+	if (ret)
+		return ret;
+
+	dev = hash_lookup(&resolve_index, key);
+	if ((!dev || stat(dev, &st)) && !resolve_fresh) {
+		/* a cached answer may predate a reconnect: rescan once */
+		ret = resolve_build();
+		if (ret)
+			return ret;
+		dev = hash_lookup(&resolve_index, key);
+	}
+	if (!dev)
+		return -ENODEV;
+
+	snprintf(path, len, "%s", dev);
+	return 0;
+}
+
+/*
+ * Drop both the in-memory and the saved index, for callers that know the
+ * device set just changed.
+ */
+void nvme_resolve_invalidate(void)
+{
+	hash_free(&resolve_index, free);
+	resolve_fresh = false;
+	unlink(RESOLVE_CACHE);
+}
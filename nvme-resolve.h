@@ -0,0 +1,13 @@
+#ifndef NVME_RESOLVE_H
+#define NVME_RESOLVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NVME_RUN_DIR		"/run/nvmf"
+
+bool nvme_resolve_is_key(const char *spec);
+int nvme_resolve_dev(const char *spec, char *path, size_t len);
+void nvme_resolve_invalidate(void);
+
+#endif
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "nvme-scan.h"
+#include "nvme-cache.h"
+#include "nvme-ioctl.h"
+#include "parallel.h"
+
+/*
+ * Shared namespace enumeration for 'list' and the vendor plugin lists.
+ *
+ * Every /dev/nvmfXnY node is probed with Identify Controller and Identify
+ * Namespace on a small worker pool. The results are kept per node under
+ * NVME_SCAN_CACHE_DIR for NVME_SCAN_CACHE_TTL seconds, so running the
+ * built-in list and a plugin list back to back only goes to the devices
+ * once. A cache record is also dropped as soon as the device node it was
+ * taken from is recreated (different rdev or ctime).
+ */
+
+#define SCAN_JOBS		16
+#define SCAN_CACHE_MAGIC	"NVMFID01"
+
+static const char *dev = "/dev/";
+
+struct scan_cache_rec {
+	char		magic[8];
+	uint64_t	rdev;
+	int64_t		ctime_sec;
+	int64_t		ctime_nsec;
+	int64_t		stamp;
+	struct list_item item;
+};
+
+/* Assume every block device starting with /dev/nvmf is an nvme namespace */
+int nvme_scan_dev_filter(const struct dirent *d)
+{
+	char path[264];
+	struct stat bd;
+	int ctrl, ns, part;
+
+	if (d->d_name[0] == '.')
+		return 0;
+
+	if (strstr(d->d_name, "nvmf")) {
+		snprintf(path, sizeof(path), "%s%s", dev, d->d_name);
+		if (stat(path, &bd))
+			return 0;
+		if (!S_ISBLK(bd.st_mode))
+			return 0;
+		if (sscanf(d->d_name, "nvmf%dn%dp%d", &ctrl, &ns, &part) == 3)
+			return 0;
+		return 1;
+	}
+	return 0;
+}
+
+static const char *scan_basename(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+static void scan_cache_path(char *buf, size_t len, const char *node)
+{
+	snprintf(buf, len, "%s/%s", NVME_SCAN_CACHE_DIR, scan_basename(node));
+}
+
+static int scan_cache_load(const char *node, struct stat *st,
+			   struct list_item *item)
+{
+	struct scan_cache_rec rec;
+	char path[PATH_MAX];
+	int fd;
+	ssize_t len;
+
+	scan_cache_path(path, sizeof(path), node);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, &rec, sizeof(rec));
+	close(fd);
+
+	if (len != sizeof(rec) ||
+	    memcmp(rec.magic, SCAN_CACHE_MAGIC, sizeof(rec.magic)) ||
+	    rec.rdev != st->st_rdev ||
+	    rec.ctime_sec != st->st_ctim.tv_sec ||
+	    rec.ctime_nsec != st->st_ctim.tv_nsec ||
+	    time(NULL) - rec.stamp >= NVME_SCAN_CACHE_TTL ||
+	    strcmp(rec.item.node, node))
+		return -ESTALE;
+
+	*item = rec.item;
+	return 0;
+}
+
+static void scan_cache_store(const char *node, struct stat *st,
+			     struct list_item *item)
+{
+	struct scan_cache_rec rec;
+	char path[PATH_MAX];
+	struct iovec iov = { &rec, sizeof(rec) };
+
+	if (mkdir(NVME_RUN_DIR, 0755) && errno != EEXIST)
+		return;
+	if (mkdir(NVME_SCAN_CACHE_DIR, 0700) && errno != EEXIST)
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+	memcpy(rec.magic, SCAN_CACHE_MAGIC, sizeof(rec.magic));
+	rec.rdev = st->st_rdev;
+	rec.ctime_sec = st->st_ctim.tv_sec;
+	rec.ctime_nsec = st->st_ctim.tv_nsec;
+	rec.stamp = time(NULL);
+	rec.item = *item;
+
+	scan_cache_path(path, sizeof(path), node);
+	nvme_cache_write(path, &iov, 1, 0600);
+}
+
+/**
+ * nvme_scan_invalidate: - drop cached identify data
+ * @devname: controller ("nvmf0") or namespace ("nvmf0n1") name, or NULL
+ *	     to drop everything
+ *
+ * Invalidating a controller also drops all of its namespaces.
+ */
+void nvme_scan_invalidate(const char *devname)
+{
+	struct dirent **ents;
+	char path[PATH_MAX];
+	size_t len = devname ? strlen(devname) : 0;
+	int i, n;
+
+	n = scandir(NVME_SCAN_CACHE_DIR, &ents, NULL, NULL);
+	if (n < 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		const char *name = ents[i]->d_name;
+
+		if (name[0] != '.' && (!devname ||
+		    (!strncmp(name, devname, len) &&
+		     (name[len] == '\0' || name[len] == 'n')))) {
+			snprintf(path, sizeof(path), "%s/%s",
+				 NVME_SCAN_CACHE_DIR, name);
+			unlink(path);
+		}
+		free(ents[i]);
+	}
+	free(ents);
+}
+
+/**
+ * nvme_scan_probe: - identify one namespace node
+ * @path: /dev node to probe
+ * @item: filled in on success
+ * @flags: NVME_SCAN_FRESH to bypass (but still refresh) the cache
+ *
+ * Returns 0, a positive NVMe status or a negative errno.
+ */
+int nvme_scan_probe(const char *path, struct list_item *item, int flags)
+{
+	struct stat st;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st)) {
+		ret = -errno;
+		goto close_fd;
+	}
+
+	if (!(flags & NVME_SCAN_FRESH) && !scan_cache_load(path, &st, item)) {
+		ret = 0;
+		goto close_fd;
+	}
+
+	memset(item, 0, sizeof(*item));
+	ret = nvme_identify_ctrl(fd, &item->ctrl);
+	if (ret < 0)
+		ret = -errno;
+	if (ret)
+		goto close_fd;
+	item->nsid = nvme_get_nsid(fd);
+	if (item->nsid <= 0) {
+		ret = item->nsid < 0 ? -errno : -ENOTBLK;
+		goto close_fd;
+	}
+	ret = nvme_identify_ns(fd, item->nsid, 0, &item->ns);
+	if (ret < 0)
+		ret = -errno;
+	if (ret)
+		goto close_fd;
+	snprintf(item->node, sizeof(item->node), "%s", path);
+	item->block = S_ISBLK(st.st_mode);
+
+	scan_cache_store(path, &st, item);
+ close_fd:
+	close(fd);
+	return ret;
+}
+
+static void scan_one(unsigned int idx, void *arg)
+{
+	struct nvme_scan *scan = arg;
+	struct list_item *item = &scan->items[idx];
+	char node[sizeof(item->node)];
+
+	/* the probe clears @item, keep the name for error reporting */
+	memcpy(node, item->node, sizeof(node));
+	scan->errs[idx] = nvme_scan_probe(node, item, 0);
+	if (scan->errs[idx])
+		memcpy(item->node, node, sizeof(node));
+}
+
+/**
+ * nvme_scan_devices: - enumerate and identify every namespace node
+ * @scan: result, release with nvme_scan_free()
+ *
+ * Returns the number of nodes found or a negative errno if /dev could not
+ * be read. Per-device failures are reported through @scan->errs.
+ */
+int nvme_scan_devices(struct nvme_scan *scan)
+{
+	struct dirent **devices;
+	unsigned int i;
+	int n;
+
+	memset(scan, 0, sizeof(*scan));
+
+	n = scandir(dev, &devices, nvme_scan_dev_filter, alphasort);
+	if (n < 0)
+		return -errno;
+
+	scan->items = calloc(n ? n : 1, sizeof(*scan->items));
+	scan->errs = calloc(n ? n : 1, sizeof(*scan->errs));
+	if (!scan->items || !scan->errs) {
+		for (i = 0; i < n; i++)
+			free(devices[i]);
+		free(devices);
+		nvme_scan_free(scan);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < n; i++) {
+		snprintf(scan->items[i].node, sizeof(scan->items[i].node),
+			 "%s%s", dev, devices[i]->d_name);
+		free(devices[i]);
+	}
+	free(devices);
+	scan->n = n;
+
+	parallel_for(n, SCAN_JOBS, scan_one, scan);
+	return n;
+}
+
+void nvme_scan_free(struct nvme_scan *scan)
+{
+	free(scan->items);
+	free(scan->errs);
+	memset(scan, 0, sizeof(*scan));
+}
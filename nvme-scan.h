@@ -0,0 +1,33 @@
+#ifndef _NVME_SCAN_H
+#define _NVME_SCAN_H
+
+#include <dirent.h>
+
+#include "nvme.h"
+#include "nvme-resolve.h"
+
+#define NVME_SCAN_CACHE_DIR	NVME_RUN_DIR "/identify"
+#define NVME_SCAN_CACHE_TTL	30	/* seconds */
+
+/* nvme_scan_probe() flags */
+#define NVME_SCAN_FRESH		(1 << 0)	/* ignore cached identify data */
+
+/*
+ * Result of enumerating every namespace node under /dev. Rows are in
+ * alphasort order; a device that could not be probed keeps its node name
+ * and a negative errno or NVMe status in errs[] so callers can report it
+ * without losing the rest of the list.
+ */
+struct nvme_scan {
+	struct list_item *items;
+	int *errs;
+	unsigned int n;
+};
+
+int nvme_scan_dev_filter(const struct dirent *d);
+int nvme_scan_probe(const char *path, struct list_item *item, int flags);
+int nvme_scan_devices(struct nvme_scan *scan);
+void nvme_scan_free(struct nvme_scan *scan);
+void nvme_scan_invalidate(const char *devname);
+
+#endif
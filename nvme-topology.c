@@ -0,0 +1,115 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "nvme-topology.h"
+
+/*
+ * Host topology lookups used to size fabrics queues. Kept apart from
+ * fabrics.c because the socket headers clash with its connect().
+ */
+
+static int read_sysfs(const char *path, char *buf, size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret < 0)
+		return -1;
+	buf[ret] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+/* Number of CPUs in a sysfs cpulist such as "0-7,16-23" */
+static int cpulist_count(const char *list)
+{
+	const char *p = list;
+	int n = 0, a, b;
+
+	while (p && *p) {
+		if (sscanf(p, "%d-%d", &a, &b) == 2)
+			n += b - a + 1;
+		else if (sscanf(p, "%d", &a) == 1)
+			n++;
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+	return n;
+}
+
+/**
+ * nvme_addr_numa_node: - NUMA node of the NIC that owns a local address
+ * @addr: IPv4 or IPv6 address in presentation form
+ *
+ * Returns the node number, or -1 if the address is not configured on this
+ * host or its device does not report a node.
+ */
+int nvme_addr_numa_node(const char *addr)
+{
+	struct ifaddrs *ifa, *i;
+	char buf[INET6_ADDRSTRLEN], path[PATH_MAX], val[16];
+	const void *in;
+	int node = -1;
+
+	if (getifaddrs(&ifa))
+		return -1;
+
+	for (i = ifa; i; i = i->ifa_next) {
+		if (!i->ifa_addr)
+			continue;
+		if (i->ifa_addr->sa_family == AF_INET)
+			in = &((struct sockaddr_in *)i->ifa_addr)->sin_addr;
+		else if (i->ifa_addr->sa_family == AF_INET6)
+			in = &((struct sockaddr_in6 *)i->ifa_addr)->sin6_addr;
+		else
+			continue;
+		if (!inet_ntop(i->ifa_addr->sa_family, in, buf, sizeof(buf)) ||
+		    strcmp(buf, addr))
+			continue;
+
+		snprintf(path, sizeof(path),
+			 "/sys/class/net/%s/device/numa_node", i->ifa_name);
+		if (!read_sysfs(path, val, sizeof(val)))
+			node = atoi(val);
+		break;
+	}
+	freeifaddrs(ifa);
+	return node;
+}
+
+/**
+ * nvme_node_cpus: - number of CPUs to plan for on a NUMA node
+ * @node: node number, or -1 for the whole host
+ *
+ * Falls back to all online CPUs when the node is unknown.
+ */
+int nvme_node_cpus(int node)
+{
+	char path[PATH_MAX], buf[1024];
+	int n;
+
+	if (node >= 0) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+		if (!read_sysfs(path, buf, sizeof(buf))) {
+			n = cpulist_count(buf);
+			if (n > 0)
+				return n;
+		}
+	}
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
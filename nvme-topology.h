@@ -0,0 +1,7 @@
+#ifndef _NVME_TOPOLOGY_H
+#define _NVME_TOPOLOGY_H
+
+int nvme_addr_numa_node(const char *addr);
+int nvme_node_cpus(int node);
+
+#endif
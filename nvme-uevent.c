@@ -0,0 +1,188 @@
+/*
+ * nvme-uevent.c -- kernel uevents for NVMe controllers and namespaces.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The kernel broadcasts every device add/remove/change on the
+ * NETLINK_KOBJECT_UEVENT socket as "action@devpath\0KEY=value\0...". This
+ * file listens on that socket and hands back only the messages concerning
+ * NVMe controllers (class nvme/nvmf, including fabrics AEN notifications)
+ * and their namespace block devices.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "nvme-uevent.h"
+
+#define UEVENT_BUF_SIZE		8192
+#define UEVENT_RCVBUF		(1024 * 1024)
+
+/**
+ * nvme_uevent_open: - subscribe to kernel uevents
+ *
+ * Returns a socket to pass to nvme_uevent_recv(), or a negative errno.
+ * Binding the kernel multicast group needs no privileges.
+ */
+int nvme_uevent_open(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family	= AF_NETLINK,
+		.nl_pid		= 0,
+		.nl_groups	= 1,
+	};
+	int fd, size = UEVENT_RCVBUF;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -errno;
+
+	/* a reconnect storm produces bursts; don't drop them on the floor */
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+	return fd;
+}
+
+static void uevent_copy(char *dst, size_t len, const char *src)
+{
+	snprintf(dst, len, "%s", src);
+}
+
+static void uevent_parse(char *buf, ssize_t len, struct nvme_uevent *ev)
+{
+	char *p = buf, *end = buf + len;
+
+	memset(ev, 0, sizeof(*ev));
+	for (; p < end; p += strlen(p) + 1) {
+		if (!strncmp(p, "ACTION=", 7))
+			uevent_copy(ev->action, sizeof(ev->action), p + 7);
+		else if (!strncmp(p, "DEVPATH=", 8))
+			uevent_copy(ev->devpath, sizeof(ev->devpath), p + 8);
+		else if (!strncmp(p, "SUBSYSTEM=", 10))
+			uevent_copy(ev->subsystem, sizeof(ev->subsystem), p + 10);
+		else if (!strncmp(p, "DEVNAME=", 8))
+			uevent_copy(ev->devname, sizeof(ev->devname), p + 8);
+		else if (!strncmp(p, "DEVTYPE=", 8))
+			uevent_copy(ev->devtype, sizeof(ev->devtype), p + 8);
+		else if (!strncmp(p, "NVME_AEN=", 9))
+			uevent_copy(ev->aen, sizeof(ev->aen), p + 9);
+		else if (!strncmp(p, "NVME_EVENT=", 11))
+			uevent_copy(ev->event, sizeof(ev->event), p + 11);
+		else if (!strncmp(p, "SEQNUM=", 7))
+			ev->seqnum = strtoull(p + 7, NULL, 10);
+	}
+
+	/* DEVNAME is absent on some remove events; use the kobject name */
+	if (!ev->devname[0]) {
+		char *base = strrchr(ev->devpath, '/');
+
+		if (base)
+			uevent_copy(ev->devname, sizeof(ev->devname), base + 1);
+	}
+}
+
+static int uevent_name_match(const char *name, const char *fmt,
+			     int *a, int *b)
+{
+	int n = 0, ret;
+
+	if (b)
+		ret = sscanf(name, fmt, a, b, &n) == 2;
+	else
+		ret = sscanf(name, fmt, a, &n) == 1;
+	return ret && !name[n];
+}
+
+/**
+ * nvme_uevent_is_ctrl: - is @ev about a controller character device?
+ * @instance: set to the controller instance on a match
+ */
+bool nvme_uevent_is_ctrl(const struct nvme_uevent *ev, int *instance)
+{
+	if (strcmp(ev->subsystem, "nvmf") && strcmp(ev->subsystem, "nvme"))
+		return false;
+	return uevent_name_match(ev->devname, "nvmf%d%n", instance, NULL) ||
+		uevent_name_match(ev->devname, "nvme%d%n", instance, NULL);
+}
+
+/**
+ * nvme_uevent_is_ns: - is @ev about a namespace block device?
+ *
+ * Partitions and the hidden per-path nodes (nvmfXcYnZ) don't match.
+ */
+bool nvme_uevent_is_ns(const struct nvme_uevent *ev, int *instance, int *nsid)
+{
+	if (strcmp(ev->subsystem, "block") || strcmp(ev->devtype, "disk"))
+		return false;
+	return uevent_name_match(ev->devname, "nvmf%dn%d%n", instance, nsid) ||
+		uevent_name_match(ev->devname, "nvme%dn%d%n", instance, nsid);
+}
+
+/**
+ * nvme_uevent_recv: - wait for the next NVMe related uevent
+ * @fd: socket from nvme_uevent_open()
+ * @ev: filled in with the decoded event
+ * @timeout_ms: how long to wait, -1 to block
+ *
+ * Unrelated uevents are consumed silently. Returns 1 when @ev holds an
+ * event, 0 on timeout, or a negative errno.
+ */
+int nvme_uevent_recv(int fd, struct nvme_uevent *ev, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char buf[UEVENT_BUF_SIZE];
+	int instance, nsid, ret;
+	ssize_t len;
+
+	for (;;) {
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!ret)
+			return 0;
+
+		len = recv(fd, buf, sizeof(buf) - 1, 0);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno == ENOBUFS)
+				return -ENOBUFS;
+			return -errno;
+		}
+		buf[len] = '\0';
+
+		/* udevd rebroadcasts with a "libudev" header; only take kernel ones */
+		if (!strchr(buf, '@'))
+			continue;
+
+		uevent_parse(buf, len, ev);
+		if (nvme_uevent_is_ctrl(ev, &instance) ||
+		    nvme_uevent_is_ns(ev, &instance, &nsid))
+			return 1;
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef NVME_UEVENT_H
+#define NVME_UEVENT_H
+
+#include <stdbool.h>
+
+struct nvme_uevent {
+	char action[16];
+	char devpath[256];
+	char subsystem[32];
+	char devname[64];
+	char devtype[16];
+	char aen[32];
+	char event[32];
+	unsigned long long seqnum;
+};
+
+int nvme_uevent_open(void);
+int nvme_uevent_recv(int fd, struct nvme_uevent *ev, int timeout_ms);
+bool nvme_uevent_is_ctrl(const struct nvme_uevent *ev, int *instance);
+bool nvme_uevent_is_ns(const struct nvme_uevent *ev, int *instance, int *nsid);
+
+#endif
@@ -24,11 +24,13 @@
  * This program uses NVMe IOCTLs to run native nvme commands to a device.
  */
 
+#include <ctype.h>
 #include <endian.h>
 #include <errno.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,13 +38,16 @@
 #include <unistd.h>
 #include <math.h>
 #include <dirent.h>
+#include <time.h>
 
 #include <linux/fs.h>
+#include <linux/kcmp.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 
 #include "nvme-print.h"
@@ -54,6 +59,14 @@
 #include "suffix.h"
 
 #include "fabrics.h"
+#include "nvme-resolve.h"
+#include "parallel.h"
+#include "nvme-uevent.h"
+#include "nvme-scan.h"
+#include "nvme-path-bench.h"
+#include "nvme-batch.h"
+#include "nvme-daemon.h"
+#include "hash.h"
 
 #define array_len(x) ((size_t)(sizeof(x) / sizeof(x[0])))
 #define min(x, y) ((x) > (y) ? (y) : (x))
@@ -61,6 +74,7 @@
 
 static struct stat nvme_stat;
 const char *devicename;
+const char *runner;
 
 static const char nvme_version_string[] = NVME_VERSION;
 
@@ -81,7 +95,9 @@ static struct program nvme = {
 	.usage = "<command> [<device>] [<args>]",
 	.desc = "The '<device>' may be either an NVMe character "\
 		"device (ex: /dev/nvme0) or an nvme block device "\
-		"(ex: /dev/nvme0n1).",
+		"(ex: /dev/nvme0n1). It may also be given by a persistent "\
+		"identifier: serial:<sn> selects a controller, and "\
+		"nguid:<id>, eui64:<id> or uuid:<id> select a namespace.",
 	.extensions = &builtin,
 };
 
@@ -93,10 +109,142 @@ static unsigned long long elapsed_utime(struct timeval start_time,
 	return ret;
 }
 
+/*
+ * While 'batch' runs, open_dev() keeps every device it opens and hands
+ * out a dup of it, so a script that reads several logs from each drive
+ * opens each drive once. Most commands leave their fd for exit() to
+ * close, so the dups are tracked and closed after every command.
+ *
+ * Some commands close their fd themselves, and under 'daemon' other
+ * threads may be handed that number again before the command returns,
+ * so a tracked number is only closed if it still refers to the file the
+ * cached fd does.
+ */
+struct cached_dev {
+	int fd;
+	struct stat st;
+	char *path;
+};
+
+struct dev_dup {
+	int fd;
+	int src;
+};
+
+static struct hash_table *dev_cache;
+static struct dev_dup *dev_dups;
+static int nr_dev_dups;
+
+static void cached_dev_free(void *data)
+{
+	struct cached_dev *c = data;
+
+	close(c->fd);
+	free(c->path);
+	free(c);
+}
+
+static bool is_cached_fd(int fd)
+{
+	struct hash_entry *e;
+	unsigned int i;
+
+	hash_for_each(dev_cache, i, e)
+		if (((struct cached_dev *)e->data)->fd == fd)
+			return true;
+	return false;
+}
+
+static int cached_dev_get(struct cached_dev *c)
+{
+	struct dev_dup *tmp;
+	int fd;
+
+	tmp = realloc(dev_dups, (nr_dev_dups + 1) * sizeof(*dev_dups));
+	if (!tmp)
+		return -ENOMEM;
+	dev_dups = tmp;
+
+	fd = dup(c->fd);
+	if (fd < 0) {
+		fd = -errno;
+		perror(c->path);
+		return fd;
+	}
+	dev_dups[nr_dev_dups].fd = fd;
+	dev_dups[nr_dev_dups].src = c->fd;
+	nr_dev_dups++;
+	nvme_stat = c->st;
+	devicename = basename(c->path);
+	return fd;
+}
+
+static int cached_dev_add(const char *key, const char *path, int fd)
+{
+	struct cached_dev *c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return fd;
+	c->path = strdup(path);
+	if (!c->path || hash_insert(dev_cache, key, c)) {
+		free(c->path);
+		free(c);
+		return fd;
+	}
+	c->fd = fd;
+	c->st = nvme_stat;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return cached_dev_get(c);
+}
+
+/*
+ * Whether fd still shares its open file description with src. If the
+ * kernel can't tell, the fd is left open: leaking it is better than
+ * closing another thread's file.
+ */
+static bool same_file(int fd, int src)
+{
+	pid_t pid = getpid();
+
+	return syscall(SYS_kcmp, pid, pid, KCMP_FILE, fd, src) == 0;
+}
+
+static void cached_dev_put_all(void)
+{
+	int i;
+
+	for (i = 0; i < nr_dev_dups; i++) {
+		struct dev_dup *d = &dev_dups[i];
+
+		if (!is_cached_fd(d->fd) && same_file(d->fd, d->src))
+			close(d->fd);
+	}
+	nr_dev_dups = 0;
+}
+
 static int open_dev(const char *dev)
 {
+	static char resolved[PATH_MAX];
+	const char *key = dev;
+	struct cached_dev *c;
 	int err, fd;
 
+	if (dev_cache) {
+		c = hash_lookup(dev_cache, dev);
+		if (c)
+			return cached_dev_get(c);
+	}
+
+	if (nvme_resolve_is_key(dev)) {
+		err = nvme_resolve_dev(dev, resolved, sizeof(resolved));
+		if (err) {
+			fprintf(stderr, "%s: %s\n", dev, strerror(-err));
+			return err;
+		}
+		dev = resolved;
+	}
+
 	devicename = basename(dev);
 	err = open(dev, O_RDONLY);
 	if (err < 0)
@@ -110,6 +258,8 @@ static int open_dev(const char *dev)
 		fprintf(stderr, "%s is not a block or character device\n", dev);
 		return -ENODEV;
 	}
+	if (dev_cache)
+		return cached_dev_add(key, dev, fd);
 	return fd;
  perror:
 	perror(dev);
@@ -255,6 +405,69 @@ static int get_effects_log(int argc, char **argv, struct command *cmd, struct pl
 	return err;
 }
 
+static int get_ana_log(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Retrieve the Asymmetric Namespace Access log page "\
+		"of a controller and show the state of each ANA group and the "\
+		"namespaces in it. The log is cached per controller and only "\
+		"read in full again when its change count moves.";
+	const char *groups = "return ANA groups only, without namespace lists";
+	const char *fresh = "ignore the cached log";
+	const char *raw = "output in binary format";
+	struct nvme_ana_log log;
+	int err, fmt, fd, flags = 0;
+
+	struct config {
+		int   groups_only;
+		int   fresh;
+		int   raw_binary;
+		char *output_format;
+	};
+
+	struct config cfg = {
+		.output_format = "normal",
+	};
+
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"groups-only",   'g', "",    CFG_NONE,   &cfg.groups_only,   no_argument,       groups},
+		{"fresh",         'f', "",    CFG_NONE,   &cfg.fresh,         no_argument,       fresh},
+		{"output-format", 'o', "FMT", CFG_STRING, &cfg.output_format, required_argument, output_format },
+		{"raw-binary",    'b', "",    CFG_NONE,   &cfg.raw_binary,    no_argument,       raw},
+		{NULL}
+	};
+
+	fd = parse_and_open(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (fd < 0)
+		return fd;
+
+	fmt = validate_output_format(cfg.output_format);
+	if (fmt < 0)
+		return fmt;
+	if (cfg.raw_binary)
+		fmt = BINARY;
+	if (cfg.groups_only)
+		flags |= NVME_ANA_RGO;
+	if (cfg.fresh)
+		flags |= NVME_ANA_FRESH;
+
+	err = nvme_ana_read(fd, &log, flags);
+	if (!err) {
+		if (fmt == BINARY)
+			d_raw((unsigned char *)log.hdr, log.len);
+		else if (fmt == JSON)
+			json_ana_log(&log, devicename);
+		else
+			show_ana_log(&log, devicename);
+		nvme_ana_free(&log);
+	}
+	else if (err > 0)
+		fprintf(stderr, "NVMe Status:%s(%x)\n",
+					nvme_status_to_string(err), err);
+	else
+		perror("ana log");
+	return err;
+}
+
 static int get_error_log(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	const char *desc = "Retrieve specified number of "\
@@ -572,27 +785,108 @@ static int list_ctrl(int argc, char **argv, struct command *cmd, struct plugin *
 	return err;
 }
 
+#define NS_LIST_ENTRIES		1024
+#define NS_DETAIL_JOBS		16
+
+struct ns_detail_ctx {
+	int fd;
+	bool present;
+	struct ns_list_item *items;
+};
+
+static void ns_detail_identify(unsigned int idx, void *arg)
+{
+	struct ns_detail_ctx *ctx = arg;
+	struct ns_list_item *item = &ctx->items[idx];
+
+	item->err = nvme_identify_ns(ctx->fd, item->nsid, ctx->present,
+				     &item->ns);
+	if (item->err < 0)
+		item->err = -errno;
+}
+
+/*
+ * Collect every NSID after @start, a page of up to 1024 at a time, then
+ * issue Identify Namespace for all of them concurrently. Returns 0, an
+ * NVMe status or a negative errno.
+ */
+static int list_ns_detail(int fd, __u32 start, bool all, int fmt)
+{
+	__u32 ns_list[NS_LIST_ENTRIES];
+	struct ns_list_item *items = NULL, *tmp;
+	struct ns_detail_ctx ctx;
+	int err, i, n = 0, cnt;
+
+	for (;;) {
+		err = nvme_identify_ns_list(fd, start, all, ns_list);
+		if (err < 0)
+			err = -errno;
+		if (err)
+			goto out;
+
+		for (cnt = 0; cnt < NS_LIST_ENTRIES && ns_list[cnt]; cnt++)
+			;
+		if (!cnt)
+			break;
+
+		tmp = realloc(items, (n + cnt) * sizeof(*items));
+		if (!tmp) {
+			err = -ENOMEM;
+			goto out;
+		}
+		items = tmp;
+		for (i = 0; i < cnt; i++) {
+			memset(&items[n + i], 0, sizeof(*items));
+			items[n + i].nsid = le32_to_cpu(ns_list[i]);
+		}
+		n += cnt;
+
+		if (cnt < NS_LIST_ENTRIES)
+			break;
+		start = items[n - 1].nsid;
+	}
+
+	ctx.fd = fd;
+	ctx.present = all;
+	ctx.items = items;
+	parallel_for(n, NS_DETAIL_JOBS, ns_detail_identify, &ctx);
+
+	if (fmt == JSON)
+		json_nvme_ns_list_detail(items, n, devicename);
+	else
+		show_nvme_ns_list_detail(items, n);
+out:
+	free(items);
+	return err;
+}
+
 static int list_ns(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	const char *desc = "For the specified device, show the "\
 		"namespace list in a NVMe subsystem, optionally starting with a given namespace";
 	const char *namespace_id = "namespace number returned list should to start after";
 	const char *all = "show all namespaces in the subsystem, whether attached or inactive";
-	int err, i, fd;
-	__u32 ns_list[1024];
+	const char *detail = "identify every listed namespace and show size, usage, format and NGUID";
+	int err, fmt, i, fd;
+	__u32 ns_list[NS_LIST_ENTRIES];
 
 	struct config {
 		__u32 namespace_id;
 		int  all;
+		int  detail;
+		char *output_format;
 	};
 
 	struct config cfg = {
 		.namespace_id = 0,
+		.output_format = "normal",
 	};
 
 	const struct argconfig_commandline_options command_line_options[] = {
-		{"namespace-id", 'n', "NUM", CFG_POSITIVE, &cfg.namespace_id, required_argument, namespace_id},
-		{"all",          'a', "",    CFG_NONE,     &cfg.all,          no_argument,       all},
+		{"namespace-id",  'n', "NUM", CFG_POSITIVE, &cfg.namespace_id,  required_argument, namespace_id},
+		{"all",           'a', "",    CFG_NONE,     &cfg.all,           no_argument,       all},
+		{"detail",        'd', "",    CFG_NONE,     &cfg.detail,        no_argument,       detail},
+		{"output-format", 'o', "FMT", CFG_STRING,   &cfg.output_format, required_argument, "Output Format: normal|json"},
 		{NULL}
 	};
 
@@ -600,15 +894,32 @@ static int list_ns(int argc, char **argv, struct command *cmd, struct plugin *pl
 	if (fd < 0)
 		return fd;
 
-	err = nvme_identify_ns_list(fd, cfg.namespace_id, !!cfg.all, ns_list);
+	fmt = validate_output_format(cfg.output_format);
+	if (fmt != JSON && fmt != NORMAL) {
+		fprintf(stderr, "invalid output format: %s\n",
+			cfg.output_format);
+		return -EINVAL;
+	}
+	if (fmt == JSON && !cfg.detail) {
+		fprintf(stderr, "json output needs --detail\n");
+		return -EINVAL;
+	}
+
+	if (cfg.detail)
+		err = list_ns_detail(fd, cfg.namespace_id, !!cfg.all, fmt);
+	else
+		err = nvme_identify_ns_list(fd, cfg.namespace_id, !!cfg.all, ns_list);
 	if (!err) {
-		for (i = 0; i < 1024; i++)
-			if (ns_list[i])
-				printf("[%4u]:%#x\n", i, ns_list[i]);
+		if (!cfg.detail)
+			for (i = 0; i < NS_LIST_ENTRIES; i++)
+				if (ns_list[i])
+					printf("[%4u]:%#x\n", i, ns_list[i]);
 	}
 	else if (err > 0)
 		fprintf(stderr, "NVMe Status:%s(%x) NSID:%d\n",
 			nvme_status_to_string(err), err, cfg.namespace_id);
+	else if (cfg.detail)
+		fprintf(stderr, "id namespace list: %s\n", strerror(-err));
 	else
 		perror("id namespace list");
 	return err;
@@ -649,10 +960,11 @@ static int delete_ns(int argc, char **argv, struct command *cmd, struct plugin *
 	}
 
 	err = nvme_ns_delete(fd, cfg.namespace_id);
-	if (!err)
+	if (!err) {
 		printf("%s: Success, deleted nsid:%d\n", cmd->name,
 								cfg.namespace_id);
-	else if (err > 0)
+		nvme_scan_invalidate(NULL);
+	} else if (err > 0)
 		fprintf(stderr, "NVMe Status:%s(%x)\n",
 					nvme_status_to_string(err), err);
 	else
@@ -703,9 +1015,10 @@ static int nvme_attach_ns(int argc, char **argv, int attach, const char *desc, s
 	else
 		err = nvme_ns_detach_ctrls(fd, cfg.namespace_id, num, ctrlist);
 
-	if (!err)
+	if (!err) {
 		printf("%s: Success, nsid:%d\n", cmd->name, cfg.namespace_id);
-	else if (err > 0)
+		nvme_scan_invalidate(NULL);
+	} else if (err > 0)
 		fprintf(stderr, "NVMe Status:%s(%x)\n",
 					nvme_status_to_string(err), err);
 	else
@@ -773,9 +1086,10 @@ static int create_ns(int argc, char **argv, struct command *cmd, struct plugin *
 		return fd;
 
 	err = nvme_ns_create(fd, cfg.nsze, cfg.ncap, cfg.flbas, cfg.dps, cfg.nmic, &nsid);
-	if (!err)
+	if (!err) {
 		printf("%s: Success, created nsid:%d\n", cmd->name, nsid);
-	else if (err > 0)
+		nvme_scan_invalidate(NULL);
+	} else if (err > 0)
 		fprintf(stderr, "NVMe Status:%s(%x)\n",
 					nvme_status_to_string(err), err);
 	else
@@ -963,6 +1277,24 @@ static int scan_ctrls_filter(const struct dirent *d)
 	return 0;
 }
 
+static void print_nvme_ctrl_ana(struct nvme_ana_log *log)
+{
+	struct nvme_ana_group_desc *desc = NULL;
+	__u32 i;
+
+	while ((desc = nvme_ana_next_group(log, desc))) {
+		printf("    ANA group %u: %s", le32_to_cpu(desc->grpid),
+		       nvme_ana_state_str(desc->state));
+		if (desc->nnsids) {
+			printf(" (nsid");
+			for (i = 0; i < le32_to_cpu(desc->nnsids); i++)
+				printf(" %u", le32_to_cpu(desc->nsids[i]));
+			printf(")");
+		}
+		printf("\n");
+	}
+}
+
 void print_nvme_subsystem(struct subsys_list_item *item)
 {
 	int i;
@@ -974,6 +1306,8 @@ void print_nvme_subsystem(struct subsys_list_item *item)
 		printf(" +- %s %s %s\n", item->ctrls[i].name,
 				item->ctrls[i].transport,
 				item->ctrls[i].address);
+		if (item->ctrls[i].ana)
+			print_nvme_ctrl_ana(item->ctrls[i].ana);
 	}
 
 }
@@ -986,6 +1320,46 @@ void print_nvme_subsystem_list(struct subsys_list_item *slist, int n)
 		print_nvme_subsystem(&slist[i]);
 }
 
+/*
+ * ANA log of a controller, through the change count keyed cache so a
+ * repeated list-subsys costs one small admin command per controller.
+ */
+static struct nvme_ana_log *get_nvme_ctrl_ana(const char *name)
+{
+	struct nvme_id_ctrl ctrl;
+	struct nvme_ana_log *log;
+	char dev_path[300];
+	int fd;
+
+	snprintf(dev_path, sizeof(dev_path), "/dev/%s", name);
+	fd = open(dev_path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	/* CMIC bit 3: the controller reports ANA at all */
+	if (nvme_identify_ctrl(fd, &ctrl) || !(ctrl.cmic & (1 << 3))) {
+		close(fd);
+		return NULL;
+	}
+
+	log = malloc(sizeof(*log));
+	if (log && nvme_ana_read(fd, log, 0)) {
+		free(log);
+		log = NULL;
+	}
+	close(fd);
+	return log;
+}
+
+/* Costs an Identify and an ANA log read per controller, so only on demand */
+static void get_nvme_subsystem_ana(struct subsys_list_item *item)
+{
+	int i;
+
+	for (i = 0; i < item->nctrls; i++)
+		item->ctrls[i].ana = get_nvme_ctrl_ana(item->ctrls[i].name);
+}
+
 int get_nvme_subsystem_info(char *name, char *path,
 				struct subsys_list_item *item)
 {
@@ -1084,6 +1458,10 @@ static void free_subsys_list_item(struct subsys_list_item *item)
 		free(item->ctrls[i].name);
 		free(item->ctrls[i].transport);
 		free(item->ctrls[i].address);
+		if (item->ctrls[i].ana) {
+			nvme_ana_free(item->ctrls[i].ana);
+			free(item->ctrls[i].ana);
+		}
 	}
 
 	free(item->ctrls);
@@ -1111,6 +1489,7 @@ static int list_subsys(int argc, char **argv, struct command *cmd,
 	const char *desc = "Retrieve information for subsystems";
 	struct config {
 		char *output_format;
+		int   ana;
 	};
 
 	struct config cfg = {
@@ -1120,6 +1499,8 @@ static int list_subsys(int argc, char **argv, struct command *cmd,
 	const struct argconfig_commandline_options opts[] = {
 		{"output-format", 'o', "FMT", CFG_STRING, &cfg.output_format,
 			required_argument, "Output Format: normal|json"},
+		{"ana", 'a', "", CFG_NONE, &cfg.ana, no_argument,
+			"show the ANA group states of every path"},
 		{NULL}
 	};
 
@@ -1143,27 +1524,451 @@ static int list_subsys(int argc, char **argv, struct command *cmd,
 		goto free_subsys;
 	}
 
-	for (i = 0; i < n; i++) {
-		snprintf(path, sizeof(path), "%s%s", subsys_dir,
-			subsys[i]->d_name);
-		ret = get_nvme_subsystem_info(subsys[i]->d_name, path, &slist[i]);
-		if (ret)
-			goto free_subsys;
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s%s", subsys_dir,
+			subsys[i]->d_name);
+		ret = get_nvme_subsystem_info(subsys[i]->d_name, path, &slist[i]);
+		if (ret)
+			goto free_subsys;
+		if (cfg.ana)
+			get_nvme_subsystem_ana(&slist[i]);
+	}
+
+	if (fmt == JSON)
+		json_print_nvme_subsystem_list(slist, n);
+	else
+		print_nvme_subsystem_list(slist, n);
+
+free_subsys:
+	free_subsys_list(slist, n);
+
+	for (i = 0; i < n; i++)
+		free(subsys[i]);
+	free(subsys);
+
+	return ret;
+}
+
+#define PATH_BENCH_COUNT	1000
+#define PATH_BENCH_WARMUP	32
+#define PATH_BENCH_SIZE		4096
+#define PATH_BENCH_THRESHOLD	50
+#define PATH_BENCH_SEED		0x6e766d66
+
+struct path_bench_job {
+	struct ctrl_list_item *ctrl;
+	struct path_bench_opts *opts;
+	struct path_bench_result res;
+	__u8 ana_state;		/* 0 if the path reports no ANA state */
+	bool skipped;
+	bool asymmetric;
+};
+
+static __u8 ctrl_ana_state(struct nvme_ana_log *log, __u32 nsid)
+{
+	struct nvme_ana_group_desc *desc = NULL;
+	__u32 i;
+
+	if (!log)
+		return 0;
+	while ((desc = nvme_ana_next_group(log, desc)))
+		for (i = 0; i < le32_to_cpu(desc->nnsids); i++)
+			if (le32_to_cpu(desc->nsids[i]) == nsid)
+				return desc->state & 0xf;
+	return 0;
+}
+
+/* name is the controller itself or one of its namespace nodes */
+static bool ctrl_name_matches(const char *ctrl, const char *name)
+{
+	size_t len = strlen(ctrl);
+
+	if (strncmp(ctrl, name, len))
+		return false;
+	return !name[len] || (name[len] == 'n' && isdigit(name[len + 1]));
+}
+
+/*
+ * Look up the subsystem given by a subsystem name, a subsystem NQN, or
+ * a controller or namespace device of it.
+ */
+static int find_nvme_subsystem(const char *spec, struct subsys_list_item *item)
+{
+	char path[310], resolved[PATH_MAX];
+	struct dirent **subsys;
+	const char *name = spec;
+	int n, i, j, err;
+	bool found = false;
+
+	if (nvme_resolve_is_key(spec)) {
+		err = nvme_resolve_dev(spec, resolved, sizeof(resolved));
+		if (err)
+			return err;
+		name = resolved;
+	}
+	if (!strncmp(name, "/dev/", 5))
+		name += 5;
+
+	n = scandir(subsys_dir, &subsys, scan_subsys_filter, alphasort);
+	if (n < 0)
+		return -errno;
+
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s%s", subsys_dir,
+			 subsys[i]->d_name);
+		if (!found &&
+		    !get_nvme_subsystem_info(subsys[i]->d_name, path, item)) {
+			found = !strcmp(item->name, name) ||
+				!strcmp(item->subsysnqn, name);
+			for (j = 0; !found && j < item->nctrls; j++)
+				found = ctrl_name_matches(item->ctrls[j].name,
+							  name);
+			if (!found)
+				free_subsys_list_item(item);
+		}
+		free(subsys[i]);
+	}
+	free(subsys);
+
+	return found ? 0 : -ENODEV;
+}
+
+static void path_bench_worker(unsigned int idx, void *arg)
+{
+	struct path_bench_job *job = (struct path_bench_job *)arg + idx;
+
+	if (!job->skipped)
+		path_bench_run(job->ctrl->name, job->opts, &job->res);
+}
+
+/*
+ * A path is asymmetric when its median or 99th percentile latency or its
+ * IOPS is more than threshold percent worse than the best path's.
+ */
+static void path_bench_flag(struct path_bench_job *jobs, int n,
+			    unsigned int threshold)
+{
+	__u32 p50 = 0, p99 = 0, iops = 0;
+	__u64 t = 100 + threshold;
+	int i, ok = 0;
+
+	for (i = 0; i < n; i++) {
+		struct path_bench_result *r = &jobs[i].res;
+
+		if (jobs[i].skipped || !r->ios)
+			continue;
+		if (!ok++) {
+			p50 = r->p50;
+			p99 = r->p99;
+			iops = r->iops;
+			continue;
+		}
+		p50 = min(p50, r->p50);
+		p99 = min(p99, r->p99);
+		iops = max(iops, r->iops);
+	}
+	if (ok < 2)
+		return;
+
+	for (i = 0; i < n; i++) {
+		struct path_bench_result *r = &jobs[i].res;
+
+		if (jobs[i].skipped || !r->ios)
+			continue;
+		jobs[i].asymmetric = (__u64)r->p50 * 100 > p50 * t ||
+				     (__u64)r->p99 * 100 > p99 * t ||
+				     (__u64)r->iops * t < (__u64)iops * 100;
+	}
+}
+
+static const char *path_bench_error(struct path_bench_job *job)
+{
+	if (job->skipped)
+		return "skipped";
+	if (job->res.err > 0)
+		return nvme_status_to_string(job->res.err);
+	if (job->res.err == -ENXIO)
+		return "namespace not attached";
+	if (job->res.err == -EPROTONOSUPPORT)
+		return "no generic namespace device";
+	if (job->res.err < 0)
+		return strerror(-job->res.err);
+	return "no reads completed";
+}
+
+static void show_path_bench(struct subsys_list_item *item,
+			    struct path_bench_job *jobs,
+			    struct path_bench_opts *opts, unsigned int threshold)
+{
+	bool flagged = false;
+	int i;
+
+	printf("%s - NQN=%s\n", item->name, item->subsysnqn);
+	printf("nsid %u, %u reads of %u bytes per path, latency in usecs\n\n",
+	       opts->nsid, opts->count, opts->data_size);
+	printf("%-10s %-6s %-15s %8s %7s %7s %7s %7s %7s %7s\n", "Path",
+	       "Trtype", "ANA", "IOPS", "avg", "p50", "p90", "p99", "p99.9",
+	       "max");
+
+	for (i = 0; i < item->nctrls; i++) {
+		struct path_bench_job *job = &jobs[i];
+		struct path_bench_result *r = &job->res;
+
+		printf("%-10s %-6s %-15s ", job->ctrl->name,
+		       job->ctrl->transport,
+		       job->ana_state ? nvme_ana_state_str(job->ana_state) : "-");
+		if (job->skipped || !r->ios) {
+			printf("%s\n", path_bench_error(job));
+			continue;
+		}
+		printf("%8u %7u %7u %7u %7u %7u %7u%s\n", r->iops, r->avg,
+		       r->p50, r->p90, r->p99, r->p999, r->max,
+		       job->asymmetric ? " *" : "");
+		flagged |= job->asymmetric;
+	}
+	if (flagged)
+		printf("\n* asymmetric: p50, p99 or IOPS more than %u%% worse "
+		       "than the best path\n", threshold);
+}
+
+static void json_path_bench(struct subsys_list_item *item,
+			    struct path_bench_job *jobs,
+			    struct path_bench_opts *opts, unsigned int threshold)
+{
+	struct json_object *root, *path;
+	struct json_array *paths;
+	int i;
+
+	root = json_create_object();
+	json_object_add_value_string(root, "subsystem", item->name);
+	json_object_add_value_string(root, "nqn", item->subsysnqn);
+	json_object_add_value_int(root, "nsid", opts->nsid);
+	json_object_add_value_int(root, "count", opts->count);
+	json_object_add_value_int(root, "data_size", opts->data_size);
+	json_object_add_value_int(root, "threshold", threshold);
+
+	paths = json_create_array();
+	for (i = 0; i < item->nctrls; i++) {
+		struct path_bench_job *job = &jobs[i];
+		struct path_bench_result *r = &job->res;
+
+		path = json_create_object();
+		json_object_add_value_string(path, "name", job->ctrl->name);
+		json_object_add_value_string(path, "transport",
+					     job->ctrl->transport);
+		json_object_add_value_string(path, "address",
+					     job->ctrl->address);
+		if (job->ana_state)
+			json_object_add_value_string(path, "ana_state",
+				nvme_ana_state_str(job->ana_state));
+		if (job->skipped || !r->ios) {
+			json_object_add_value_string(path, "error",
+						     path_bench_error(job));
+		} else {
+			json_object_add_value_int(path, "ios", r->ios);
+			json_object_add_value_int(path, "iops", r->iops);
+			json_object_add_value_int(path, "avg_usecs", r->avg);
+			json_object_add_value_int(path, "min_usecs", r->min);
+			json_object_add_value_int(path, "p50_usecs", r->p50);
+			json_object_add_value_int(path, "p90_usecs", r->p90);
+			json_object_add_value_int(path, "p99_usecs", r->p99);
+			json_object_add_value_int(path, "p999_usecs", r->p999);
+			json_object_add_value_int(path, "max_usecs", r->max);
+			json_object_add_value_int(path, "asymmetric",
+						  job->asymmetric);
+		}
+		json_array_add_value_object(paths, path);
+	}
+	json_object_add_value_array(root, "paths", paths);
+
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
+/* Namespace geometry, from the first path that answers Identify */
+static int path_bench_identify(struct path_bench_job *jobs, int n,
+			       struct path_bench_opts *opts)
+{
+	__u32 ns_list[1024];
+	struct nvme_id_ns ns;
+	char path[300];
+	int i, fd, err = -ENODEV;
+
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "/dev/%s", jobs[i].ctrl->name);
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			err = -errno;
+			continue;
+		}
+		if (!opts->nsid) {
+			err = nvme_identify_ns_list(fd, 0, false, ns_list);
+			if (!err && !ns_list[0])
+				err = -ENODEV;
+			if (!err)
+				opts->nsid = le32_to_cpu(ns_list[0]);
+		}
+		if (opts->nsid)
+			err = nvme_identify_ns(fd, opts->nsid, false, &ns);
+		close(fd);
+		if (err < 0)
+			err = -errno;
+		if (!err)
+			break;
+	}
+	if (err)
+		return err;
+
+	opts->lba_shift = ns.lbaf[ns.flbas & 0xf].ds;
+	opts->nsze = le64_to_cpu(ns.nsze);
+	return 0;
+}
+
+static int path_bench(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Run the same short random read workload through "\
+		"every controller path of a subsystem, using I/O passthrough on "\
+		"each controller with the shared namespace ID, and show latency "\
+		"percentiles and IOPS per path side by side. Paths that are much "\
+		"slower than the best one are flagged. The subsystem is given by "\
+		"name, NQN, or any of its controller or namespace devices.";
+	const char *namespace_id = "namespace to read (default: first active)";
+	const char *count = "timed reads per path";
+	const char *warmup = "untimed reads per path before timing";
+	const char *data_size = "bytes per read";
+	const char *threshold = "flag paths this many percent worse than the best";
+	const char *concurrent = "run all paths at the same time";
+	struct path_bench_opts opts = { .seed = PATH_BENCH_SEED };
+	struct subsys_list_item item;
+	struct path_bench_job *jobs;
+	__u32 lba_size;
+	int err, fmt, i, ok = 0;
+
+	struct config {
+		__u32 namespace_id;
+		__u32 count;
+		__u32 warmup;
+		__u32 data_size;
+		__u32 threshold;
+		int   concurrent;
+		char *output_format;
+	};
+
+	struct config cfg = {
+		.count		= PATH_BENCH_COUNT,
+		.warmup		= PATH_BENCH_WARMUP,
+		.data_size	= PATH_BENCH_SIZE,
+		.threshold	= PATH_BENCH_THRESHOLD,
+		.output_format	= "normal",
+	};
+
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"namespace-id",  'n', "NUM", CFG_POSITIVE, &cfg.namespace_id,  required_argument, namespace_id},
+		{"count",         'c', "NUM", CFG_POSITIVE, &cfg.count,         required_argument, count},
+		{"warmup",        'w', "NUM", CFG_POSITIVE, &cfg.warmup,        required_argument, warmup},
+		{"data-size",     'z', "NUM", CFG_POSITIVE, &cfg.data_size,     required_argument, data_size},
+		{"threshold",     't', "NUM", CFG_POSITIVE, &cfg.threshold,     required_argument, threshold},
+		{"concurrent",    'C', "",    CFG_NONE,     &cfg.concurrent,    no_argument,       concurrent},
+		{"output-format", 'o', "FMT", CFG_STRING,   &cfg.output_format, required_argument, "Output format: normal|json"},
+		{NULL}
+	};
+
+	err = argconfig_parse(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (err)
+		return err;
+
+	fmt = validate_output_format(cfg.output_format);
+	if (fmt != JSON && fmt != NORMAL)
+		return -EINVAL;
+	if (optind >= argc || !cfg.count || !cfg.data_size) {
+		argconfig_print_help(desc, command_line_options);
+		return -EINVAL;
+	}
+
+	err = find_nvme_subsystem(argv[optind], &item);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-err));
+		return err;
+	}
+	get_nvme_subsystem_ana(&item);
+
+	jobs = calloc(item.nctrls, sizeof(*jobs));
+	if (!jobs) {
+		err = -ENOMEM;
+		goto free_item;
+	}
+	for (i = 0; i < item.nctrls; i++) {
+		jobs[i].ctrl = &item.ctrls[i];
+		jobs[i].opts = &opts;
+	}
+
+	opts.nsid = cfg.namespace_id;
+	err = path_bench_identify(jobs, item.nctrls, &opts);
+	if (err) {
+		if (err > 0)
+			fprintf(stderr, "NVMe Status:%s(%x)\n",
+				nvme_status_to_string(err), err);
+		else
+			fprintf(stderr, "identify namespace: %s\n",
+				strerror(-err));
+		goto free_jobs;
+	}
+
+	lba_size = 1 << opts.lba_shift;
+	opts.count = cfg.count;
+	opts.warmup = cfg.warmup;
+	opts.data_size = max(cfg.data_size / lba_size * lba_size, lba_size);
+	if (opts.data_size >> opts.lba_shift > 0x10000) {
+		fprintf(stderr, "data size above 65536 blocks\n");
+		err = -EINVAL;
+		goto free_jobs;
+	}
+
+	/* Reads through an inaccessible path would only time the error */
+	for (i = 0; i < item.nctrls; i++) {
+		jobs[i].ana_state = ctrl_ana_state(item.ctrls[i].ana, opts.nsid);
+		jobs[i].skipped = jobs[i].ana_state == NVME_ANA_INACCESSIBLE ||
+				  jobs[i].ana_state == NVME_ANA_PERSISTENT_LOSS ||
+				  jobs[i].ana_state == NVME_ANA_CHANGE;
 	}
 
-	if (fmt == JSON)
-		json_print_nvme_subsystem_list(slist, n);
-	else
-		print_nvme_subsystem_list(slist, n);
+	/* the first path that can read warms the target for all of them */
+	for (i = 0; i < item.nctrls; i++)
+		if (!jobs[i].skipped && !path_bench_prime(item.ctrls[i].name, &opts))
+			break;
 
-free_subsys:
-	free_subsys_list(slist, n);
+	if (cfg.concurrent)
+		err = parallel_for(item.nctrls, item.nctrls, path_bench_worker,
+				   jobs);
+	else
+		for (i = 0; i < item.nctrls; i++)
+			path_bench_worker(i, jobs);
+	if (err)
+		goto free_jobs;
 
-	for (i = 0; i < n; i++)
-		free(subsys[i]);
-	free(subsys);
+	path_bench_flag(jobs, item.nctrls, cfg.threshold);
+	if (fmt == JSON)
+		json_path_bench(&item, jobs, &opts, cfg.threshold);
+	else
+		show_path_bench(&item, jobs, &opts, cfg.threshold);
 
-	return ret;
+	for (i = 0; i < item.nctrls; i++) {
+		if (jobs[i].res.ios)
+			ok++;
+		else if (!err && !jobs[i].skipped)
+			err = jobs[i].res.err;
+	}
+	if (ok)
+		err = 0;
+	else if (!err)
+		err = -ENODEV;
+
+free_jobs:
+	free(jobs);
+free_item:
+	free_subsys_list_item(&item);
+	return err;
 }
 
 static void print_list_item(struct list_item list_item)
@@ -1203,59 +2008,243 @@ static void print_list_items(struct list_item *list_items, unsigned len)
 
 }
 
-static int get_nvme_info(int fd, struct list_item *item, const char *node)
+static const char *dev = "/dev/";
+
+/*
+ * The table kept by 'list --watch'. Rows stay sorted by node name so the
+ * redrawn table matches what a one-shot 'list' would print.
+ */
+struct list_table {
+	struct list_item *items;
+	unsigned int n;
+};
+
+static int list_table_find(struct list_table *t, const char *node)
 {
-	int err;
+	unsigned int i;
 
-	err = nvme_identify_ctrl(fd, &item->ctrl);
-	if (err)
-		return err;
-	item->nsid = nvme_get_nsid(fd);
-	err = nvme_identify_ns(fd, item->nsid,
-			       0, &item->ns);
-	if (err)
-		return err;
-	strcpy(item->node, node);
-	item->block = S_ISBLK(nvme_stat.st_mode);
+	for (i = 0; i < t->n; i++)
+		if (!strcmp(t->items[i].node, node))
+			return i;
+	return -1;
+}
+
+static int list_table_set(struct list_table *t, struct list_item *item)
+{
+	struct list_item *tmp;
+	unsigned int i;
+	int idx = list_table_find(t, item->node);
+
+	if (idx >= 0) {
+		t->items[idx] = *item;
+		return 0;
+	}
+
+	tmp = realloc(t->items, (t->n + 1) * sizeof(*tmp));
+	if (!tmp)
+		return -ENOMEM;
+	t->items = tmp;
 
+	for (i = t->n; i > 0; i--) {
+		if (strverscmp(t->items[i - 1].node, item->node) < 0)
+			break;
+		t->items[i] = t->items[i - 1];
+	}
+	t->items[i] = *item;
+	t->n++;
 	return 0;
 }
 
-static const char *dev = "/dev/";
+static void list_table_del(struct list_table *t, int idx)
+{
+	memmove(&t->items[idx], &t->items[idx + 1],
+		(t->n - idx - 1) * sizeof(*t->items));
+	t->n--;
+}
+
+static void list_watch_emit(int fmt, const char *action, struct list_item *item)
+{
+	struct json_object *root;
+
+	if (fmt != JSON)
+		return;
+
+	root = json_create_object();
+	json_object_add_value_int(root, "Timestamp", time(NULL));
+	json_object_add_value_string(root, "Action", action);
+	if (!strcmp(action, "remove"))
+		json_object_add_value_string(root, "DevicePath", item->node);
+	else
+		json_object_add_value_object(root, "Device",
+					     json_list_item(item));
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
+/*
+ * Re-read one namespace node and report what changed. A node that no
+ * longer answers Identify is treated as gone.
+ */
+static bool list_watch_refresh(struct list_table *t, const char *node, int fmt)
+{
+	struct list_item item;
+	int idx = list_table_find(t, node);
+
+	if (nvme_scan_probe(node, &item, NVME_SCAN_FRESH)) {
+		if (idx < 0)
+			return false;
+		list_watch_emit(fmt, "remove", &t->items[idx]);
+		list_table_del(t, idx);
+		return true;
+	}
+
+	if (idx >= 0 && !memcmp(&t->items[idx], &item, sizeof(item)))
+		return false;
+	if (list_table_set(t, &item))
+		return false;
+	list_watch_emit(fmt, idx < 0 ? "add" : "change", &item);
+	return true;
+}
 
-/* Assume every block device starting with /dev/nvme is an nvme namespace */
-static int scan_dev_filter(const struct dirent *d)
+/*
+ * Full scan used at start-up and to resynchronise after the kernel had to
+ * drop uevents (ENOBUFS). Rows that vanished are reported as removed.
+ */
+static bool list_watch_rescan(struct list_table *t, int fmt)
 {
+	struct dirent **devices;
 	char path[264];
-	struct stat bd;
-	int ctrl, ns, part;
+	bool changed = false, *seen;
+	int i, n;
 
-	if (d->d_name[0] == '.')
-		return 0;
+	n = scandir(dev, &devices, nvme_scan_dev_filter, alphasort);
+	if (n < 0)
+		n = 0;
 
-	if (strstr(d->d_name, "nvmf")) {
-		snprintf(path, sizeof(path), "%s%s", dev, d->d_name);
-		if (stat(path, &bd))
-			return 0;
-		if (!S_ISBLK(bd.st_mode))
-			return 0;
-		if (sscanf(d->d_name, "nvmf%dn%dp%d", &ctrl, &ns, &part) == 3)
-			return 0;
-		return 1;
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s%s", dev, devices[i]->d_name);
+		changed |= list_watch_refresh(t, path, fmt);
 	}
-	return 0;
+
+	seen = calloc(t->n ? t->n : 1, sizeof(*seen));
+	if (seen) {
+		for (i = 0; i < n; i++) {
+			int idx;
+
+			snprintf(path, sizeof(path), "%s%s", dev,
+				 devices[i]->d_name);
+			idx = list_table_find(t, path);
+			if (idx >= 0)
+				seen[idx] = true;
+		}
+		for (i = t->n - 1; i >= 0; i--) {
+			if (seen[i])
+				continue;
+			list_watch_emit(fmt, "remove", &t->items[i]);
+			list_table_del(t, i);
+			changed = true;
+		}
+		free(seen);
+	}
+
+	for (i = 0; i < n; i++)
+		free(devices[i]);
+	free(devices);
+	return changed;
+}
+
+static bool list_watch_event(struct list_table *t, struct nvme_uevent *ev,
+			     int fmt)
+{
+	char path[sizeof(t->items->node)], prefix[96];
+	bool changed = false;
+	int instance, nsid, i;
+
+	if (nvme_uevent_is_ns(ev, &instance, &nsid)) {
+		snprintf(path, sizeof(path), "%s%s", dev, ev->devname);
+		if (strcmp(ev->action, "remove"))
+			return list_watch_refresh(t, path, fmt);
+
+		i = list_table_find(t, path);
+		if (i < 0)
+			return false;
+		list_watch_emit(fmt, "remove", &t->items[i]);
+		list_table_del(t, i);
+		return true;
+	}
+
+	/*
+	 * A controller reset, reconnect or AEN shows up as a change on the
+	 * character device; re-identify only the namespaces behind it.
+	 * Namespace nodes announce their own add/remove.
+	 */
+	if (!nvme_uevent_is_ctrl(ev, &instance) || strcmp(ev->action, "change"))
+		return false;
+
+	snprintf(prefix, sizeof(prefix), "%s%sn", dev, ev->devname);
+	for (i = t->n - 1; i >= 0; i--) {
+		if (strncmp(t->items[i].node, prefix, strlen(prefix)))
+			continue;
+		snprintf(path, sizeof(path), "%s", t->items[i].node);
+		changed |= list_watch_refresh(t, path, fmt);
+	}
+	return changed;
+}
+
+static int list_watch(int fmt)
+{
+	struct list_table table = { NULL, 0 };
+	struct nvme_uevent ev;
+	bool changed;
+	int fd, ret;
+
+	fd = nvme_uevent_open();
+	if (fd < 0) {
+		fprintf(stderr, "failed to open uevent socket: %s\n",
+			strerror(-fd));
+		return fd;
+	}
+
+	/* subscribe before the first scan so nothing falls in between */
+	list_watch_rescan(&table, fmt);
+	changed = true;
+	for (;;) {
+		if (changed && fmt != JSON) {
+			time_t now = time(NULL);
+
+			printf("\n%s", ctime(&now));
+			print_list_items(table.items, table.n);
+		}
+		fflush(stdout);
+
+		ret = nvme_uevent_recv(fd, &ev, -1);
+		if (ret == -ENOBUFS) {
+			changed = list_watch_rescan(&table, fmt);
+			continue;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "uevent receive failed: %s\n",
+				strerror(-ret));
+			break;
+		}
+		changed = list_watch_event(&table, &ev, fmt);
+	}
+
+	close(fd);
+	free(table.items);
+	return ret;
 }
 
 static int list(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
-	char path[264];
-	struct dirent **devices;
-	struct list_item *list_items;
-	unsigned int i, n;
-	int fmt, ret, fd;
+	struct nvme_scan scan;
+	int i, n, good, fmt, ret;
 	const char *desc = "Retrieve basic information for the given device";
+	const char *watch = "keep running and update the table from kernel uevents";
 	struct config {
 		char *output_format;
+		int  watch;
 	};
 
 	struct config cfg = {
@@ -1264,6 +2253,7 @@ static int list(int argc, char **argv, struct command *cmd, struct plugin *plugi
 
 	const struct argconfig_commandline_options opts[] = {
 		{"output-format", 'o', "FMT", CFG_STRING, &cfg.output_format, required_argument, "Output Format: normal|json"},
+		{"watch",         'w', "",    CFG_NONE,   &cfg.watch,         no_argument,       watch},
 		{NULL}
 	};
 
@@ -1276,43 +2266,42 @@ static int list(int argc, char **argv, struct command *cmd, struct plugin *plugi
 	if (fmt != JSON && fmt != NORMAL)
 		return -EINVAL;
 
-	n = scandir(dev, &devices, scan_dev_filter, alphasort);
+	if (cfg.watch) {
+		if (runner) {
+			fprintf(stderr, "--watch can not be used from %s\n",
+				runner);
+			return -EINVAL;
+		}
+		return list_watch(fmt);
+	}
+
+	n = nvme_scan_devices(&scan);
 	if (n < 0) {
 		fprintf(stderr, "no NVMe device(s) detected.\n");
 		return n;
 	}
 
-	list_items = calloc(n, sizeof(*list_items));
-	if (!list_items) {
-		fprintf(stderr, "can not allocate controller list payload\n");
-		return ENOMEM;
-	}
-
-	for (i = 0; i < n; i++) {
-		snprintf(path, sizeof(path), "%s%s", dev, devices[i]->d_name);
-		fd = open(path, O_RDONLY);
-		if (fd < 0) {
-			fprintf(stderr, "can not open %s: %s\n", path,
-					strerror(errno));
-			return errno;
-		}
-		ret = get_nvme_info(fd, &list_items[i], path);
-		close(fd);
-		if (ret)
-			return ret;
+	/* a device that does not answer must not hide the others */
+	for (i = 0, good = 0; i < n; i++) {
+		ret = scan.errs[i];
+		if (ret > 0)
+			fprintf(stderr, "%s: NVMe Status:%s(%x)\n",
+				scan.items[i].node, nvme_status_to_string(ret),
+				ret);
+		else if (ret < 0)
+			fprintf(stderr, "can not probe %s: %s\n",
+				scan.items[i].node, strerror(-ret));
+		else
+			scan.items[good++] = scan.items[i];
 	}
 
 	if (fmt == JSON)
-		json_print_list_items(list_items, n);
+		json_print_list_items(scan.items, good);
 	else
-		print_list_items(list_items, n);
-
-	for (i = 0; i < n; i++)
-		free(devices[i]);
-	free(devices);
-	free(list_items);
+		print_list_items(scan.items, good);
 
-	return 0;
+	nvme_scan_free(&scan);
+	return good == n ? 0 : -EIO;
 }
 
 static int get_nsid(int fd)
@@ -1320,6 +2309,9 @@ static int get_nsid(int fd)
 	int nsid = nvme_get_nsid(fd);
 
 	if (nsid <= 0) {
+		if (errno == ENOTBLK)
+			fprintf(stderr, "Error: requesting namespace-id from "
+				"non-block device\n");
 		fprintf(stderr,
 			"%s: failed to return namespace id\n",
 			devicename);
@@ -1557,7 +2549,11 @@ static int get_ns_id(int argc, char **argv, struct command *cmd, struct plugin *
 		return fd;
 	nsid = nvme_get_nsid(fd);
 	if (nsid <= 0) {
-		perror(devicename);
+		if (errno == ENOTBLK)
+			fprintf(stderr, "Error: requesting namespace-id from "
+				"non-block device\n");
+		else
+			perror(devicename);
 		return errno;
 	}
 	printf("%s: namespace-id:%d\n", devicename, nsid);
@@ -1857,6 +2853,18 @@ static int fw_commit(int argc, char **argv, struct command *cmd, struct plugin *
 	return err;
 }
 
+/*
+ * The library only reports ENOTTY for these; keep the message and status
+ * the reset commands have always given for a namespace handle.
+ */
+static int check_ctrl_handle(void)
+{
+	if (S_ISCHR(nvme_stat.st_mode))
+		return 0;
+	fprintf(stderr, "Error: requesting reset on non-controller handle\n");
+	return ENOTBLK;
+}
+
 static int subsystem_reset(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	const char *desc = "Resets the NVMe subsystem\n";
@@ -1870,6 +2878,9 @@ static int subsystem_reset(int argc, char **argv, struct command *cmd, struct pl
 	if (fd < 0)
 		return fd;
 
+	err = check_ctrl_handle();
+	if (err)
+		return err;
 	err = nvme_subsystem_reset(fd);
 	if (err < 0) {
 		perror("Subsystem-reset");
@@ -1891,6 +2902,9 @@ static int reset(int argc, char **argv, struct command *cmd, struct plugin *plug
 	if (fd < 0)
 		return fd;
 
+	err = check_ctrl_handle();
+	if (err)
+		return err;
 	err = nvme_reset_controller(fd);
 	if (err < 0) {
 		perror("Reset");
@@ -1912,6 +2926,9 @@ static int ns_rescan(int argc, char **argv, struct command *cmd, struct plugin *
 	if (fd < 0)
 		return fd;
 
+	err = check_ctrl_handle();
+	if (err)
+		return err;
 	err = nvme_ns_rescan(fd);
 	if (err < 0) {
 		perror("Namespace Rescan");
@@ -2207,6 +3224,7 @@ static int format(int argc, char **argv, struct command *cmd, struct plugin *plu
 					nvme_status_to_string(err), err);
 	else {
 		printf("Success formatting namespace:%x\n", cfg.namespace_id);
+		nvme_scan_invalidate(NULL);
 		ioctl(fd, BLKRRPART);
 		if (cfg.reset && S_ISCHR(nvme_stat.st_mode))
 			nvme_reset_controller(fd);
@@ -3759,6 +4777,305 @@ static int disconnect_cmd(int argc, char **argv, struct command *command, struct
 	return disconnect(desc, argc, argv);
 }
 
+static int reconnect_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Delete and re-create every NVMeoF controller "\
+		"that is not live, with bounded concurrency, backoff and jitter";
+	return reconnect(desc, argc, argv);
+}
+
+static int monitor_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Print NVMe controller and namespace uevents as "\
+		"they happen, optionally running a hook, re-creating "\
+		"controllers the kernel gave up on, or dropping cached data";
+
+	if (runner) {
+		fprintf(stderr, "monitor can not run from %s\n", runner);
+		return -EINVAL;
+	}
+	return monitor(desc, argc, argv);
+}
+
+static int fabric_health_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Show the state and keep-alive/reconnect settings "\
+		"of every NVMeoF controller, and summarize connect timing "\
+		"from a fabrics log";
+	return fabric_health(desc, argc, argv);
+}
+
+static bool is_help(const char *str)
+{
+	size_t len;
+
+	while (*str == '-')
+		str++;
+	len = strlen(str);
+	return !strcmp(str, "help") ||
+		(len > 5 && !strcmp(str + len - 5, "-help"));
+}
+
+/* 'help <command>' replaces the process with man(1) */
+static bool runs_man(int argc, char **argv)
+{
+	struct plugin *extension;
+
+	if (argc > 1 && is_help(argv[0]))
+		return true;
+	for (extension = nvme.extensions->next; extension;
+	     extension = extension->next)
+		if (argc > 2 && !strcmp(argv[0], extension->name) &&
+		    is_help(argv[1]))
+			return true;
+	return false;
+}
+
+/*
+ * Run one command line for 'batch' or 'daemon'. Commands that would not
+ * return check runner themselves; this catches the ones that exec.
+ */
+static int run_in_process(int argc, char **argv)
+{
+	int err;
+
+	if (runs_man(argc, argv)) {
+		fprintf(stderr, "help can not run from %s\n", runner);
+		return -EINVAL;
+	}
+	err = handle_plugin(argc, argv, nvme.extensions);
+	cached_dev_put_all();
+	return err;
+}
+
+static int batch(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Run many commands in one process, one per line "\
+		"of a file or stdin, written as they would be typed after the "\
+		"program name or as a JSON array of strings. Each device is "\
+		"opened once and shared by every command that names it. With "\
+		"JSON output the output, error text and status of every "\
+		"command are collected into one array.";
+	const char *file = "read commands from FILE (default stdin)";
+	const char *stop = "stop at the first command that fails";
+	struct batch_capture out, errs;
+	struct hash_table cache;
+	struct batch_cmd cmd;
+	char *args[BATCH_MAX_ARGS];
+	char *line = NULL;
+	size_t size = 0;
+	int err, fmt, ret = 0, lineno = 0, n = 0, null_fd;
+	FILE *f = stdin;
+
+	struct config {
+		char *file;
+		int   stop_on_error;
+		char *output_format;
+	};
+
+	struct config cfg = {
+		.file		= "-",
+		.output_format	= "normal",
+	};
+
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"file",          'f', "FILE", CFG_STRING, &cfg.file,          required_argument, file},
+		{"stop-on-error", 'e', "",     CFG_NONE,   &cfg.stop_on_error, no_argument,       stop},
+		{"output-format", 'o', "FMT",  CFG_STRING, &cfg.output_format, required_argument, "Output format: normal|json"},
+		{NULL}
+	};
+
+	err = argconfig_parse(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (err)
+		return err;
+
+	fmt = validate_output_format(cfg.output_format);
+	if (fmt != JSON && fmt != NORMAL)
+		return -EINVAL;
+	if (dev_cache) {
+		fprintf(stderr, "batch commands can not be nested\n");
+		return -EINVAL;
+	}
+
+	if (strcmp(cfg.file, "-")) {
+		f = fopen(cfg.file, "r");
+		if (!f) {
+			perror(cfg.file);
+			return -errno;
+		}
+	} else {
+		/*
+		 * Commands that read stdin would consume the rest of the
+		 * batch; read it through a copy and give them /dev/null.
+		 */
+		null_fd = open("/dev/null", O_RDONLY);
+		err = null_fd < 0 ? -errno : dup(STDIN_FILENO);
+		if (err >= 0 && !(f = fdopen(err, "r"))) {
+			close(err);
+			err = -errno;
+		}
+		if (err >= 0 && dup2(null_fd, STDIN_FILENO) < 0) {
+			fclose(f);
+			err = -errno;
+		}
+		if (null_fd >= 0)
+			close(null_fd);
+		if (err < 0) {
+			perror("stdin");
+			return err;
+		}
+	}
+
+	err = hash_init(&cache, 32);
+	if (err)
+		goto close;
+	if (fmt == JSON) {
+		err = batch_capture_init(&out, STDOUT_FILENO);
+		if (!err) {
+			err = batch_capture_init(&errs, STDERR_FILENO);
+			if (err)
+				batch_capture_free(&out);
+		}
+		if (err) {
+			fprintf(stderr, "batch: %s\n", strerror(-err));
+			ret = err;
+			goto free;
+		}
+		printf("[");
+	}
+	dev_cache = &cache;
+	runner = "batch";
+
+	while (getline(&line, &size, f) >= 0) {
+		if (fmt == JSON) {
+			batch_capture_begin(&out);
+			batch_capture_begin(&errs);
+		}
+		err = batch_parse_line(line,
+				       strcmp(cfg.file, "-") ? cfg.file : "stdin",
+				       ++lineno, &cmd);
+		if (!err && cmd.argc) {
+			/* getopt and handle_plugin shuffle argv; keep cmd.argv to free */
+			memcpy(args, cmd.argv, (cmd.argc + 1) * sizeof(char *));
+			err = run_in_process(cmd.argc, args);
+		}
+		if (fmt == JSON) {
+			batch_capture_end(&errs);
+			batch_capture_end(&out);
+			if (err || cmd.argc) {
+				printf("%s\n", n++ ? "," : "");
+				batch_print_record(stdout, &cmd, err, &out,
+						   &errs, false);
+			}
+		}
+		batch_cmd_free(&cmd);
+
+		if (err) {
+			ret = err;
+			if (cfg.stop_on_error)
+				break;
+		}
+	}
+
+	runner = NULL;
+	dev_cache = NULL;
+	if (fmt == JSON) {
+		printf("\n]\n");
+		batch_capture_free(&errs);
+		batch_capture_free(&out);
+	}
+ free:
+	hash_free(&cache, cached_dev_free);
+	free(dev_dups);
+	dev_dups = NULL;
+	free(line);
+	err = ret;
+ close:
+	if (!strcmp(cfg.file, "-"))
+		dup2(fileno(f), STDIN_FILENO);
+	fclose(f);
+	return err;
+}
+
+static struct hash_table daemon_dev_cache;
+
+static int daemon_run(int argc, char **argv)
+{
+	return run_in_process(argc, argv);
+}
+
+static void daemon_flush(void)
+{
+	hash_free(&daemon_dev_cache, cached_dev_free);
+	hash_init(&daemon_dev_cache, 32);
+}
+
+static int daemon_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Serve requests on a Unix socket until interrupted. "\
+		"A request is a command line, as 'batch' reads them, answered "\
+		"with its JSON result on one line, or a binary admin command "\
+		"answered with its status and data. Device handles, identify "\
+		"data and listings are kept between requests, and commands to "\
+		"each controller are serialized.";
+	const char *sock = "socket path (default " NVME_DAEMON_SOCKET ")";
+	const char *workers = "number of worker threads";
+	const char *interval = "minimum usecs between commands to a controller";
+	struct nvme_daemon_opts opts = {
+		.run	= daemon_run,
+		.flush	= daemon_flush,
+	};
+	int err;
+
+	struct config {
+		char *socket;
+		__u32 workers;
+		__u32 min_interval;
+	};
+
+	struct config cfg = {
+		.socket		= NVME_DAEMON_SOCKET,
+		.workers	= NVME_DAEMON_WORKERS,
+	};
+
+	const struct argconfig_commandline_options command_line_options[] = {
+		{"socket",       's', "PATH", CFG_STRING,   &cfg.socket,       required_argument, sock},
+		{"workers",      'w', "NUM",  CFG_POSITIVE, &cfg.workers,      required_argument, workers},
+		{"min-interval", 'i', "NUM",  CFG_POSITIVE, &cfg.min_interval, required_argument, interval},
+		{NULL}
+	};
+
+	err = argconfig_parse(argc, argv, desc, command_line_options, &cfg, sizeof(cfg));
+	if (err)
+		return err;
+	if (!cfg.workers || cfg.workers > PARALLEL_MAX_WORKERS) {
+		fprintf(stderr, "--workers must be 1 to %d\n",
+			PARALLEL_MAX_WORKERS);
+		return -EINVAL;
+	}
+	if (dev_cache) {
+		fprintf(stderr, "daemon can not run from a batch\n");
+		return -EINVAL;
+	}
+
+	opts.socket = cfg.socket;
+	opts.workers = cfg.workers;
+	opts.min_interval = cfg.min_interval;
+
+	err = hash_init(&daemon_dev_cache, 32);
+	if (err)
+		return err;
+	dev_cache = &daemon_dev_cache;
+	runner = "daemon";
+	err = nvme_daemon(&opts);
+	runner = NULL;
+	dev_cache = NULL;
+	hash_free(&daemon_dev_cache, cached_dev_free);
+	free(dev_dups);
+	dev_dups = NULL;
+	return err;
+}
+
 void register_extension(struct plugin *plugin)
 {
 	plugin->parent = &nvme;
@@ -117,10 +117,19 @@ struct list_item {
 	unsigned            block;
 };
 
+struct ns_list_item {
+	__u32               nsid;
+	int                 err;
+	struct nvme_id_ns   ns;
+};
+
+struct nvme_ana_log;
+
 struct ctrl_list_item {
 	char *name;
 	char *address;
 	char *transport;
+	struct nvme_ana_log *ana;	/* NULL if the controller has none */
 };
 
 struct subsys_list_item {
@@ -143,6 +152,8 @@ int parse_and_open(int argc, char **argv, const char *desc,
 	const struct argconfig_commandline_options *clo, void *cfg, size_t size);
 
 extern const char *devicename;
+/* "batch" or "daemon" while they run command lines, which must return */
+extern const char *runner;
 
 int __id_ctrl(int argc, char **argv, struct command *cmd, struct plugin *plugin, void (*vs)(__u8 *vs, struct json_object *root));
 int	validate_output_format(char *format);
@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+struct parallel_ctx {
+	unsigned int n;
+	unsigned int next;
+	parallel_fn fn;
+	void *arg;
+};
+
+static void *parallel_worker(void *data)
+{
+	struct parallel_ctx *ctx = data;
+	unsigned int idx;
+
+	while ((idx = __sync_fetch_and_add(&ctx->next, 1)) < ctx->n)
+		ctx->fn(idx, ctx->arg);
+	return NULL;
+}
+
+unsigned int parallel_default_workers(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n < 1)
+		return 1;
+	return n > PARALLEL_MAX_WORKERS ? PARALLEL_MAX_WORKERS : n;
+}
+
+/**
+ * parallel_for: - call @fn once for every index in [0, @n)
+ * @n: number of work items
+ * @max_workers: upper bound on concurrently running calls, 0 for the
+ *		 number of online CPUs
+ * @fn: work function; called from several threads at once, so it may
+ *	only touch state belonging to its own index
+ * @arg: passed through to @fn
+ *
+ * Items are handed out in index order from a shared counter, so a slow
+ * item only holds up the worker running it. The calling thread takes part
+ * in the work, and if no extra thread can be started everything simply
+ * runs serially. Returns once every item has completed.
+ */
+int parallel_for(unsigned int n, unsigned int max_workers,
+		 parallel_fn fn, void *arg)
+{
+	struct parallel_ctx ctx = {
+		.n	= n,
+		.next	= 0,
+		.fn	= fn,
+		.arg	= arg,
+	};
+	pthread_t *threads;
+	unsigned int i, started = 0;
+
+	if (!n)
+		return 0;
+	if (!max_workers)
+		max_workers = parallel_default_workers();
+	if (max_workers > PARALLEL_MAX_WORKERS)
+		max_workers = PARALLEL_MAX_WORKERS;
+	if (max_workers > n)
+		max_workers = n;
+
+	threads = calloc(max_workers, sizeof(*threads));
+	if (threads) {
+		for (i = 1; i < max_workers; i++) {
+			if (pthread_create(&threads[started], NULL,
+					   parallel_worker, &ctx))
+				break;
+			started++;
+		}
+	}
+
+	parallel_worker(&ctx);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#define PARALLEL_MAX_WORKERS	64
+
+typedef void (*parallel_fn)(unsigned int idx, void *arg);
+
+unsigned int parallel_default_workers(void);
+int parallel_for(unsigned int n, unsigned int max_workers,
+		 parallel_fn fn, void *arg);
+
+#endif
@@ -1,11 +1,20 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "plugin.h"
 #include "argconfig.h"
 
+struct cmd_hash_entry {
+	const char *plugin;	/* NULL for the built-in commands */
+	const char *name;	/* command name or alias */
+	unsigned short index;	/* in the plugin's commands[] */
+};
+
+#include "cmd_hash.h"
+
 static int version(struct plugin *plugin)
 {
 	struct program *prog = plugin->parent;
@@ -111,13 +120,77 @@ void general_help(struct plugin *plugin)
 			prog->name);
 }
 
+static unsigned int cmd_hash_key(const char *plugin, const char *name,
+				 unsigned int mul)
+{
+	unsigned int h = 0;
+
+	if (plugin) {
+		while (*plugin)
+			h = h * mul + (unsigned char)*plugin++;
+		h = h * mul + ' ';
+	}
+	while (*name)
+		h = h * mul + (unsigned char)*name++;
+	return h;
+}
+
+/* The built-in commands and the plugins in CMD_HEADERS are all hashed */
+static bool cmd_hash_covers(struct plugin *plugin)
+{
+	const char *const *p;
+
+	if (!plugin->name)
+		return true;
+	for (p = cmd_hash_plugins; *p; p++)
+		if (!strcmp(*p, plugin->name))
+			return true;
+	return false;
+}
+
+/*
+ * Look a command up in the table gen-cmd-hash.awk built from the command
+ * headers: one bucket hash picks the multiplier that places the command
+ * in its own slot. A miss is final for the plugins the table covers;
+ * only a plugin built from a header outside CMD_HEADERS falls back to a
+ * walk of its list.
+ */
+static struct command *find_command(struct plugin *plugin, const char *str)
+{
+	const struct cmd_hash_entry *e;
+	struct command *cmd;
+	unsigned int b, i;
+
+	b = cmd_hash_key(plugin->name, str, 31) % CMD_HASH_BUCKETS;
+	e = &cmd_hash[cmd_hash_key(plugin->name, str, cmd_hash_mul[b]) %
+		      CMD_HASH_SLOTS];
+	if (e->name && !strcmp(e->name, str) &&
+	    (plugin->name ? e->plugin && !strcmp(e->plugin, plugin->name) :
+			    !e->plugin)) {
+		cmd = plugin->commands[e->index];
+		if (!strcmp(str, cmd->name) ||
+		    (cmd->alias && !strcmp(str, cmd->alias)))
+			return cmd;
+	}
+	if (cmd_hash_covers(plugin))
+		return NULL;
+
+	for (i = 0; plugin->commands[i]; i++) {
+		cmd = plugin->commands[i];
+		if (!strcmp(str, cmd->name) ||
+		    (cmd->alias && !strcmp(str, cmd->alias)))
+			return cmd;
+	}
+	return NULL;
+}
+
 int handle_plugin(int argc, char **argv, struct plugin *plugin)
 {
-	unsigned i = 0;
 	char *str = argv[0];
 	char use[0x100];
 
 	struct plugin *extension;
+	struct command *cmd;
 	struct program *prog = plugin->parent;
 
 	if (!argc) {
@@ -140,15 +213,9 @@ int handle_plugin(int argc, char **argv, struct plugin *plugin)
 	if (!strcmp(str, "version"))
 		return version(plugin);
 
-	for (; plugin->commands[i]; i++) {
-		struct command *cmd = plugin->commands[i];
-
-		if (strcmp(str, cmd->name))
-			if (!cmd->alias || (cmd->alias && strcmp(str, cmd->alias)))
-				continue;
-
-		return (cmd->fn(argc, argv, cmd, plugin));
-	}
+	cmd = find_command(plugin, str);
+	if (cmd)
+		return cmd->fn(argc, argv, cmd, plugin);
 
 	/* Check extensions only if this is running the built-in plugin */
 	if (plugin->name) { 